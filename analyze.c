@@ -0,0 +1,89 @@
+#include "analyze.h"
+#include "code.h"
+#include "header.h"
+#include "hist.h"
+#include "huffman.h"
+#include "io.h"
+#include "node.h"
+#include "perf.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Predicts the output of the default mode from the histogram of its
+   input, without coding anything.  Every Huffman code is as long as the
+   depth of its leaf, so the coded size is exact, and the entropy bounds
+   what any code table could do on the same counts. */
+void analyze_estimate(uint64_t hist[static ALPHABET], Estimate *e) {
+  e->distinct = hist_symbols(hist);
+  e->entropy = hist_entropy(hist);
+
+  /* Trees are built like the encoder builds them, with phantom symbols
+     that are in the tree but never coded. */
+  uint64_t counts[ALPHABET];
+  memcpy(counts, hist, sizeof(counts));
+  uint16_t tree_size = 0;
+  Node *tree = build_byte_tree(counts, &tree_size);
+  Code table[ALPHABET];
+  memset(table, 0, sizeof(table));
+  build_codes(tree, table);
+  e->codes = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    e->codes += hist[s] * code_size(&table[s]);
+  }
+  delete_tree(&tree);
+  e->output = sizeof(Header) + tree_size + ((e->codes + 7) / 8);
+}
+
+/* Writes one line of the report.  The columns are the kind of line, the
+   offset and length of the bytes it covers, how many different bytes
+   they have, their entropy and their Huffman codes rounded up to bytes,
+   and the bytes the default mode would write for them on their own. */
+static void report(int outfile, const char *kind, uint64_t offset,
+                   uint64_t bytes, Estimate *e) {
+  char line[160];
+  int n = snprintf(line, sizeof(line),
+                   "%s\t%" PRIu64 "\t%" PRIu64 "\t%u\t%" PRIu64 "\t%" PRIu64
+                   "\t%" PRIu64 "\n",
+                   kind, offset, bytes, e->distinct, (e->entropy + 7) / 8,
+                   (e->codes + 7) / 8, e->output);
+  write_symbols(outfile, (uint8_t *)line, n);
+}
+
+/* Runs the histogram pass of the encoder over infile and reports how well
+   it compresses to outfile, as tab-separated lines after a line naming
+   the columns.  Every io_block bytes of input get a block line of their
+   own counts, and the last line is the total of the whole input, whose
+   output column is the exact size encode would write in the default
+   mode.  Returns the bytes of input read. */
+uint64_t analyze(int infile, int outfile) {
+  const char *columns =
+      "kind\toffset\tbytes\tdistinct\tentropy\thuffman\toutput\n";
+  write_symbols(outfile, (uint8_t *)columns, strlen(columns));
+
+  uint64_t total[ALPHABET] = {0};
+  uint8_t *block = io_alloc(io_block);
+  uint64_t offset = 0;
+  int nbytes = 0;
+  Estimate e;
+
+  perf_begin("histogram");
+  while ((nbytes = read_bytes(infile, block, io_block)) > 0) {
+    uint64_t hist[ALPHABET] = {0};
+    hist_count(hist, block, nbytes);
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+      total[s] += hist[s];
+    }
+    analyze_estimate(hist, &e);
+    report(outfile, "block", offset, nbytes, &e);
+    offset += nbytes;
+  }
+  analyze_estimate(total, &e);
+  report(outfile, "total", 0, offset, &e);
+  flush_codes(outfile);
+  perf_end(offset);
+
+  free(block);
+  return offset;
+}
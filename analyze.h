@@ -0,0 +1,15 @@
+#pragma once
+
+#include "defines.h"
+#include <stdint.h>
+
+typedef struct {
+    uint32_t distinct; // Bytes that occur.
+    uint64_t entropy;  // Entropy of the bytes in bits, rounded down.
+    uint64_t codes;    // Bits of their Huffman codes.
+    uint64_t output;   // Bytes the default mode writes for them.
+} Estimate;
+
+void analyze_estimate(uint64_t hist[static ALPHABET], Estimate *e);
+
+uint64_t analyze(int infile, int outfile);
@@ -0,0 +1,530 @@
+#include "bitpack.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define CODE_MASK   ((UINT64_C(1) << PACK_MAX_LEN) - 1)
+#define UNPACK_MASK ((UINT64_C(1) << UNPACK_BITS) - 1)
+#define VECTOR_LEN  14 /* Four codes of this length fit in one 56-bit lane. */
+
+/* Codes are stored LSB first in little-endian order, so whole 64-bit
+   words can be loaded and stored with memcpy(). */
+static inline uint64_t load64(const uint8_t *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static inline void store64(uint8_t *p, uint64_t w) {
+  memcpy(p, &w, sizeof(w));
+}
+
+static inline bool leaf(Node *n) { return n->left == NULL && n->right == NULL; }
+
+/* Walks from node down to a leaf one bit at a time starting at bit pos of
+   in.  Used for the rare codes that are longer than a table lookup. */
+static inline Node *walk(Node *node, const uint8_t *in, uint64_t *pos) {
+  while (leaf(node) == false) {
+    if (((in[*pos / 8] >> (*pos % 8)) & 0x1) == 0) {
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+    *pos += 1;
+  }
+  return node;
+}
+
+/* Portable packing kernel.  Appends the codes of n symbols to out starting
+   at bit, one symbol per iteration, using a 64-bit accumulator that never
+   holds more than 7 pending bits between symbols.  Returns the new bit
+   position. */
+static uint64_t pack_portable(const uint64_t *entry, const uint8_t *in,
+                              uint32_t n, uint8_t *out, uint64_t bit) {
+  uint64_t byte = bit / 8;
+  uint32_t nacc = bit % 8;
+  uint64_t acc = out[byte] & ((1u << nacc) - 1);
+
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t e = entry[in[i]];
+    acc |= (e & CODE_MASK) << nacc;
+    nacc += e >> 56;
+    store64(out + byte, acc);
+    byte += nacc / 8;
+    acc >>= nacc & ~7u;
+    nacc %= 8;
+  }
+  store64(out + byte, acc);
+  return (byte * 8) + nacc;
+}
+
+/* Portable decoding kernel.  Resolves up to two symbols per table lookup
+   and falls back to walking the tree for codes longer than UNPACK_BITS.
+   Stops UNPACK_SLACK bytes before nbits or one symbol short of n, leaving
+   the rest to unpack_tail(). */
+static uint32_t unpack_portable(UnpackTable *t, const uint8_t *in,
+                                uint64_t *bit, uint64_t nbits, uint8_t *out,
+                                uint32_t n) {
+  uint64_t pos = *bit;
+  uint32_t k = 0;
+
+  while (k + 2 <= n && pos + (8 * UNPACK_SLACK) <= nbits) {
+    uint64_t idx = (load64(in + (pos / 8)) >> (pos % 8)) & UNPACK_MASK;
+    uint32_t e = t->entry[idx];
+
+    if ((e >> 24) == 0) {
+      pos += UNPACK_BITS;
+      out[k++] = walk(t->subtree[idx], in, &pos)->symbol;
+    } else {
+      out[k] = e & 0xFF;
+      out[k + 1] = (e >> 8) & 0xFF;
+      k += e >> 24;
+      pos += (e >> 16) & 0xFF;
+    }
+  }
+
+  *bit = pos;
+  return k;
+}
+
+/* Portable two-symbol packing kernel.  Writes one bit per byte of in, set
+   where the byte is one, so every 8 bytes become one output byte.  n must
+   be a multiple of 8. */
+static void pack_bitmap_portable(uint8_t one, const uint8_t *in, uint32_t n,
+                                 uint8_t *out) {
+  for (uint32_t i = 0; i < n; i += 8) {
+    uint8_t byte = 0;
+    for (uint32_t j = 0; j < 8; j++) {
+      byte |= (uint8_t)(in[i + j] == one) << j;
+    }
+    out[i / 8] = byte;
+  }
+}
+
+/* Portable two-symbol decoding kernel.  Expands every bit of in into a
+   byte that is one where the bit is set and zero where it is clear. */
+static void unpack_bitmap_portable(uint8_t zero, uint8_t one,
+                                   const uint8_t *in, uint32_t nbytes,
+                                   uint8_t *out) {
+  for (uint32_t i = 0; i < nbytes; i++) {
+    for (uint32_t j = 0; j < 8; j++) {
+      out[(8 * i) + j] = ((in[i] >> j) & 0x1) == 0 ? zero : one;
+    }
+  }
+}
+
+#if defined(__x86_64__)
+/* BMI2 packing kernel.  Same as pack_portable() but extracts the code with
+   bzhi, and since it is compiled for BMI2 the variable shifts become
+   shlx/shrx, which avoid the flag dependencies of the legacy shifts. */
+__attribute__((target("bmi2"))) static uint64_t
+pack_bmi2(const uint64_t *entry, const uint8_t *in, uint32_t n, uint8_t *out,
+          uint64_t bit) {
+  uint64_t byte = bit / 8;
+  uint32_t nacc = bit % 8;
+  uint64_t acc = _bzhi_u64(out[byte], nacc);
+
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t e = entry[in[i]];
+    acc |= _bzhi_u64(e, PACK_MAX_LEN) << nacc;
+    nacc += e >> 56;
+    store64(out + byte, acc);
+    byte += nacc >> 3;
+    acc >>= nacc & ~7u;
+    nacc &= 7;
+  }
+  store64(out + byte, acc);
+  return (byte * 8) + nacc;
+}
+
+/* AVX2 packing kernel for tables whose codes are at most VECTOR_LEN bits.
+   Four codes are gathered per iteration, their bit offsets are computed
+   with an in-register prefix sum of the lengths, and they are shifted into
+   place and OR-reduced into one chunk of at most 56 bits which is then
+   appended like a single code. */
+__attribute__((target("avx2,bmi2"))) static uint64_t
+pack_avx2(const uint64_t *entry, const uint8_t *in, uint32_t n, uint8_t *out,
+          uint64_t bit) {
+  uint64_t byte = bit / 8;
+  uint32_t nacc = bit % 8;
+  uint64_t acc = _bzhi_u64(out[byte], nacc);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i mask = _mm256_set1_epi64x((long long)CODE_MASK);
+  uint32_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    uint32_t four;
+    memcpy(&four, in + i, sizeof(four));
+    __m128i idx = _mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)four));
+    __m256i e = _mm256_i32gather_epi64((const long long *)entry, idx, 8);
+    __m256i len = _mm256_srli_epi64(e, 56);
+    __m256i code = _mm256_and_si256(e, mask);
+
+    /* Inclusive prefix sum of the four lengths. */
+    __m256i sum = _mm256_blend_epi32(
+        _mm256_permute4x64_epi64(len, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x03);
+    sum = _mm256_add_epi64(len, sum);
+    sum = _mm256_add_epi64(
+        sum,
+        _mm256_blend_epi32(
+            _mm256_permute4x64_epi64(sum, _MM_SHUFFLE(1, 0, 0, 0)), zero,
+            0x0F));
+
+    __m256i placed = _mm256_sllv_epi64(code, _mm256_sub_epi64(sum, len));
+    __m128i half = _mm_or_si128(_mm256_castsi256_si128(placed),
+                                _mm256_extracti128_si256(placed, 1));
+    uint64_t chunk = (uint64_t)_mm_cvtsi128_si64(half) |
+                     (uint64_t)_mm_extract_epi64(half, 1);
+
+    acc |= chunk << nacc;
+    nacc += (uint32_t)_mm256_extract_epi64(sum, 3);
+    store64(out + byte, acc);
+    byte += nacc >> 3;
+    acc >>= nacc & ~7u;
+    nacc &= 7;
+  }
+
+  store64(out + byte, acc);
+  return pack_bmi2(entry, in + i, n - i, out, (byte * 8) + nacc);
+}
+
+/* BMI2 decoding kernel.  Same as unpack_portable() but extracts the table
+   index with shrx and bzhi. */
+__attribute__((target("bmi2"))) static uint32_t
+unpack_bmi2(UnpackTable *t, const uint8_t *in, uint64_t *bit, uint64_t nbits,
+            uint8_t *out, uint32_t n) {
+  uint64_t pos = *bit;
+  uint32_t k = 0;
+
+  while (k + 2 <= n && pos + (8 * UNPACK_SLACK) <= nbits) {
+    uint64_t idx =
+        _bzhi_u64(load64(in + (pos >> 3)) >> (pos & 7), UNPACK_BITS);
+    uint32_t e = t->entry[idx];
+
+    if ((e >> 24) == 0) {
+      pos += UNPACK_BITS;
+      out[k++] = walk(t->subtree[idx], in, &pos)->symbol;
+    } else {
+      out[k] = e & 0xFF;
+      out[k + 1] = (e >> 8) & 0xFF;
+      k += e >> 24;
+      pos += (e >> 16) & 0xFF;
+    }
+  }
+
+  *bit = pos;
+  return k;
+}
+
+#define BYTES_LOW  UINT64_C(0x0101010101010101)
+#define BYTES_HIGH UINT64_C(0x8080808080808080)
+
+/* BMI2 two-symbol packing kernel.  Finds the bytes equal to one 8 at a
+   time with a SWAR zero-byte test and gathers their flags with pext. */
+__attribute__((target("bmi2"))) static void
+pack_bitmap_bmi2(uint8_t one, const uint8_t *in, uint32_t n, uint8_t *out) {
+  uint64_t ones = one * BYTES_LOW;
+  uint64_t low7 = ~BYTES_HIGH;
+
+  for (uint32_t i = 0; i < n; i += 8) {
+    uint64_t x = load64(in + i) ^ ones;
+    uint64_t nonzero = (((x & low7) + low7) | x) & BYTES_HIGH;
+    out[i / 8] = (uint8_t)_pext_u64(~nonzero, BYTES_HIGH);
+  }
+}
+
+/* AVX2 two-symbol packing kernel.  Compares 32 bytes at a time and takes
+   the byte mask of the comparison as 32 output bits. */
+__attribute__((target("avx2,bmi2"))) static void
+pack_bitmap_avx2(uint8_t one, const uint8_t *in, uint32_t n, uint8_t *out) {
+  const __m256i ones = _mm256_set1_epi8((char)one);
+  uint32_t i = 0;
+
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ones));
+    memcpy(out + (i / 8), &mask, sizeof(mask));
+  }
+  pack_bitmap_bmi2(one, in + i, n - i, out + (i / 8));
+}
+
+/* BMI2 two-symbol decoding kernel.  Spreads each input byte over the low
+   bits of 8 bytes with pdep and turns those into the two symbols. */
+__attribute__((target("bmi2"))) static void
+unpack_bitmap_bmi2(uint8_t zero, uint8_t one, const uint8_t *in,
+                   uint32_t nbytes, uint8_t *out) {
+  uint64_t zeros = zero * BYTES_LOW;
+  uint64_t flip = (uint8_t)(zero ^ one) * BYTES_LOW;
+
+  for (uint32_t i = 0; i < nbytes; i++) {
+    uint64_t set = _pdep_u64(in[i], BYTES_LOW) * 0xFF;
+    store64(out + (8 * i), zeros ^ (set & flip));
+  }
+}
+#endif
+
+typedef uint64_t PackKernel(const uint64_t *, const uint8_t *, uint32_t,
+                            uint8_t *, uint64_t);
+typedef uint32_t UnpackKernel(UnpackTable *, const uint8_t *, uint64_t *,
+                              uint64_t, uint8_t *, uint32_t);
+typedef void PackBitmap(uint8_t, const uint8_t *, uint32_t, uint8_t *);
+typedef void UnpackBitmap(uint8_t, uint8_t, const uint8_t *, uint32_t,
+                          uint8_t *);
+
+static bool selected = false;
+static PackKernel *pack_scalar = pack_portable;
+static PackKernel *pack_vector = NULL;
+static UnpackKernel *unpack_kernel = unpack_portable;
+static PackBitmap *pack_bitmap_kernel = pack_bitmap_portable;
+static UnpackBitmap *unpack_bitmap_kernel = unpack_bitmap_portable;
+static const char *kernel_name = "portable";
+
+/* Picks the fastest kernels the CPU supports.  The BITPACK environment
+   variable can cap the choice at "portable" or "bmi2" for comparisons. */
+static void select_kernels(void) {
+  if (selected == true) {
+    return;
+  }
+  selected = true;
+
+#if defined(__x86_64__)
+  char *cap = getenv("BITPACK");
+  if (cap != NULL && strcmp(cap, "portable") == 0) {
+    return;
+  }
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("bmi2")) {
+    pack_scalar = pack_bmi2;
+    unpack_kernel = unpack_bmi2;
+    pack_bitmap_kernel = pack_bitmap_bmi2;
+    unpack_bitmap_kernel = unpack_bitmap_bmi2;
+    kernel_name = "bmi2";
+
+    if (__builtin_cpu_supports("avx2") &&
+        (cap == NULL || strcmp(cap, "bmi2") != 0)) {
+      pack_vector = pack_avx2;
+      pack_bitmap_kernel = pack_bitmap_avx2;
+      kernel_name = "avx2";
+    }
+  }
+#endif
+}
+
+/* Returns the name of the kernels in use. */
+const char *bitpack_kernel(void) {
+  select_kernels();
+  return kernel_name;
+}
+
+/* Compiles the code table into one 64-bit word per symbol for the packing
+   kernels.  The table is marked invalid if any code is longer than
+   PACK_MAX_LEN bits, in which case pack_symbols() packs nothing and the
+   caller has to use write_code(). */
+void pack_create(PackTable *t, Code table[static ALPHABET]) {
+  select_kernels();
+  t->codes = table;
+  t->max_len = 0;
+  t->valid = true;
+
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    uint32_t len = code_size(&table[s]);
+    uint64_t bits = 0;
+
+    if (len > PACK_MAX_LEN) {
+      t->valid = false;
+    }
+    for (uint32_t b = 0; b < len && b < PACK_MAX_LEN; b++) {
+      if (code_get_bit(&table[s], b) == true) {
+        bits |= UINT64_C(1) << b;
+      }
+    }
+
+    t->entry[s] = bits | ((uint64_t)len << 56);
+    if (len > t->max_len) {
+      t->max_len = len;
+    }
+  }
+}
+
+/* Packs the codes of as many of the n symbols of in as safely fit into
+   out, which holds capacity bits, starting at *bit.  The kernels store
+   whole words, so packing stops 64 bits short of capacity.  Returns how
+   many symbols were packed and advances *bit past them. */
+uint32_t pack_symbols(PackTable *t, const uint8_t *in, uint32_t n,
+                      uint8_t *out, uint64_t *bit, uint64_t capacity) {
+  if (t->valid == false || t->max_len == 0 ||
+      *bit + 64 + t->max_len > capacity) {
+    return 0;
+  }
+
+  uint64_t room = (capacity - *bit - 64) / t->max_len;
+  if (room < n) {
+    n = room;
+  }
+
+  if (pack_vector != NULL && t->max_len <= VECTOR_LEN) {
+    *bit = pack_vector(t->entry, in, n, out, *bit);
+  } else {
+    *bit = pack_scalar(t->entry, in, n, out, *bit);
+  }
+  return n;
+}
+
+/* Packs the codes of all n symbols of in into out starting at *bit, which
+   must have room for their bits plus 8 bytes.  Codes too long for the
+   kernels are appended a bit at a time.  Advances *bit past the codes. */
+void pack_codes(PackTable *t, const uint8_t *in, uint32_t n, uint8_t *out,
+                uint64_t *bit) {
+  uint32_t i = pack_symbols(t, in, n, out, bit, UINT64_MAX);
+  for (; i < n; i++) {
+    Code *c = &t->codes[in[i]];
+    for (uint32_t b = 0; b < code_size(c); b++, *bit += 1) {
+      if (*bit % 8 == 0) {
+        out[*bit / 8] = 0;
+      }
+      out[*bit / 8] |= (uint8_t)code_get_bit(c, b) << (*bit % 8);
+    }
+  }
+}
+
+/* Builds the decode table of the Huffman tree given by root.  Each entry
+   of the table is indexed by the next UNPACK_BITS bits of input and holds
+   up to two symbols (bits 0-15), their total length (bits 16-23) and the
+   symbol count (bits 24-31).  A count of 0 means the code is longer than
+   the lookup, in which case the walk continues from the subtree. */
+void unpack_create(UnpackTable *t, Node *root) {
+  select_kernels();
+
+  for (uint32_t i = 0; i < (1u << UNPACK_BITS); i++) {
+    Node *first = root;
+    uint32_t len = 0;
+    while (len < UNPACK_BITS && leaf(first) == false) {
+      first = ((i >> len) & 0x1) == 0 ? first->left : first->right;
+      len++;
+    }
+
+    if (leaf(first) == false) {
+      t->entry[i] = 0;
+      t->subtree[i] = first;
+      continue;
+    }
+
+    Node *second = root;
+    uint32_t total = len;
+    while (total < UNPACK_BITS && leaf(second) == false) {
+      second = ((i >> total) & 0x1) == 0 ? second->left : second->right;
+      total++;
+    }
+
+    if (leaf(second) == true && total > len) {
+      t->entry[i] = first->symbol | ((uint32_t)second->symbol << 8) |
+                    (total << 16) | (2u << 24);
+    } else {
+      t->entry[i] = first->symbol | (len << 16) | (1u << 24);
+    }
+    t->subtree[i] = NULL;
+  }
+}
+
+/* Decodes up to n symbols from in, which holds nbits bits, starting at
+   *bit.  Returns how many symbols were decoded and advances *bit past
+   them.  Only the part of the input that has UNPACK_SLACK bytes after it
+   is decoded; the remainder is decoded with unpack_tail(). */
+uint32_t unpack_symbols(UnpackTable *t, const uint8_t *in, uint64_t *bit,
+                        uint64_t nbits, uint8_t *out, uint32_t n) {
+  return unpack_kernel(t, in, bit, nbits, out, n);
+}
+
+/* Decodes up to n symbols from the last bits of the input by walking the
+   tree one bit at a time, stopping at the first code that isn't complete
+   within nbits.  Returns how many symbols were decoded. */
+uint32_t unpack_tail(Node *root, const uint8_t *in, uint64_t *bit,
+                     uint64_t nbits, uint8_t *out, uint32_t n) {
+  uint32_t k = 0;
+
+  while (k < n) {
+    Node *node = root;
+    uint64_t pos = *bit;
+
+    while (leaf(node) == false && pos < nbits) {
+      if (((in[pos / 8] >> (pos % 8)) & 0x1) == 0) {
+        node = node->left;
+      } else {
+        node = node->right;
+      }
+      pos++;
+    }
+
+    if (leaf(node) == false) {
+      break;
+    }
+    out[k++] = node->symbol;
+    *bit = pos;
+  }
+  return k;
+}
+
+/* Allocates the buffer of coded input that is read block bytes at a
+   time.  Returns false if it can't be allocated. */
+bool unpack_input_create(UnpackInput *u, uint32_t block) {
+  u->in = (uint8_t *)calloc((2 * (uint64_t)block) + UNPACK_SLACK, 1);
+  u->block = block;
+  u->have = 0;
+  u->bit = 0;
+  u->eof = false;
+  return u->in != NULL;
+}
+
+/* Moves the bytes that hold codes not decoded yet to the front of the
+   buffer, which leaves room for another block once less than a block is
+   left. */
+void unpack_shift(UnpackInput *u) {
+  uint32_t used = u->bit / 8;
+  memmove(u->in, u->in + used, u->have - used);
+  u->have -= used;
+  u->bit -= 8 * (uint64_t)used;
+}
+
+/* Reads another block from infile with fill once less than a block is
+   left to decode, so the decoders always have a block of lookahead until
+   the end of input, and zeroes the bytes after the input that they may
+   load.  Returns the bytes read. */
+int unpack_refill(UnpackInput *u, int infile,
+                  int (*fill)(int infile, uint8_t *buf, int nbytes)) {
+  if (u->eof == true || u->have - (u->bit / 8) >= u->block) {
+    return 0;
+  }
+  unpack_shift(u);
+  int got = fill(infile, u->in + u->have, u->block);
+  u->have += got;
+  u->eof = got < (int)u->block;
+  memset(u->in + u->have, 0, UNPACK_SLACK);
+  return got;
+}
+
+/* Frees the buffer of coded input. */
+void unpack_input_delete(UnpackInput *u) {
+  free(u->in);
+  u->in = NULL;
+}
+
+/* Packs the n bytes of in, which may only hold two different symbols,
+   into one bit per byte that is set where the byte is one.  This is the
+   code of every symbol when a tree has just two leaves.  n must be a
+   multiple of 8. */
+void pack_bitmap(uint8_t one, const uint8_t *in, uint32_t n, uint8_t *out) {
+  select_kernels();
+  pack_bitmap_kernel(one, in, n, out);
+}
+
+/* Expands the nbytes bytes of in into 8 * nbytes symbols, zero for every
+   clear bit and one for every set bit. */
+void unpack_bitmap(uint8_t zero, uint8_t one, const uint8_t *in,
+                   uint32_t nbytes, uint8_t *out) {
+  select_kernels();
+  unpack_bitmap_kernel(zero, one, in, nbytes, out);
+}
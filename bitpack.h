@@ -0,0 +1,63 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include "node.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PACK_MAX_LEN 56   // Longest code the packing kernels handle.
+#define UNPACK_BITS  11   // Bits resolved by one decode table lookup.
+#define UNPACK_SLACK 40   // Readable bytes the decode kernel needs ahead.
+
+typedef struct {
+    uint64_t entry[ALPHABET]; // Code bits with the length in the top byte.
+    uint32_t max_len;
+    bool valid;               // False if a code exceeds PACK_MAX_LEN bits.
+    Code *codes;
+} PackTable;
+
+typedef struct {
+    uint32_t entry[1 << UNPACK_BITS];
+    Node *subtree[1 << UNPACK_BITS];
+} UnpackTable;
+
+typedef struct {
+    uint8_t *in;    // Coded input, with room for two blocks.
+    uint32_t block; // Bytes read at a time.
+    uint32_t have;  // Bytes held in in.
+    uint64_t bit;   // Position of the next code in in.
+    bool eof;       // True once a read came up short.
+} UnpackInput;
+
+void pack_create(PackTable *t, Code table[static ALPHABET]);
+
+uint32_t pack_symbols(PackTable *t, const uint8_t *in, uint32_t n,
+                      uint8_t *out, uint64_t *bit, uint64_t capacity);
+
+void pack_codes(PackTable *t, const uint8_t *in, uint32_t n, uint8_t *out,
+                uint64_t *bit);
+
+void unpack_create(UnpackTable *t, Node *root);
+
+uint32_t unpack_symbols(UnpackTable *t, const uint8_t *in, uint64_t *bit,
+                        uint64_t nbits, uint8_t *out, uint32_t n);
+
+uint32_t unpack_tail(Node *root, const uint8_t *in, uint64_t *bit,
+                     uint64_t nbits, uint8_t *out, uint32_t n);
+
+bool unpack_input_create(UnpackInput *u, uint32_t block);
+
+void unpack_shift(UnpackInput *u);
+
+int unpack_refill(UnpackInput *u, int infile,
+                  int (*fill)(int infile, uint8_t *buf, int nbytes));
+
+void unpack_input_delete(UnpackInput *u);
+
+void pack_bitmap(uint8_t one, const uint8_t *in, uint32_t n, uint8_t *out);
+
+void unpack_bitmap(uint8_t zero, uint8_t one, const uint8_t *in,
+                   uint32_t nbytes, uint8_t *out);
+
+const char *bitpack_kernel(void);
@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+#include "cache.h"
+#include "header.h"
+#include "io.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* A cache directory holds the compressed form of inputs compressed
+   before, one file per input named after the 128-bit digest of its bytes,
+   its size and the mode it was compressed in.  An entry is written under
+   a temporary name next to it and renamed once it is complete, so an
+   interrupted encoder never leaves a partial entry behind and encoders
+   sharing the directory never see one. */
+
+/* Names the entry of an input of size bytes with the given digest, which
+   was compressed in the mode given by a letter. */
+void cache_name(Cache *c, uint64_t digest[static 2], uint64_t size,
+                char mode) {
+  snprintf(c->name, sizeof(c->name), "%016" PRIx64 "%016" PRIx64 "-%" PRIx64
+           ".%c", digest[0], digest[1], size, mode);
+}
+
+/* Copies from its current offset to its end to the current offset of
+   to, and returns the bytes copied.  Files are copied in the kernel, which
+   may share their blocks, and anything else like a pipe is copied with
+   reads and writes. */
+static uint64_t copy_rest(int from, int to) {
+  uint64_t copied = 0;
+  ssize_t n = 0;
+  while ((n = copy_file_range(from, NULL, to, NULL, IO_BLOCK_MAX, 0)) > 0) {
+    copied += n;
+  }
+  if (n < 0) {
+    uint8_t *buf = io_alloc(io_block);
+    int nbytes = 0;
+    while ((nbytes = read_bytes(from, buf, io_block)) > 0) {
+      copied += write_bytes(to, buf, nbytes);
+    }
+    free(buf);
+  }
+  return copied;
+}
+
+/* Copies the entry of the input to outfile with the given permissions in
+   its header, if the cache has one.  Returns false if it hasn't. */
+bool cache_fetch(Cache *c, int outfile, uint16_t permissions) {
+  char path[CACHE_PATH];
+  snprintf(path, sizeof(path), "%s/%s", c->dir, c->name);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  Header header;
+  if (read_bytes(fd, (uint8_t *)&header, sizeof(header)) != sizeof(header)) {
+    close(fd);
+    return false;
+  }
+  header.permissions = permissions;
+  bytes_written += write_bytes(outfile, (uint8_t *)&header, sizeof(header));
+  bytes_written += copy_rest(fd, outfile);
+  close(fd);
+  return true;
+}
+
+/* Starts a new entry for the input, which is copied to outfile when it is
+   committed.  Returns the descriptor to write the compressed input to,
+   which is outfile itself if the entry can't be created. */
+int cache_begin(Cache *c, int outfile) {
+  c->outfile = outfile;
+  snprintf(c->tmp, sizeof(c->tmp), "%s/.%s.XXXXXX", c->dir, c->name);
+  c->fd = mkstemp(c->tmp);
+  return c->fd >= 0 ? c->fd : outfile;
+}
+
+/* Copies the new entry to the output and adds it to the cache.  Returns
+   the output. */
+int cache_commit(Cache *c) {
+  if (c->fd < 0) {
+    return c->outfile;
+  }
+
+  char path[CACHE_PATH];
+  snprintf(path, sizeof(path), "%s/%s", c->dir, c->name);
+  lseek(c->fd, 0, SEEK_SET);
+  copy_rest(c->fd, c->outfile);
+  close(c->fd);
+  c->fd = -1;
+  rename(c->tmp, path);
+  return c->outfile;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CACHE_PATH 4096 // Longest path of a cache entry.
+
+typedef struct {
+    const char *dir;      // Directory holding the entries.
+    char name[64];        // Entry of the input, from its digest and mode.
+    char tmp[CACHE_PATH]; // Entry being written, renamed once complete.
+    int fd;               // Descriptor of the entry being written, or -1.
+    int outfile;          // Output the entry is copied to.
+} Cache;
+
+void cache_name(Cache *c, uint64_t digest[static 2], uint64_t size,
+                char mode);
+
+bool cache_fetch(Cache *c, int outfile, uint16_t permissions);
+
+int cache_begin(Cache *c, int outfile);
+
+int cache_commit(Cache *c);
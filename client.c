@@ -0,0 +1,75 @@
+#include "client.h"
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* A request is a HuffdRequest sent with the input and output file
+   descriptors attached, so the daemon reads and writes the caller's files
+   directly and no data goes through the socket.  The daemon answers every
+   request with a HuffdReply once the output is written.  A connection can
+   carry any amount of requests one after another. */
+
+/* Connects to the daemon listening at path.  Returns the socket, or -1 if
+   the daemon can't be reached. */
+int huffd_connect(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    return -1;
+  }
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+/* Sends req with infile and outfile to the daemon on sock and waits for
+   its reply.  Returns false if the connection failed. */
+bool huffd_call(int sock, HuffdRequest *req, int infile, int outfile,
+                HuffdReply *reply) {
+  int fds[2] = {infile, outfile};
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct iovec iov = {.iov_base = req, .iov_len = sizeof(*req)};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control.buf,
+                       .msg_controllen = sizeof(control.buf)};
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(*req)) {
+    return false;
+  }
+  return recv(sock, reply, sizeof(*reply), MSG_WAITALL) == sizeof(*reply);
+}
+
+/* Returns a message describing a reply status. */
+const char *huffd_error(int32_t status) {
+  switch (status) {
+  case HUFFD_OK:
+    return "Done";
+  case HUFFD_EINVAL:
+    return "Invalid request";
+  case HUFFD_EFORMAT:
+    return "Invalid input format";
+  case HUFFD_EIO:
+    return "Input or output error";
+  default:
+    return "Unknown error";
+  }
+}
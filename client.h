@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HUFFD_SOCKET  "/tmp/huffd.sock" // Default socket of the daemon.
+#define HUFFD_ENCODE  'E'               // Compresses the input.
+#define HUFFD_DECODE  'D'               // Decompresses the input.
+#define HUFFD_CHMOD   0x1               // Sets the output's permissions.
+
+#define HUFFD_OK      0 // Request done.
+#define HUFFD_EINVAL  1 // Unknown operation or missing descriptors.
+#define HUFFD_EFORMAT 2 // Input isn't a file the daemon decodes.
+#define HUFFD_EIO     3 // Reading the input or writing the output failed.
+
+typedef struct {
+    uint32_t op;    // HUFFD_ENCODE or HUFFD_DECODE.
+    uint32_t flags; // HUFFD_CHMOD or 0.
+} HuffdRequest;
+
+typedef struct {
+    int32_t status;     // HUFFD_OK or one of the errors.
+    uint32_t reserved;
+    uint64_t bytes_in;  // Bytes read from the input.
+    uint64_t bytes_out; // Bytes written to the output.
+} HuffdReply;
+
+int huffd_connect(const char *path);
+
+bool huffd_call(int sock, HuffdRequest *req, int infile, int outfile,
+                HuffdReply *reply);
+
+const char *huffd_error(int32_t status);
@@ -0,0 +1,395 @@
+#include "context.h"
+#include "hist.h"
+#include "huffman.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* An order-1 model codes every byte with the codes of the byte before it.
+   Giving each of the 256 previous bytes a tree of its own would cost more
+   in trees than it saves on most inputs, so the previous bytes are
+   clustered into a few groups whose bytes follow them alike, like the
+   letters before a vowel, and each group gets one tree.  Switching trees
+   is a lookup of the previous byte's group, and every group's codes and
+   decode table are built before coding starts.
+
+   A file coded with contexts is a header, the amount of groups, the group
+   of every previous byte, the dumped tree of every group with its size in
+   2 bytes, and the codes.  The first byte is coded as if it followed a 0
+   byte. */
+
+static inline bool leaf(Node *n) { return n->left == NULL && n->right == NULL; }
+
+/* Adds the counts of the n bytes of buf to hist, each under the byte
+   before it, which is *last for the first one.  Leaves the last byte of
+   buf in *last. */
+void context_count(uint64_t hist[static CONTEXTS], uint8_t *last,
+                   const uint8_t *buf, uint32_t n) {
+  uint32_t prev = *last;
+  for (uint32_t i = 0; i < n; i++) {
+    hist[(prev << 8) | buf[i]]++;
+    prev = buf[i];
+  }
+  *last = prev;
+}
+
+/* Sets the cost of every byte in a group with the counts g, in 16.16
+   fixed point bits, from its probability with one count added to every
+   byte so bytes the group hasn't seen yet don't cost infinitely much. */
+static void group_costs(uint64_t g[static ALPHABET],
+                        uint64_t cost[static ALPHABET]) {
+  uint64_t total = ALPHABET;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    total += g[s];
+  }
+  uint64_t log_total = hist_log2(total);
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    cost[s] = log_total - hist_log2(g[s] + 1);
+  }
+}
+
+/* Clusters the previous bytes that occur into at most groups groups and
+   sets the group of every previous byte.  The most frequent previous
+   bytes start the groups, and then every previous byte joins the group
+   whose counts code the bytes after it in the fewest bits, with the
+   group counts summed again after every round, until no byte moves.
+   Returns the amount of groups that are left. */
+static uint32_t cluster(uint64_t hist[static CONTEXTS], uint32_t groups,
+                        uint8_t group[static ALPHABET]) {
+  uint64_t total[ALPHABET] = {0};
+  uint32_t order[ALPHABET];
+  for (uint32_t c = 0; c < ALPHABET; c++) {
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+      total[c] += hist[(c << 8) | s];
+    }
+    uint32_t i = c;
+    for (; i > 0 && total[order[i - 1]] < total[c]; i--) {
+      order[i] = order[i - 1];
+    }
+    order[i] = c;
+  }
+
+  bool seeded[ALPHABET] = {false};
+  memset(group, 0, ALPHABET);
+  for (uint32_t i = 0; i < groups && total[order[i]] > 0; i++) {
+    group[order[i]] = i;
+    seeded[order[i]] = true;
+  }
+
+  uint64_t counts[CONTEXT_GROUPS][ALPHABET];
+  uint64_t cost[CONTEXT_GROUPS][ALPHABET];
+  bool changed = true;
+  for (uint32_t round = 0; round < CONTEXT_ROUNDS && changed == true;
+       round++) {
+    memset(counts, 0, sizeof(counts));
+    for (uint32_t c = 0; c < ALPHABET; c++) {
+      if (seeded[c] == true) {
+        for (uint32_t s = 0; s < ALPHABET; s++) {
+          counts[group[c]][s] += hist[(c << 8) | s];
+        }
+      }
+    }
+    for (uint32_t g = 0; g < groups; g++) {
+      group_costs(counts[g], cost[g]);
+    }
+
+    changed = false;
+    for (uint32_t c = 0; c < ALPHABET; c++) {
+      if (total[c] == 0) {
+        continue;
+      }
+      uint32_t best = 0;
+      uint64_t best_bits = UINT64_MAX;
+      for (uint32_t g = 0; g < groups; g++) {
+        uint64_t bits = 0;
+        for (uint32_t s = 0; s < ALPHABET; s++) {
+          bits += hist[(c << 8) | s] * cost[g][s];
+        }
+        if (bits < best_bits) {
+          best_bits = bits;
+          best = g;
+        }
+      }
+      if (seeded[c] == false || group[c] != best) {
+        changed = true;
+      }
+      group[c] = best;
+      seeded[c] = true;
+    }
+  }
+
+  /* Numbers the groups that kept any previous byte from 0. */
+  int32_t renumber[CONTEXT_GROUPS];
+  for (uint32_t g = 0; g < groups; g++) {
+    renumber[g] = -1;
+  }
+  uint32_t used = 0;
+  for (uint32_t c = 0; c < ALPHABET; c++) {
+    if (total[c] > 0 && renumber[group[c]] < 0) {
+      renumber[group[c]] = used++;
+    }
+  }
+  for (uint32_t c = 0; c < ALPHABET; c++) {
+    group[c] = total[c] > 0 ? renumber[group[c]] : 0;
+  }
+  return used > 0 ? used : 1;
+}
+
+/* Builds the codes and the decode table of a group from its tree. */
+static void build_table(ContextTable *t) {
+  memset(t->codes, 0, sizeof(t->codes));
+  build_codes(t->tree, t->codes);
+  memset(t->lookup, 0, sizeof(t->lookup));
+
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    uint32_t len = code_size(&t->codes[s]);
+    uint64_t bits = 0;
+    for (uint32_t b = 0; b < len && b < PACK_MAX_LEN; b++) {
+      if (code_get_bit(&t->codes[s], b) == true) {
+        bits |= UINT64_C(1) << b;
+      }
+    }
+    t->entry[s] = bits | ((uint64_t)len << 56);
+
+    if (len > 0 && len <= UNPACK_BITS) {
+      for (uint32_t i = bits; i < (1u << UNPACK_BITS); i += 1u << len) {
+        t->lookup[i] = s | (len << 8);
+      }
+    }
+  }
+}
+
+/* Builds a model of groups groups for the counts of hist and sets the
+   bits it codes them in, tables included. */
+static ContextModel *build_model(uint64_t hist[static CONTEXTS],
+                                 uint32_t groups) {
+  ContextModel *m = (ContextModel *)calloc(1, sizeof(ContextModel));
+  m->ngroups = cluster(hist, groups, m->group);
+  m->bits = 8 * (1 + ALPHABET);
+
+  for (uint32_t g = 0; g < m->ngroups; g++) {
+    uint64_t counts[ALPHABET] = {0};
+    for (uint32_t c = 0; c < ALPHABET; c++) {
+      if (m->group[c] == g) {
+        for (uint32_t s = 0; s < ALPHABET; s++) {
+          counts[s] += hist[(c << 8) | s];
+        }
+      }
+    }
+    uint64_t coded[ALPHABET];
+    memcpy(coded, counts, sizeof(coded));
+
+    /* Adds phantom symbols until there are two, and builds the tree. */
+    for (uint32_t s = 0; hist_symbols(counts) < 2; s++) {
+      if (counts[s] == 0) {
+        counts[s] = 1;
+      }
+    }
+    ContextTable *t = &m->table[g];
+    t->tree = build_tree(counts);
+    build_table(t);
+
+    m->bits += 8 * (2 + (3 * (uint64_t)hist_symbols(counts)) - 1);
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+      m->bits += coded[s] * (t->entry[s] >> 56);
+    }
+  }
+  return m;
+}
+
+/* Builds the model that codes the counts of hist in the fewest bits with
+   its tables, out of those with 1, 2, 4, 8 and 16 groups.  A single group
+   is a plain Huffman code, so small or unstructured inputs don't pay for
+   trees that don't help. */
+ContextModel *context_create(uint64_t hist[static CONTEXTS]) {
+  ContextModel *best = NULL;
+  for (uint32_t groups = 1; groups <= CONTEXT_GROUPS; groups *= 2) {
+    ContextModel *m = build_model(hist, groups);
+    if (best == NULL || m->bits < best->bits) {
+      context_delete(&best);
+      best = m;
+    } else {
+      context_delete(&m);
+    }
+  }
+  return best;
+}
+
+/* Frees a model and its trees. */
+void context_delete(ContextModel **m) {
+  if (*m == NULL) {
+    return;
+  }
+  for (uint32_t g = 0; g < (*m)->ngroups; g++) {
+    if ((*m)->table[g].tree != NULL) {
+      delete_tree(&(*m)->table[g].tree);
+    }
+  }
+  free(*m);
+  *m = NULL;
+}
+
+/* Writes the amount of groups, the group of every previous byte and the
+   trees of the groups. */
+void context_dump(int outfile, ContextModel *m) {
+  uint8_t head[1 + ALPHABET];
+  head[0] = m->ngroups;
+  memcpy(head + 1, m->group, ALPHABET);
+  bytes_written += write_bytes(outfile, head, sizeof(head));
+
+  for (uint32_t g = 0; g < m->ngroups; g++) {
+    uint8_t buf[2 + MAX_TREE_SIZE];
+    uint16_t size = flatten_tree(m->table[g].tree, buf + 2);
+    buf[0] = size & 0xFF;
+    buf[1] = size >> 8;
+    bytes_written += write_bytes(outfile, buf, 2 + size);
+  }
+}
+
+/* Reads a model written by context_dump().  Returns NULL if it's
+   malformed. */
+ContextModel *context_load(int infile) {
+  uint8_t head[1 + ALPHABET];
+  int got = read_bytes(infile, head, sizeof(head));
+  bytes_read += got;
+  if (got < (int)sizeof(head) || head[0] == 0 || head[0] > CONTEXT_GROUPS) {
+    return NULL;
+  }
+
+  ContextModel *m = (ContextModel *)calloc(1, sizeof(ContextModel));
+  m->ngroups = head[0];
+  memcpy(m->group, head + 1, ALPHABET);
+  bool valid = true;
+  for (uint32_t c = 0; c < ALPHABET; c++) {
+    valid = valid == true && m->group[c] < m->ngroups;
+  }
+
+  for (uint32_t g = 0; valid == true && g < m->ngroups; g++) {
+    uint8_t buf[MAX_TREE_SIZE];
+    got = read_bytes(infile, buf, 2);
+    bytes_read += got;
+    uint16_t size = buf[0] | (buf[1] << 8);
+    valid = got == 2 && size >= 3 && size <= MAX_TREE_SIZE;
+    if (valid == true) {
+      got = read_bytes(infile, buf, size);
+      bytes_read += got;
+      valid = got == size && valid_dump(buf, size) == true;
+    }
+    if (valid == true) {
+      m->table[g].tree = rebuild_tree(size, buf);
+      build_table(&m->table[g]);
+    }
+  }
+
+  if (valid == false) {
+    context_delete(&m);
+  }
+  return m;
+}
+
+/* Writes the codes of the n bytes of buf to outfile, each with the codes
+   of the group of the byte before it, which is *last for the first one.
+   Codes are gathered into a word and written 32 bits at a time.  Leaves
+   the last byte of buf in *last. */
+void context_encode(int outfile, ContextModel *m, uint8_t *last,
+                    const uint8_t *buf, uint32_t n) {
+  uint64_t acc = 0;
+  uint32_t nacc = 0;
+  uint8_t prev = *last;
+
+  for (uint32_t i = 0; i < n; i++) {
+    ContextTable *t = &m->table[m->group[prev]];
+    uint64_t e = t->entry[buf[i]];
+    uint32_t len = e >> 56;
+    if (len > PACK_MAX_LEN) {
+      write_bits(outfile, acc, nacc);
+      acc = 0;
+      nacc = 0;
+      write_code(outfile, &t->codes[buf[i]]);
+    } else {
+      acc |= (e & ((UINT64_C(1) << 56) - 1)) << nacc;
+      nacc += len;
+      if (nacc >= 32) {
+        write_bits(outfile, acc & 0xFFFFFFFF, 32);
+        acc >>= 32;
+        nacc -= 32;
+      }
+    }
+    prev = buf[i];
+  }
+  write_bits(outfile, acc, nacc);
+  *last = prev;
+}
+
+/* Decodes the byte whose code in the table t starts at bit *pos of in,
+   which holds nbits readable bits followed by at least 8 zero bytes.
+   Codes that fit the lookup table take one lookup, and longer ones are
+   walked down the tree.  Returns false if the input ends in the middle of
+   a code. */
+static inline bool decode_one(ContextTable *t, const uint8_t *in,
+                              uint64_t *pos, uint64_t nbits,
+                              uint8_t *symbol) {
+  uint64_t w;
+  memcpy(&w, in + (*pos / 8), sizeof(w));
+  w >>= *pos % 8;
+
+  uint32_t e = t->lookup[w & ((1u << UNPACK_BITS) - 1)];
+  if (e != 0) {
+    uint32_t len = e >> 8;
+    if (*pos + len > nbits) {
+      return false;
+    }
+    *symbol = e & 0xFF;
+    *pos += len;
+    return true;
+  }
+
+  Node *node = t->tree;
+  uint64_t p = *pos;
+  while (leaf(node) == false && p < nbits) {
+    node = ((in[p / 8] >> (p % 8)) & 0x1) == 0 ? node->left : node->right;
+    p++;
+  }
+  if (leaf(node) == false) {
+    return false;
+  }
+  *symbol = node->symbol;
+  *pos = p;
+  return true;
+}
+
+/* Decodes nbytes bytes from infile to outfile, switching to the tables of
+   the previous byte's group for every byte.  The input is refilled a
+   block at a time with unpack_refill().  Returns false if
+   the input ends early. */
+bool context_decode(int infile, int outfile, ContextModel *m,
+                    uint64_t nbytes) {
+  UnpackInput u;
+  unpack_input_create(&u, io_block);
+  uint8_t out[BLOCK];
+  uint8_t prev = 0;
+
+  while (nbytes > 0) {
+    bytes_read += unpack_refill(&u, infile, read_bytes);
+
+    /* Stops at one block of output or once the lookahead runs low. */
+    uint64_t nbits = 8 * (uint64_t)u.have;
+    uint64_t ahead = u.eof == true ? 0 : 8 * MAX_CODE_SIZE;
+    uint32_t want = nbytes < BLOCK ? nbytes : BLOCK;
+    uint32_t k = 0;
+    while (k < want && u.bit + ahead <= nbits &&
+           decode_one(&m->table[m->group[prev]], u.in, &u.bit, nbits,
+                      &prev) == true) {
+      out[k++] = prev;
+    }
+    nbytes -= k;
+
+    if (k == 0 && u.eof == true) {
+      break;
+    }
+    write_symbols(outfile, out, k);
+  }
+  flush_codes(outfile);
+  unpack_input_delete(&u);
+  return nbytes == 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "bitpack.h"
+#include "code.h"
+#include "defines.h"
+#include "node.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CONTEXTS       (ALPHABET * ALPHABET) // Counts of a byte after a byte.
+#define CONTEXT_GROUPS 16                    // Most groups of contexts.
+#define CONTEXT_ROUNDS 8                     // Most rounds of clustering.
+
+typedef struct {
+    Node *tree;
+    Code codes[ALPHABET];
+    uint64_t entry[ALPHABET];          // Code bits with the length on top.
+    uint16_t lookup[1 << UNPACK_BITS]; // Symbol and length, 0 if longer.
+} ContextTable;
+
+typedef struct {
+    uint32_t ngroups;
+    uint8_t group[ALPHABET];            // Group of each previous byte.
+    ContextTable table[CONTEXT_GROUPS]; // Codes of each group.
+    uint64_t bits;                      // Coded size, tables included.
+} ContextModel;
+
+void context_count(uint64_t hist[static CONTEXTS], uint8_t *last,
+                   const uint8_t *buf, uint32_t n);
+
+ContextModel *context_create(uint64_t hist[static CONTEXTS]);
+
+void context_delete(ContextModel **m);
+
+void context_dump(int outfile, ContextModel *m);
+
+ContextModel *context_load(int infile);
+
+void context_encode(int outfile, ContextModel *m, uint8_t *last,
+                    const uint8_t *buf, uint32_t n);
+
+bool context_decode(int infile, int outfile, ContextModel *m,
+                    uint64_t nbytes);
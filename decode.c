@@ -1,21 +1,35 @@
+#include "bitpack.h"
+#include "client.h"
 #include "code.h"
+#include "context.h"
+#include "dedup.h"
+#include "delta.h"
 #include "defines.h"
+#include "entropy.h"
+#include "frame.h"
 #include "header.h"
+#include "hstream.h"
 #include "huffman.h"
 #include "io.h"
 #include "node.h"
+#include "parallel.h"
+#include "perf.h"
+#include "pipeline.h"
 #include "pq.h"
+#include "rle.h"
 #include "stack.h"
+#include "wide.h"
 #include <ctype.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#define OPTIONS "hi:o:v"
+#define OPTIONS "hi:o:vpzcmb:t:D:r:"
 
 struct Stack {
   uint32_t top;
@@ -29,29 +43,289 @@ struct PriorityQueue {
   Node **items;
 };
 
+/* Prints the help message to stderr. */
+static void usage(char *name) {
+  fprintf(stderr, "SYNOPSIS\n");
+  fprintf(stderr, "  A Huffman decoder.\n");
+  fprintf(stderr,
+          "  Decompresses a file using the Huffman coding algorithm.\n\n");
+  fprintf(stderr, "USAGE\n");
+  fprintf(stderr, "  %s [-hvpzcm] [-b KiB] [-t threads] [-D socket]\n", name);
+  fprintf(stderr, "         [-r reference] [-i infile] [-o outfile]\n\n");
+  fprintf(stderr, "OPTIONS\n");
+  fprintf(stderr, "  -h             Program usage and help.\n");
+  fprintf(stderr, "  -v             Print compression statistics.\n");
+  fprintf(stderr, "  -p             Overlap I/O and coding on threads.\n");
+  fprintf(stderr, "  -z             Zero-copy output to pipes.\n");
+  fprintf(stderr, "  -c             Print performance counters per phase.\n");
+  fprintf(stderr, "  -m             Decode into a mapping of outfile.\n");
+  fprintf(stderr, "  -b KiB         Size of the I/O buffers.\n");
+  fprintf(stderr, "  -t threads     Decode segments of input on threads.\n");
+  fprintf(stderr, "  -D socket      Have the daemon at socket decompress.\n");
+  fprintf(stderr, "  -r reference   Reference a delta was coded against.\n");
+  fprintf(stderr, "  -i infile      Input file to decompress.\n");
+  fprintf(stderr, "  -o outfile     Output of decompressed data.\n");
+}
+
+/* Bytes read past the end of a member, which belong to the next one. */
+static uint8_t *pending = NULL;
+static uint32_t npending = 0;
+static uint32_t pending_at = 0;
+
+/* Reads nbytes from infile into buf like read_bytes(), starting with the
+   bytes the previous member read past its end. */
+static int read_input(int infile, uint8_t *buf, int nbytes) {
+  int n = 0;
+  if (pending_at < npending) {
+    n = npending - pending_at < (uint32_t)nbytes ? npending - pending_at
+                                                 : (uint32_t)nbytes;
+    memcpy(buf, pending + pending_at, n);
+    pending_at += n;
+  }
+  if (n < nbytes) {
+    n += read_bytes(infile, buf + n, nbytes - n);
+  }
+  return n;
+}
+
+/* Puts back the n bytes of buf that were read past the end of a member,
+   ahead of any that are still pending, so the next member reads them
+   first.  They are no longer counted as read until then. */
+static void unread_input(uint8_t *buf, uint32_t n) {
+  uint32_t left = npending - pending_at;
+  uint8_t *kept = (uint8_t *)malloc(n + left + 1);
+  memcpy(kept, buf, n);
+  memcpy(kept + n, pending + pending_at, left);
+  free(pending);
+
+  pending = kept;
+  npending = n + left;
+  pending_at = 0;
+  bytes_read -= n;
+}
+
+/* Decodes nsymbols symbols from infile to outfile, or straight into map
+   if the output is mapped.  The compressed input is read io_block bytes
+   at a time into a buffer that keeps at least a block of lookahead for
+   the table-driven kernels until the end of input, where the last codes
+   are decoded by walking the tree.  Bytes read past the last code are put
+   back for a member that may follow. */
+static void decode_symbols(int infile, int outfile, uint8_t *map,
+                           Node *root, uint64_t nsymbols) {
+  UnpackTable *t = (UnpackTable *)malloc(sizeof(UnpackTable));
+  unpack_create(t, root);
+
+  UnpackInput u;
+  unpack_input_create(&u, io_block);
+  uint8_t syms[BLOCK];
+  uint64_t decoded = 0;
+
+  while (decoded < nsymbols) {
+    bytes_read += unpack_refill(&u, infile, read_input);
+
+    uint32_t want = nsymbols - decoded < BLOCK ? nsymbols - decoded : BLOCK;
+    uint64_t nbits = 8 * (uint64_t)u.have;
+    uint8_t *dst = map != NULL ? map + decoded : syms;
+    uint32_t k = unpack_symbols(t, u.in, &u.bit, nbits, dst, want);
+    k += unpack_tail(root, u.in, &u.bit, nbits, dst + k, want - k);
+
+    /* Stops early if the input ran out in the middle of a code. */
+    if (k == 0 && u.eof == true) {
+      break;
+    }
+    if (map != NULL) {
+      bytes_written += k;
+    } else {
+      write_symbols(outfile, syms, k);
+    }
+    decoded += k;
+  }
+
+  uint32_t used = (u.bit + 7) / 8;
+  if (used < u.have) {
+    unread_input(u.in + used, u.have - used);
+  }
+  flush_codes(outfile);
+  unpack_input_delete(&u);
+  free(t);
+}
+
+/* If stats are enabled, prints out decompression statistics to standard
+   error (stderr).  This ends the decoding phase, so the performance
+   counters are printed as well if they are enabled. */
+static void print_statistics(bool print_stats) {
+  perf_end(bytes_written);
+  perf_report();
+
+  if (print_stats == true) {
+    fprintf(stderr, "Compressed file size: %lu bytes\n", bytes_read);
+    fprintf(stderr, "Decompressed file size: %lu bytes\n", bytes_written);
+
+    long double space_saving =
+        100 * (1 - ((long double)bytes_read / (long double)bytes_written));
+    fprintf(stderr, "Space saving: %.2Lf%%", space_saving);
+    fprintf(stderr, "\n");
+  }
+}
+
+/* Decodes a framed stream, whose header was read already, from infile to
+   outfile with the incremental decoder.  The decoder is handed the header
+   and then whatever each read returns, so the output of a frame is
+   written as soon as the frame has arrived.  Returns false if the stream
+   is malformed or ends in the middle of a frame. */
+static bool decode_framed(int infile, int outfile, Header *header) {
+  HStream s = {.next_in = (uint8_t *)header, .avail_in = sizeof(*header)};
+  if (hstream_decode_init(&s) == false) {
+    return false;
+  }
+  uint8_t *in = io_alloc(io_block);
+  uint8_t *out = io_alloc(io_block);
+  int status = HSTREAM_OK;
+  bool eof = false;
+
+  while (status == HSTREAM_OK) {
+    if (s.avail_in == 0 && eof == false) {
+      ssize_t got = read(infile, in, io_block);
+      eof = got <= 0;
+      s.next_in = in;
+      s.avail_in = got > 0 ? got : 0;
+      bytes_read += s.avail_in;
+    }
+    s.next_out = out;
+    s.avail_out = io_block;
+    status = hstream_decode(&s, eof == true ? HSTREAM_FINISH : HSTREAM_NONE);
+    write_symbols(outfile, out, io_block - s.avail_out);
+    flush_codes(outfile);
+  }
+
+  hstream_end(&s);
+  free(in);
+  free(out);
+  return status == HSTREAM_END;
+}
+
+/* Returns true if n is a leaf node. */
+static bool leaf(Node *n) { return n->left == NULL && n->right == NULL; }
+
+/* Decodes nsymbols symbols of a tree with just two leaves from infile to
+   outfile, or straight into map if the output is mapped.  Every bit of
+   input is one symbol, so whole bytes of input are expanded into 8
+   symbols at a time. */
+static void decode_bitmap(int infile, int outfile, uint8_t *map, Node *root,
+                          uint64_t nsymbols) {
+  uint8_t in[BLOCK / 8];
+  uint8_t syms[BLOCK];
+  uint64_t decoded = 0;
+
+  while (decoded < nsymbols) {
+    int nbytes = read_bytes(infile, in, BLOCK / 8);
+    if (nbytes <= 0) {
+      break;
+    }
+    bytes_read += nbytes;
+
+    /* The last bits may be padding, so they are never expanded straight
+       into the mapping, which ends after the last symbol. */
+    uint64_t k = 8 * (uint64_t)nbytes;
+    bool direct = map != NULL && k <= nsymbols - decoded;
+    uint8_t *dst = direct == true ? map + decoded : syms;
+    unpack_bitmap(root->left->symbol, root->right->symbol, in, nbytes, dst);
+    if (k > nsymbols - decoded) {
+      k = nsymbols - decoded;
+    }
+    if (map != NULL) {
+      if (direct == false) {
+        memcpy(map + decoded, syms, k);
+      }
+      bytes_written += k;
+    } else {
+      write_symbols(outfile, syms, k);
+    }
+    decoded += k;
+  }
+  flush_codes(outfile);
+}
+
+/* Decodes the members of an appendable file one after another into
+   outfile, starting with the member whose header was read already.  A
+   member without a tree reuses the tree of the member before it, and the
+   trailers between members are skipped.  Returns false if a member or
+   trailer is invalid. */
+static bool decode_members(int infile, int outfile, Header *header) {
+  Node *root = NULL;
+  bool valid = true;
+
+  while (valid == true) {
+    if (header->tree_size > MAX_TREE_SIZE ||
+        (header->tree_size == 0 && root == NULL)) {
+      valid = false;
+      break;
+    }
+    if (header->tree_size > 0) {
+      uint8_t tree[MAX_TREE_SIZE];
+      bytes_read += read_input(infile, tree, header->tree_size);
+      if (valid_dump(tree, header->tree_size) == false) {
+        valid = false;
+        break;
+      }
+      if (root != NULL) {
+        delete_tree(&root);
+      }
+      root = rebuild_tree(header->tree_size, tree);
+    }
+    decode_symbols(infile, outfile, NULL, root, header->file_size);
+
+    /* A member is followed by its trailer, except for a plain file that
+       was made the first member, and then by the next member if any. */
+    uint32_t magic = 0;
+    int nbytes = read_input(infile, (uint8_t *)&magic, sizeof(magic));
+    if (nbytes == sizeof(magic) && magic == MAGIC_TRAILER) {
+      Trailer trailer;
+      nbytes = read_input(infile, (uint8_t *)&trailer + sizeof(magic),
+                          sizeof(trailer) - sizeof(magic));
+      bytes_read += sizeof(magic) + nbytes;
+      valid = nbytes == sizeof(trailer) - sizeof(magic);
+      nbytes = read_input(infile, (uint8_t *)&magic, sizeof(magic));
+    }
+    if (nbytes == 0) {
+      break;
+    }
+
+    header->magic = magic;
+    nbytes += read_input(infile, (uint8_t *)header + sizeof(magic),
+                         sizeof(*header) - sizeof(magic));
+    bytes_read += nbytes;
+    valid = valid == true && nbytes == sizeof(*header) &&
+            header->magic == MAGIC_MEMBER;
+  }
+
+  if (root != NULL) {
+    delete_tree(&root);
+  }
+  free(pending);
+  return valid;
+}
+
 int main(int argc, char **argv) {
 
   int opt = 0;
   bool input_file_exists = false;
   bool output_file_exists = false;
   bool print_stats = false;
+  bool pipelined = false;
+  bool zero_copy = false;
+  bool mapped = false;
+  uint64_t block_size = IO_BLOCK;
+  uint32_t threads = 1;
+  char *daemon_socket = NULL;
+  char *reference_file = NULL;
   char *input_file = NULL;
   char *output_file = NULL;
 
   while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
     switch (opt) {
     case 'h': /* Help Message */
-      fprintf(stderr, "SYNOPSIS\n");
-      fprintf(stderr, "  A Huffman decoder.\n");
-      fprintf(stderr,
-              "  Decompresses a file using the Huffman coding algorithm.\n\n");
-      fprintf(stderr, "USAGE\n");
-      fprintf(stderr, "  %s [-h] [-i infile] [-o outfile]\n\n", argv[0]);
-      fprintf(stderr, "OPTIONS\n");
-      fprintf(stderr, "  -h             Program usage and help.\n");
-      fprintf(stderr, "  -v             Print compression statistics.\n");
-      fprintf(stderr, "  -i infile      Input file to decompress.\n");
-      fprintf(stderr, "  -o outfile     Output of decompressed data.\n");
+      usage(argv[0]);
       return 0;
     case 'i': /* Input File */
       if (access(optarg, F_OK) != 0) {
@@ -68,34 +342,89 @@ int main(int argc, char **argv) {
     case 'v': /* Enabling Stats */
       print_stats = true;
       break;
+    case 'p': /* Enabling the threaded pipeline */
+      pipelined = true;
+      break;
+    case 'z': /* Enabling zero-copy output to pipes */
+      zero_copy = true;
+      break;
+    case 'c': /* Enabling performance counters */
+      perf_enable();
+      break;
+    case 'm': /* Enabling decoding into a mapped output file */
+      mapped = true;
+      break;
+    case 'b': /* Setting the I/O buffer size */
+      block_size = strtoull(optarg, NULL, 10) << 10;
+      break;
+    case 't': /* Setting the amount of decoding threads */
+      threads = strtoul(optarg, NULL, 10);
+      break;
+    case 'D': /* Handing the files to a daemon */
+      daemon_socket = optarg;
+      break;
+    case 'r': /* Decoding against a reference file */
+      if (access(optarg, F_OK) != 0) {
+        fprintf(stderr, "Reference file doesn't exist\n");
+        return 1;
+      }
+      reference_file = optarg;
+      break;
     default: /* Bad Option */
-      fprintf(stderr, "SYNOPSIS\n");
-      fprintf(stderr, "  A Huffman decoder.\n");
-      fprintf(stderr,
-              "  Decompresses a file using the Huffman coding algorithm.\n\n");
-      fprintf(stderr, "USAGE\n");
-      fprintf(stderr, "  %s [-h] [-i infile] [-o outfile]\n\n", argv[0]);
-      fprintf(stderr, "OPTIONS\n");
-      fprintf(stderr, "  -h             Program usage and help.\n");
-      fprintf(stderr, "  -v             Print compression statistics.\n");
-      fprintf(stderr, "  -i infile      Input file to decompress.\n");
-      fprintf(stderr, "  -o outfile     Output of decompressed data.\n");
+      usage(argv[0]);
       return 1;
     }
   }
 
+  if (io_set_block(block_size) == false) {
+    fprintf(stderr, "Invalid I/O buffer size\n");
+    return 1;
+  }
+
   /* Sets the input file descrptor with the input file if it exists.
      For standard input, 0 should suffice. */
   int input = 0;
   if (input_file_exists == true) {
     input = open(input_file, O_RDWR | O_CREAT, 0777);
+    io_advise(input, false);
   }
 
   /* Sets the output file descrptor with the output file if it exists.
-     For standard output, 1 should suffice. */
+     For standard output, 1 should suffice.  The output file is opened for
+     reading as well, so deduplicated files can copy from it. */
   int output = 1;
   if (output_file_exists == true) {
-    output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    output = open(output_file, O_CREAT | O_RDWR | O_TRUNC, 0600);
+  }
+
+  /* With a daemon, only the files are opened here and the daemon
+     decompresses them, setting the output's permissions if it's a file. */
+  if (daemon_socket != NULL) {
+    int sock = huffd_connect(daemon_socket);
+    if (sock < 0) {
+      fprintf(stderr, "Unable to reach the daemon at %s\n", daemon_socket);
+      return 1;
+    }
+    HuffdRequest req = {.op = HUFFD_DECODE,
+                        .flags = output_file_exists == true ? HUFFD_CHMOD : 0};
+    HuffdReply reply = {.status = HUFFD_EIO};
+    huffd_call(sock, &req, input, output, &reply);
+    close(sock);
+    close(input);
+    close(output);
+    if (reply.status != HUFFD_OK) {
+      fprintf(stderr, "%s\n", huffd_error(reply.status));
+      return 1;
+    }
+    bytes_read = reply.bytes_in;
+    bytes_written = reply.bytes_out;
+    print_statistics(print_stats);
+    return 0;
+  }
+
+  /* Zero-copy output only applies to the single threaded decoder. */
+  if (zero_copy == true && pipelined == false) {
+    enable_zero_copy(output);
   }
 
   /* Initializes the header object*/
@@ -106,74 +435,216 @@ int main(int argc, char **argv) {
   bytes_read = read_bytes(input, (uint8_t *)&header, sizeof(header));
 
   /* The program will exit and print out an error message if the magic
-     number doesn't match with the MAGIC macro defined in defines.h */
-  if (header.magic != MAGIC) {
+     number doesn't match with one of the magic numbers defined in
+     defines.h */
+  if (header.magic != MAGIC && header.magic != MAGIC_RLE &&
+      header.magic != MAGIC_WIDE && header.magic != MAGIC_FRAMED &&
+      header.magic != MAGIC_MEMBER && header.magic != MAGIC_DEDUP &&
+      header.magic != MAGIC_ENTROPY && header.magic != MAGIC_CONTEXT &&
+      header.magic != MAGIC_DELTA) {
     fprintf(stderr, "Invalid magic number\n");
     return 1;
   }
 
+  /* A delta is decoded from the reference it was coded against. */
+  int reference = -1;
+  if (header.magic == MAGIC_DELTA) {
+    if (reference_file == NULL) {
+      fprintf(stderr, "The input is a delta, decode it with -r\n");
+      return 1;
+    }
+    reference = open(reference_file, O_RDONLY);
+  }
+
   /* If the output file exists, sets its permission bits with the bits
      provided from the header's permission bits. */
   if (output_file_exists == true) {
     fchmod(output, header.permissions);
   }
 
-  /* Reads the dumped tree from infile into an array that is tree_size
-     bytes long */
-  uint8_t tree[header.tree_size];
-  bytes_read += read_bytes(input, tree, header.tree_size);
+  /* A run-length coded file without a tree is a single repeated byte. */
+  bytes_written = 0;
+  if (header.magic == MAGIC_RLE && header.tree_size == 0) {
+    perf_begin("decoding");
+    uint8_t symbol[1] = {0};
+    bytes_read += read_bytes(input, symbol, 1);
+    write_repeat(output, symbol[0], header.file_size);
+    flush_codes(output);
+    print_statistics(print_stats);
+    close(input);
+    close(output);
+    return 0;
+  }
 
-  /* Reconstructs the Huffman Tree*/
-  Node *h_tree = rebuild_tree(header.tree_size, tree);
+  /* A framed stream is decoded frame by frame as the frames arrive. */
+  if (header.magic == MAGIC_FRAMED) {
+    perf_begin("decoding");
+    bool valid = decode_framed(input, output, &header);
+    print_statistics(print_stats);
+    close(input);
+    close(output);
+    if (valid == false) {
+      fprintf(stderr, "Invalid frame\n");
+      return 1;
+    }
+    return 0;
+  }
 
-  Node *temp_node = h_tree;
-  uint8_t temp_bit = 0;
-  bytes_written = 0;
+  /* A file appended to has members that are decoded one by one. */
+  if (header.magic == MAGIC_MEMBER) {
+    perf_begin("decoding");
+    bool valid = decode_members(input, output, &header);
+    print_statistics(print_stats);
+    close(input);
+    close(output);
+    if (valid == false) {
+      fprintf(stderr, "Invalid member\n");
+      return 1;
+    }
+    return 0;
+  }
 
-  /* Traverses down the Huffman tree a bit at a time from input.  If
-     a leaf node was found, it's written to outfile or standard output.
-     Else, the trees continues to traverse down (0 = left and 1 = right). */
-  while (read_bit(input, &temp_bit) == true &&
-         bytes_written < header.file_size) {
-    if (temp_node->left == NULL && temp_node->right == NULL) {
-      uint8_t character[1];
-      character[0] = temp_node->symbol;
-      bytes_written += write_bytes(output, character, 1);
-      temp_node = h_tree;
+  /* A file coded with entropy backends has their tables instead of a
+     tree, and its blocks are decoded by the backend each one selects. */
+  if (header.magic == MAGIC_ENTROPY) {
+    perf_begin("decoding");
+    bool valid = entropy_decode(input, output, header.file_size);
+    print_statistics(print_stats);
+    close(input);
+    close(output);
+    if (valid == false) {
+      fprintf(stderr, "Invalid block\n");
+      return 1;
     }
+    return 0;
+  }
 
-    if (temp_bit == 0) {
-      temp_node = temp_node->left;
-    } else {
-      temp_node = temp_node->right;
+  /* A file coded with contexts has the groups of the previous bytes and
+     a tree per group, and its bytes are decoded with the tables of the
+     group of the byte before them. */
+  if (header.magic == MAGIC_CONTEXT) {
+    perf_begin("tree");
+    ContextModel *m = context_load(input);
+    if (m == NULL) {
+      fprintf(stderr, "Invalid code table\n");
+      return 1;
     }
+    perf_end(header.file_size);
+
+    perf_begin("decoding");
+    bool valid = context_decode(input, output, m, header.file_size);
+    context_delete(&m);
+    print_statistics(print_stats);
+    close(input);
+    close(output);
+    if (valid == false) {
+      fprintf(stderr, "Truncated input\n");
+      return 1;
+    }
+    return 0;
   }
 
-  /* I noticed that the loop doesn't write the possible last byte to
-     outfile or stdout.  So this portion code does that task. */
-  if (temp_node->left == NULL && temp_node->right == NULL &&
-      bytes_written < header.file_size) {
-    uint8_t character[1];
-    character[0] = temp_node->symbol;
-    bytes_written += write_bytes(output, character, 1);
-    temp_node = h_tree;
+  /* A file of 16-bit symbols has a table of code lengths instead of a
+     tree, and its symbols are decoded a pair of bytes per lookup. */
+  if (header.magic == MAGIC_WIDE) {
+    perf_begin("tree");
+    WideTable *t = wide_load(input);
+    if (t == NULL) {
+      fprintf(stderr, "Invalid code table\n");
+      return 1;
+    }
+    perf_end(header.file_size);
+
+    perf_begin("decoding");
+    bool valid = wide_decode(input, output, t, header.file_size);
+    wide_delete(&t);
+    print_statistics(print_stats);
+    close(input);
+    close(output);
+    if (valid == false) {
+      fprintf(stderr, "Invalid code\n");
+      return 1;
+    }
+    return 0;
   }
 
-  /* If stats are enabled, prints out decompression statistics to standard
-     error (stderr). */
-  if (print_stats == true) {
-    fprintf(stderr, "Compressed file size: %lu bytes\n", bytes_read);
-    fprintf(stderr, "Decompressed file size: %lu bytes\n", bytes_written);
+  /* Reads the dumped tree from infile into an array that is tree_size
+     bytes long */
+  perf_begin("tree");
+  uint8_t tree[header.tree_size];
+  bytes_read += read_bytes(input, tree, header.tree_size);
 
-    long double space_saving =
-        100 * (1 - ((long double)bytes_read / (long double)bytes_written));
-    fprintf(stderr, "Space saving: %.2Lf%%", space_saving);
-    fprintf(stderr, "\n");
+  /* Reconstructs the Huffman Tree*/
+  Node *h_tree = NULL;
+  if (header.magic == MAGIC_RLE) {
+    if (valid_dump_wide(tree, header.tree_size, RLE_ALPHABET) == true) {
+      h_tree = rebuild_tree_wide(header.tree_size, tree);
+    }
+  } else if (valid_dump(tree, header.tree_size) == true) {
+    h_tree = rebuild_tree(header.tree_size, tree);
+  }
+  if (h_tree == NULL) {
+    fprintf(stderr, "Invalid tree\n");
+    return 1;
+  }
+  if (header.magic == MAGIC_DELTA &&
+      delta_check(input, reference) == false) {
+    fprintf(stderr, "The reference isn't the one the delta was coded "
+                    "against\n");
+    return 1;
+  }
+  perf_end(header.file_size);
+  /* Decodes the symbols either on this thread or, in pipelined mode, with
+     separate threads for reading, decoding and writing.  A tree of just
+     two leaves codes every symbol with one bit, so its bits are expanded
+     into symbols directly.  With more than one thread, segments of a
+     mapped input file are decoded speculatively side by side.  A
+     deduplicated file or a delta is decoded record by record on this
+     thread.  With a mapped output, the whole file is reserved up front
+     and symbols are stored straight into it, which the pipeline doesn't
+     do. */
+  perf_begin("decoding");
+  uint8_t *map = NULL;
+  if (mapped == true && header.magic == MAGIC &&
+      io_map_output(output, header.file_size, &map) == false) {
+    fprintf(stderr, "Not enough space for the output\n");
+    return 1;
   }
 
+  bool valid = true;
+  if (header.magic == MAGIC_RLE) {
+    rle_decode(input, output, h_tree, header.file_size);
+  } else if (header.magic == MAGIC_DEDUP) {
+    valid = dedup_decode(input, output, h_tree, header.file_size);
+  } else if (header.magic == MAGIC_DELTA) {
+    valid = delta_decode(input, output, reference, h_tree, header.file_size);
+  } else if (threads > 1 &&
+             (leaf(h_tree->left) == false || leaf(h_tree->right) == false) &&
+             parallel_decode(input, output, map, h_tree, header.file_size,
+                             threads) == true) {
+    /* Decoded by the threads. */
+  } else if (pipelined == true && map == NULL) {
+    pipeline_decode(input, output, h_tree, header.file_size);
+  } else if (leaf(h_tree->left) == true && leaf(h_tree->right) == true) {
+    decode_bitmap(input, output, map, h_tree, header.file_size);
+  } else {
+    decode_symbols(input, output, map, h_tree, header.file_size);
+  }
+  if (map != NULL) {
+    io_unmap_output(output, map, header.file_size);
+  }
+
+  print_statistics(print_stats);
   close(input);
   close(output);
+  if (reference >= 0) {
+    close(reference);
+  }
   delete_tree(&h_tree);
+  if (valid == false) {
+    fprintf(stderr, "Invalid record\n");
+    return 1;
+  }
 
   return 0;
 }
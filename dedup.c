@@ -0,0 +1,369 @@
+#include "dedup.h"
+#include "bitpack.h"
+#include "hash.h"
+#include "hist.h"
+#include "io.h"
+#include "spool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A deduplicated file is a header and a tree followed by records, each a
+   marker and the length of its payload like the frames of a framed
+   stream.  The input is cut into blocks at content-defined boundaries, so
+   a block that occurs again is cut the same way wherever it starts.  The
+   first occurrence of a block is coded in a data record, and every later
+   one becomes a copy record that points back at the first, which the
+   decoder resolves by copying output it has written already. */
+
+#define COPY_PAYLOAD 12                       /* Source and length. */
+#define COPY_MAX     (UINT32_MAX - DEDUP_MAX) /* Longest merged copy. */
+
+/* Open addressing table from the hashes of unique blocks to the blocks. */
+typedef struct {
+  uint64_t *hash;  /* Hash of the block in each slot. */
+  uint64_t *block; /* Index of the block plus one, 0 if the slot is free. */
+  uint64_t size;   /* Slots, a power of two. */
+  uint64_t used;   /* Slots holding a block. */
+} Index;
+
+/* Puts block b with hash h into a free slot of the index. */
+static void index_put(Index *x, uint64_t h, uint64_t b) {
+  uint64_t i = h & (x->size - 1);
+  while (x->block[i] != 0) {
+    i = (i + 1) & (x->size - 1);
+  }
+  x->hash[i] = h;
+  x->block[i] = b + 1;
+  x->used++;
+}
+
+/* Doubles the slots of the index, which keeps it at most half full. */
+static void index_grow(Index *x) {
+  Index bigger = {.size = 2 * x->size, .used = 0};
+  bigger.hash = (uint64_t *)calloc(bigger.size, sizeof(uint64_t));
+  bigger.block = (uint64_t *)calloc(bigger.size, sizeof(uint64_t));
+  for (uint64_t i = 0; i < x->size; i++) {
+    if (x->block[i] != 0) {
+      index_put(&bigger, x->hash[i], x->block[i] - 1);
+    }
+  }
+  free(x->hash);
+  free(x->block);
+  *x = bigger;
+}
+
+/* Returns the first block of p with the same bytes as block b, whose hash
+   is h, or b itself after adding it to the index if there is none.  The
+   bytes are compared, so blocks whose hashes collide are never mixed. */
+static DedupBlock *index_find(Index *x, DedupPlan *p, uint64_t h,
+                              uint64_t b) {
+  DedupBlock *block = &p->blocks[b];
+  uint64_t i = h & (x->size - 1);
+  while (x->block[i] != 0) {
+    DedupBlock *other = &p->blocks[x->block[i] - 1];
+    if (x->hash[i] == h && other->length == block->length &&
+        memcmp(p->data + other->offset, p->data + block->offset,
+               block->length) == 0) {
+      return other;
+    }
+    i = (i + 1) & (x->size - 1);
+  }
+
+  if (2 * (x->used + 1) > x->size) {
+    index_grow(x);
+  }
+  index_put(x, h, b);
+  return block;
+}
+
+/* Maps infile and cuts it into blocks, finding the first occurrence of
+   every block.  Only the bytes of unique blocks are counted into hist,
+   since those are the only ones that get coded.  Returns NULL if infile
+   can't be mapped. */
+DedupPlan *dedup_scan(int infile, uint64_t hist[static ALPHABET]) {
+  struct stat st;
+  if (fstat(infile, &st) != 0) {
+    return NULL;
+  }
+
+  DedupPlan *p = (DedupPlan *)calloc(1, sizeof(DedupPlan));
+  p->size = st.st_size;
+  if (p->size > 0) {
+    p->data = (uint8_t *)mmap(NULL, p->size, PROT_READ, MAP_PRIVATE, infile,
+                              0);
+    if (p->data == MAP_FAILED) {
+      free(p);
+      return NULL;
+    }
+    madvise(p->data, p->size, MADV_SEQUENTIAL);
+  }
+
+  memset(hist, 0, ALPHABET * sizeof(uint64_t));
+  Index x = {.size = 1024, .used = 0};
+  x.hash = (uint64_t *)calloc(x.size, sizeof(uint64_t));
+  x.block = (uint64_t *)calloc(x.size, sizeof(uint64_t));
+
+  for (uint64_t pos = 0; pos < p->size;) {
+    if (p->nblocks == p->capacity) {
+      p->capacity = p->capacity == 0 ? 1024 : 2 * p->capacity;
+      p->blocks = (DedupBlock *)realloc(p->blocks,
+                                        p->capacity * sizeof(DedupBlock));
+    }
+    DedupBlock *b = &p->blocks[p->nblocks];
+    b->offset = pos;
+    b->length = hash_cut(p->data + pos, p->size - pos, DEDUP_MIN, DEDUP_MAX,
+                         DEDUP_BITS);
+
+    uint64_t h = hash_bytes(p->data + pos, b->length, 0);
+    b->source = index_find(&x, p, h, p->nblocks)->offset;
+    if (b->source == b->offset) {
+      hist_count(hist, p->data + pos, b->length);
+    } else {
+      p->duplicates += b->length;
+    }
+    p->nblocks++;
+    pos += b->length;
+  }
+
+  free(x.hash);
+  free(x.block);
+  return p;
+}
+
+/* Sets the record header at the front of record. */
+static void put_header(uint8_t *record, uint8_t marker, uint32_t length) {
+  record[0] = marker;
+  for (uint32_t b = 0; b < 4; b++) {
+    record[1 + b] = (length >> (8 * b)) & 0xFF;
+  }
+}
+
+/* Returns the n-byte little-endian number at p. */
+static uint64_t get_le(const uint8_t *p, uint32_t n) {
+  uint64_t v = 0;
+  for (uint32_t b = 0; b < n; b++) {
+    v |= (uint64_t)p[b] << (8 * b);
+  }
+  return v;
+}
+
+/* Sends a copy record of length bytes of output starting at source. */
+static void send_copy(int outfile, uint64_t source, uint64_t length) {
+  uint8_t record[DEDUP_HEADER + COPY_PAYLOAD];
+  put_header(record, DEDUP_COPY, COPY_PAYLOAD);
+  for (uint32_t b = 0; b < 8; b++) {
+    record[DEDUP_HEADER + b] = (source >> (8 * b)) & 0xFF;
+  }
+  for (uint32_t b = 0; b < 4; b++) {
+    record[DEDUP_HEADER + 8 + b] = (length >> (8 * b)) & 0xFF;
+  }
+  bytes_written += write_bytes(outfile, record, sizeof(record));
+}
+
+/* Codes the n bytes of buf into record and sends it as a data record,
+   whose payload is the symbol count as 4 bytes followed by the codes
+   padded to a byte boundary. */
+static void send_data(int outfile, PackTable *pack, uint8_t *record,
+                      const uint8_t *buf, uint32_t n) {
+  uint64_t bit = 0;
+  for (uint32_t b = 0; b < 4; b++) {
+    record[DEDUP_HEADER + b] = (n >> (8 * b)) & 0xFF;
+  }
+  pack_codes(pack, buf, n, record + DEDUP_HEADER + 4, &bit);
+
+  uint32_t length = 4 + ((bit + 7) / 8);
+  put_header(record, DEDUP_DATA, length);
+  bytes_written += write_bytes(outfile, record, DEDUP_HEADER + length);
+}
+
+/* Writes the records of the blocks of p to outfile, coding unique blocks
+   with table.  Duplicate blocks that follow each other and whose first
+   occurrences follow each other as well, like the blocks of a file that
+   occurs twice, are sent as a single copy record. */
+void dedup_encode(DedupPlan *p, int outfile, Code table[static ALPHABET]) {
+  PackTable pack;
+  pack_create(&pack, table);
+  uint8_t *record = (uint8_t *)malloc(
+      DEDUP_HEADER + 4 + ((uint64_t)DEDUP_MAX * pack.max_len / 8) + 16);
+  uint64_t source = 0; /* Start of the pending copy. */
+  uint64_t length = 0; /* Bytes of the pending copy. */
+
+  for (uint64_t i = 0; i < p->nblocks; i++) {
+    DedupBlock *b = &p->blocks[i];
+    if (b->source != b->offset) {
+      if (length > 0 && source + length == b->source &&
+          length + b->length <= COPY_MAX) {
+        length += b->length;
+        continue;
+      }
+      if (length > 0) {
+        send_copy(outfile, source, length);
+      }
+      source = b->source;
+      length = b->length;
+      continue;
+    }
+
+    if (length > 0) {
+      send_copy(outfile, source, length);
+      length = 0;
+    }
+    send_data(outfile, &pack, record, p->data + b->offset, b->length);
+  }
+  if (length > 0) {
+    send_copy(outfile, source, length);
+  }
+  free(record);
+}
+
+/* Unmaps the input of a plan and frees it. */
+void dedup_delete(DedupPlan **p) {
+  if (*p == NULL) {
+    return;
+  }
+  if ((*p)->data != NULL) {
+    munmap((*p)->data, (*p)->size);
+  }
+  free((*p)->blocks);
+  free(*p);
+  *p = NULL;
+}
+
+/* The output of the decoder, which copy records read back from.  Output
+   that can't be read back, like a pipe or a write-only file, is also
+   kept in a spool. */
+typedef struct {
+  int outfile;
+  bool spooled;  /* True if earlier output is read from the spool. */
+  Spool spool;   /* Copy of the output if it can't be read back. */
+  uint64_t size; /* Bytes of output so far. */
+} History;
+
+/* Writes the n bytes of buf to the output.  Returns false if they can't
+   be kept in the spool. */
+static bool emit(History *h, uint8_t *buf, uint32_t n) {
+  write_symbols(h->outfile, buf, n);
+  h->size += n;
+  return h->spooled == false || spool_write(&h->spool, buf, n) == true;
+}
+
+/* Copies length bytes of output starting at source to the end of the
+   output.  The copy may overlap the bytes it produces, so it is done in
+   pieces that were all written before.  Returns false if source is not
+   part of the output yet. */
+static bool copy_output(History *h, uint64_t source, uint64_t length,
+                        uint8_t *buf) {
+  if (source >= h->size) {
+    return false;
+  }
+  int from = h->spooled == true ? h->spool.fd : h->outfile;
+
+  while (length > 0) {
+    uint64_t n = length < io_block ? length : io_block;
+    if (n > h->size - source) {
+      n = h->size - source;
+    }
+    if (h->spooled == false) {
+      flush_codes(h->outfile);
+    }
+    if (pread(from, buf, n, source) != (ssize_t)n) {
+      return false;
+    }
+    if (emit(h, buf, n) == false) {
+      return false;
+    }
+    source += n;
+    length -= n;
+  }
+  return true;
+}
+
+/* Decodes the payload of a data record of length bytes, which is followed
+   by UNPACK_SLACK readable bytes, into the output.  Returns false if the
+   payload doesn't hold its symbols or would exceed left symbols. */
+static bool decode_data(History *h, UnpackTable *t, Node *root,
+                        uint8_t *payload, uint32_t length, uint64_t left) {
+  uint32_t nsymbols = get_le(payload, 4);
+  if (nsymbols > DEDUP_MAX || nsymbols > left) {
+    return false;
+  }
+
+  uint8_t *in = payload + 4;
+  uint64_t nbits = 8 * (uint64_t)(length - 4);
+  uint64_t bit = 0;
+  uint8_t syms[BLOCK];
+
+  while (nsymbols > 0) {
+    uint32_t want = nsymbols < BLOCK ? nsymbols : BLOCK;
+    uint32_t k = unpack_symbols(t, in, &bit, nbits, syms, want);
+    k += unpack_tail(root, in, &bit, nbits, syms + k, want - k);
+    if (k == 0) {
+      return false;
+    }
+    if (emit(h, syms, k) == false) {
+      return false;
+    }
+    nsymbols -= k;
+  }
+  return true;
+}
+
+/* Decodes the records of a deduplicated file from infile to outfile until
+   nsymbols bytes were written.  Copy records are read back from outfile
+   if it is a readable file, and from a spool of the output otherwise.
+   Returns false if a record is malformed. */
+bool dedup_decode(int infile, int outfile, Node *root, uint64_t nsymbols) {
+  History h = {.outfile = outfile, .spooled = false, .size = 0};
+  uint8_t probe[1];
+  if (pread(outfile, probe, 0, 0) != 0) {
+    if (spool_open(&h.spool, (uint64_t)SPOOL_LIMIT << 20) == false) {
+      return false;
+    }
+    h.spooled = true;
+  }
+
+  UnpackTable *t = (UnpackTable *)malloc(sizeof(UnpackTable));
+  unpack_create(t, root);
+  uint8_t *buf = io_alloc(io_block);
+  bool valid = true;
+
+  while (valid == true && h.size < nsymbols) {
+    uint8_t header[DEDUP_HEADER];
+    int got = read_bytes(infile, header, DEDUP_HEADER);
+    bytes_read += got;
+    uint32_t length = get_le(header + 1, 4);
+    if (got < DEDUP_HEADER ||
+        length > 4 + ((uint64_t)DEDUP_MAX * MAX_CODE_SIZE)) {
+      valid = false;
+      break;
+    }
+
+    uint8_t *payload = (uint8_t *)calloc(length + UNPACK_SLACK, 1);
+    got = read_bytes(infile, payload, length);
+    bytes_read += got;
+
+    if (got < (int)length) {
+      valid = false;
+    } else if (header[0] == DEDUP_COPY && length == COPY_PAYLOAD) {
+      uint64_t count = get_le(payload + 8, 4);
+      valid = count <= nsymbols - h.size &&
+              copy_output(&h, get_le(payload, 8), count, buf) == true;
+    } else if (header[0] == DEDUP_DATA && length >= 4) {
+      valid = decode_data(&h, t, root, payload, length, nsymbols - h.size);
+    } else {
+      valid = false;
+    }
+    free(payload);
+  }
+  flush_codes(outfile);
+
+  if (h.spooled == true) {
+    spool_close(&h.spool);
+  }
+  free(buf);
+  free(t);
+  return valid;
+}
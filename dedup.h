@@ -0,0 +1,37 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include "node.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DEDUP_MIN    (16 * 1024)  // Shortest block cut at a content boundary.
+#define DEDUP_BITS   16           // Boundary test, one in 64 KiB on average.
+#define DEDUP_MAX    (256 * 1024) // Longest block.
+#define DEDUP_DATA   'D'          // Record of a symbol count and codes.
+#define DEDUP_COPY   'C'          // Record of earlier output to copy.
+#define DEDUP_HEADER 5            // Marker byte and 4-byte length.
+
+typedef struct {
+    uint64_t offset; // Offset of the block in the input.
+    uint64_t source; // Offset of its first occurrence, offset if unique.
+    uint32_t length;
+} DedupBlock;
+
+typedef struct {
+    uint8_t *data;       // Mapped input.
+    uint64_t size;       // Bytes of input.
+    DedupBlock *blocks;  // Blocks of the input in order.
+    uint64_t nblocks;
+    uint64_t capacity;   // Blocks allocated.
+    uint64_t duplicates; // Bytes in blocks that occurred before.
+} DedupPlan;
+
+DedupPlan *dedup_scan(int infile, uint64_t hist[static ALPHABET]);
+
+void dedup_encode(DedupPlan *p, int outfile, Code table[static ALPHABET]);
+
+void dedup_delete(DedupPlan **p);
+
+bool dedup_decode(int infile, int outfile, Node *root, uint64_t nsymbols);
@@ -1,7 +1,19 @@
 #pragma once
 
 #define BLOCK         4096               // 4KB blocks.
+#define IO_BLOCK      (128 * 1024)       // Default I/O buffer size.
+#define IO_BLOCK_MAX  (64 * 1024 * 1024) // Largest I/O buffer size.
+#define IO_ALIGN      4096               // Alignment of I/O buffers.
 #define ALPHABET      256                // ASCII + Extended ASCII.
 #define MAGIC         0xBEEFBBAD         // 32-bit magic number.
+#define MAGIC_RLE     0xBEEFBBAE         // Magic of run-length coded files.
+#define MAGIC_WIDE    0xBEEFBBAF         // Magic of 16-bit symbol files.
+#define MAGIC_FRAMED  0xBEEFBBB0         // Magic of framed streams.
+#define MAGIC_MEMBER  0xBEEFBBB1         // Magic of appendable members.
+#define MAGIC_TRAILER 0xBEEFBBB2         // Magic of a member's trailer.
+#define MAGIC_DEDUP   0xBEEFBBB3         // Magic of deduplicated files.
+#define MAGIC_ENTROPY 0xBEEFBBB4         // Magic of entropy backend files.
+#define MAGIC_CONTEXT 0xBEEFBBB5         // Magic of order-1 context files.
+#define MAGIC_DELTA   0xBEEFBBB6         // Magic of reference delta files.
 #define MAX_CODE_SIZE (ALPHABET / 8)     // Bytes for a maximum, 256-bit code.
 #define MAX_TREE_SIZE (3 * ALPHABET - 1) // Maximum Huffman tree dump size.
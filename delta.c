@@ -0,0 +1,388 @@
+#include "delta.h"
+#include "bitpack.h"
+#include "hash.h"
+#include "hist.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A delta file is a header and a tree followed by the size and hash of
+   the reference it was coded against, and then by records that are each
+   a marker and the length of its payload like the records of a
+   deduplicated file.  Ranges of the input that occur in the reference
+   become copy records of the reference offset and length, and the bytes
+   between them are coded with the tree in data records.  The decoder
+   rebuilds the input from the same reference. */
+
+#define COPY_PAYLOAD 12         /* Source and length. */
+#define COPY_MAX     UINT32_MAX /* Longest copy record. */
+#define PREAMBLE     16         /* Reference size and hash. */
+#define ROLL_PRIME   0x100000001B3 /* Multiplier of the rolling hash. */
+
+/* Returns the rolling hash of the DELTA_WINDOW bytes at p, the sum of
+   every byte times a power of ROLL_PRIME, which roll() moves along the
+   input a byte at a time. */
+static uint64_t window_hash(const uint8_t *p) {
+  uint64_t h = 0;
+  for (uint32_t i = 0; i < DELTA_WINDOW; i++) {
+    h = (h * ROLL_PRIME) + p[i];
+  }
+  return h;
+}
+
+/* Returns the hash of the window one byte further on, which drops out
+   and adds in, given the factor of the byte leaving the window. */
+static inline uint64_t roll(uint64_t h, uint8_t out, uint8_t in,
+                            uint64_t factor) {
+  return ((h - (out * factor)) * ROLL_PRIME) + in;
+}
+
+/* Table from the hashes of windows of the reference to their offsets.
+   The reference is sampled every DELTA_WINDOW bytes, so any range of at
+   least two windows in common holds a sampled window, and a slot keeps
+   the first window that hashes to it. */
+typedef struct {
+  uint64_t *slot; /* Offset of a window plus one, 0 if the slot is free. */
+  uint32_t bits;  /* Slots are 2^bits. */
+} Index;
+
+/* Returns the slot of a window hash, from its top bits which every byte
+   of the window is mixed into. */
+static inline uint64_t index_slot(Index *x, uint64_t h) {
+  return (h * 0x9E3779B97F4A7C15) >> (64 - x->bits);
+}
+
+/* Indexes the windows of the reference of p. */
+static void index_build(Index *x, DeltaPlan *p) {
+  uint64_t windows = p->ref_size / DELTA_WINDOW;
+  x->bits = 10;
+  while (((uint64_t)1 << x->bits) < 2 * windows) {
+    x->bits++;
+  }
+  x->slot = (uint64_t *)calloc((uint64_t)1 << x->bits, sizeof(uint64_t));
+  for (uint64_t w = 0; w < windows; w++) {
+    uint64_t offset = w * DELTA_WINDOW;
+    uint64_t *s = &x->slot[index_slot(x, window_hash(p->ref + offset))];
+    if (*s == 0) {
+      *s = offset + 1;
+    }
+  }
+}
+
+/* Appends a range of the input to p. */
+static void add_range(DeltaPlan *p, uint64_t offset, uint64_t source,
+                      uint64_t length, bool copy) {
+  if (p->nranges == p->capacity) {
+    p->capacity = p->capacity == 0 ? 1024 : 2 * p->capacity;
+    p->ranges =
+        (DeltaRange *)realloc(p->ranges, p->capacity * sizeof(DeltaRange));
+  }
+  p->ranges[p->nranges++] = (DeltaRange){
+      .offset = offset, .source = source, .length = length, .copy = copy};
+}
+
+/* Maps fd into *data and its size into *size.  Returns false if it can't
+   be mapped. */
+static bool map_file(int fd, uint8_t **data, uint64_t *size) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return false;
+  }
+  *size = st.st_size;
+  *data = NULL;
+  if (*size > 0) {
+    *data = (uint8_t *)mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (*data == MAP_FAILED) {
+      *data = NULL;
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Maps infile and the reference and splits the input into ranges copied
+   from the reference and literal ranges between them.  A rolling hash of
+   the window at every offset of the input is looked up in the index of
+   the reference, and a window found there is extended forward and back
+   as far as the bytes match.  Only literal bytes are counted into hist,
+   since those are the only ones that get coded.  Returns NULL if a file
+   can't be mapped. */
+DeltaPlan *delta_scan(int infile, int reffile, uint64_t hist[static ALPHABET]) {
+  DeltaPlan *p = (DeltaPlan *)calloc(1, sizeof(DeltaPlan));
+  if (map_file(infile, &p->data, &p->size) == false ||
+      map_file(reffile, &p->ref, &p->ref_size) == false) {
+    delta_delete(&p);
+    return NULL;
+  }
+  if (p->size > 0) {
+    madvise(p->data, p->size, MADV_SEQUENTIAL);
+  }
+
+  memset(hist, 0, ALPHABET * sizeof(uint64_t));
+  Index x;
+  index_build(&x, p);
+  uint64_t factor = 1;
+  for (uint32_t i = 1; i < DELTA_WINDOW; i++) {
+    factor *= ROLL_PRIME;
+  }
+
+  uint64_t literal = 0; /* Start of the pending literal range. */
+  uint64_t pos = 0;
+  uint64_t h = p->size >= DELTA_WINDOW ? window_hash(p->data) : 0;
+  while (pos + DELTA_WINDOW <= p->size) {
+    uint64_t s = x.slot[index_slot(&x, h)];
+    uint64_t source = s - 1;
+    if (s != 0 &&
+        memcmp(p->ref + source, p->data + pos, DELTA_WINDOW) == 0) {
+      uint64_t length = DELTA_WINDOW;
+      while (pos + length < p->size && source + length < p->ref_size &&
+             p->data[pos + length] == p->ref[source + length]) {
+        length++;
+      }
+      while (pos > literal && source > 0 &&
+             p->data[pos - 1] == p->ref[source - 1]) {
+        pos--;
+        source--;
+        length++;
+      }
+
+      if (pos > literal) {
+        add_range(p, literal, 0, pos - literal, false);
+        hist_count(hist, p->data + literal, pos - literal);
+      }
+      add_range(p, pos, source, length, true);
+      p->copied += length;
+      pos += length;
+      literal = pos;
+      if (pos + DELTA_WINDOW <= p->size) {
+        h = window_hash(p->data + pos);
+      }
+      continue;
+    }
+
+    if (pos + DELTA_WINDOW == p->size) {
+      break;
+    }
+    h = roll(h, p->data[pos], p->data[pos + DELTA_WINDOW], factor);
+    pos++;
+  }
+  if (literal < p->size) {
+    add_range(p, literal, 0, p->size - literal, false);
+    hist_count(hist, p->data + literal, p->size - literal);
+  }
+
+  free(x.slot);
+  return p;
+}
+
+/* Sets the record header at the front of record. */
+static void put_header(uint8_t *record, uint8_t marker, uint32_t length) {
+  record[0] = marker;
+  for (uint32_t b = 0; b < 4; b++) {
+    record[1 + b] = (length >> (8 * b)) & 0xFF;
+  }
+}
+
+/* Returns the n-byte little-endian number at p. */
+static uint64_t get_le(const uint8_t *p, uint32_t n) {
+  uint64_t v = 0;
+  for (uint32_t b = 0; b < n; b++) {
+    v |= (uint64_t)p[b] << (8 * b);
+  }
+  return v;
+}
+
+/* Sets the n-byte little-endian number v at p. */
+static void put_le(uint8_t *p, uint64_t v, uint32_t n) {
+  for (uint32_t b = 0; b < n; b++) {
+    p[b] = (v >> (8 * b)) & 0xFF;
+  }
+}
+
+/* Sends a copy record of length bytes of the reference at source. */
+static void send_copy(int outfile, uint64_t source, uint32_t length) {
+  uint8_t record[DELTA_HEADER + COPY_PAYLOAD];
+  put_header(record, DELTA_COPY, COPY_PAYLOAD);
+  put_le(record + DELTA_HEADER, source, 8);
+  put_le(record + DELTA_HEADER + 8, length, 4);
+  bytes_written += write_bytes(outfile, record, sizeof(record));
+}
+
+/* Codes the n bytes of buf into record and sends it as a data record,
+   whose payload is the symbol count as 4 bytes followed by the codes
+   padded to a byte boundary. */
+static void send_data(int outfile, PackTable *pack, uint8_t *record,
+                      const uint8_t *buf, uint32_t n) {
+  uint64_t bit = 0;
+  put_le(record + DELTA_HEADER, n, 4);
+  pack_codes(pack, buf, n, record + DELTA_HEADER + 4, &bit);
+
+  uint32_t length = 4 + ((bit + 7) / 8);
+  put_header(record, DELTA_DATA, length);
+  bytes_written += write_bytes(outfile, record, DELTA_HEADER + length);
+}
+
+/* Writes the size and hash of the reference and the records of the ranges
+   of p to outfile, coding literal ranges with table.  Ranges longer than
+   a record holds are split over several records. */
+void delta_encode(DeltaPlan *p, int outfile, Code table[static ALPHABET]) {
+  uint8_t preamble[PREAMBLE];
+  put_le(preamble, p->ref_size, 8);
+  put_le(preamble + 8, hash_bytes(p->ref, p->ref_size, 0), 8);
+  bytes_written += write_bytes(outfile, preamble, PREAMBLE);
+
+  PackTable pack;
+  pack_create(&pack, table);
+  uint8_t *record = (uint8_t *)malloc(
+      DELTA_HEADER + 4 + ((uint64_t)DELTA_MAX * pack.max_len / 8) + 16);
+
+  for (uint64_t i = 0; i < p->nranges; i++) {
+    DeltaRange *r = &p->ranges[i];
+    for (uint64_t done = 0; done < r->length;) {
+      uint64_t n = r->length - done;
+      if (r->copy == true) {
+        n = n < COPY_MAX ? n : COPY_MAX;
+        send_copy(outfile, r->source + done, n);
+      } else {
+        n = n < DELTA_MAX ? n : DELTA_MAX;
+        send_data(outfile, &pack, record, p->data + r->offset + done, n);
+      }
+      done += n;
+    }
+  }
+  free(record);
+}
+
+/* Unmaps the input and reference of a plan and frees it. */
+void delta_delete(DeltaPlan **p) {
+  if (*p == NULL) {
+    return;
+  }
+  if ((*p)->data != NULL) {
+    munmap((*p)->data, (*p)->size);
+  }
+  if ((*p)->ref != NULL) {
+    munmap((*p)->ref, (*p)->ref_size);
+  }
+  free((*p)->ranges);
+  free(*p);
+  *p = NULL;
+}
+
+/* Reads the size and hash of the reference the file was coded against
+   from infile, right after the tree.  Returns true if reffile is that
+   reference. */
+bool delta_check(int infile, int reffile) {
+  uint8_t preamble[PREAMBLE];
+  int got = read_bytes(infile, preamble, PREAMBLE);
+  bytes_read += got;
+  uint8_t *ref = NULL;
+  uint64_t size = 0;
+  if (got < PREAMBLE || map_file(reffile, &ref, &size) == false) {
+    return false;
+  }
+
+  bool same = size == get_le(preamble, 8) &&
+              hash_bytes(ref, size, 0) == get_le(preamble + 8, 8);
+  if (ref != NULL) {
+    munmap(ref, size);
+  }
+  return same;
+}
+
+/* Decodes the payload of a data record of length bytes, which is followed
+   by UNPACK_SLACK readable bytes, to outfile.  Returns the amount of
+   symbols, or 0 if the payload doesn't hold its symbols or would exceed
+   left symbols. */
+static uint32_t decode_data(int outfile, UnpackTable *t, Node *root,
+                            uint8_t *payload, uint32_t length,
+                            uint64_t left) {
+  uint32_t nsymbols = get_le(payload, 4);
+  if (nsymbols > DELTA_MAX || nsymbols > left) {
+    return 0;
+  }
+
+  uint8_t *in = payload + 4;
+  uint64_t nbits = 8 * (uint64_t)(length - 4);
+  uint64_t bit = 0;
+  uint8_t syms[BLOCK];
+
+  for (uint32_t done = 0; done < nsymbols;) {
+    uint32_t want = nsymbols - done < BLOCK ? nsymbols - done : BLOCK;
+    uint32_t k = unpack_symbols(t, in, &bit, nbits, syms, want);
+    k += unpack_tail(root, in, &bit, nbits, syms + k, want - k);
+    if (k == 0) {
+      return 0;
+    }
+    write_symbols(outfile, syms, k);
+    done += k;
+  }
+  return nsymbols;
+}
+
+/* Decodes the records of a delta file, whose reference was checked with
+   delta_check(), from infile to outfile until nsymbols bytes were
+   written.  Copy records are copied from the mapped reference.  Returns
+   false if a record is malformed. */
+bool delta_decode(int infile, int outfile, int reffile, Node *root,
+                  uint64_t nsymbols) {
+  uint8_t *ref = NULL;
+  uint64_t ref_size = 0;
+  if (map_file(reffile, &ref, &ref_size) == false) {
+    return false;
+  }
+
+  UnpackTable *t = (UnpackTable *)malloc(sizeof(UnpackTable));
+  unpack_create(t, root);
+  uint64_t decoded = 0;
+  bool valid = true;
+
+  while (valid == true && decoded < nsymbols) {
+    uint8_t header[DELTA_HEADER];
+    int got = read_bytes(infile, header, DELTA_HEADER);
+    bytes_read += got;
+    uint32_t length = get_le(header + 1, 4);
+    if (got < DELTA_HEADER ||
+        length > 4 + ((uint64_t)DELTA_MAX * MAX_CODE_SIZE)) {
+      valid = false;
+      break;
+    }
+
+    uint8_t *payload = (uint8_t *)calloc(length + UNPACK_SLACK, 1);
+    got = read_bytes(infile, payload, length);
+    bytes_read += got;
+
+    if (got < (int)length) {
+      valid = false;
+    } else if (header[0] == DELTA_COPY && length == COPY_PAYLOAD) {
+      uint64_t source = get_le(payload, 8);
+      uint64_t count = get_le(payload + 8, 4);
+      valid = count <= nsymbols - decoded && source <= ref_size &&
+              count <= ref_size - source;
+      for (uint64_t done = 0; valid == true && done < count;) {
+        uint32_t n = count - done < io_block ? count - done : io_block;
+        write_symbols(outfile, ref + source + done, n);
+        done += n;
+      }
+      decoded += valid == true ? count : 0;
+    } else if (header[0] == DELTA_DATA && length >= 4) {
+      uint32_t n =
+          decode_data(outfile, t, root, payload, length, nsymbols - decoded);
+      valid = n > 0;
+      decoded += n;
+    } else {
+      valid = false;
+    }
+    free(payload);
+  }
+  flush_codes(outfile);
+
+  if (ref != NULL) {
+    munmap(ref, ref_size);
+  }
+  free(t);
+  return valid;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include "node.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DELTA_WINDOW 32           // Bytes hashed to find a match.
+#define DELTA_MAX    (256 * 1024) // Most bytes coded in one data record.
+#define DELTA_DATA   'D'          // Record of a symbol count and codes.
+#define DELTA_COPY   'C'          // Record of reference bytes to copy.
+#define DELTA_HEADER 5            // Marker byte and 4-byte length.
+
+typedef struct {
+    uint64_t offset; // Offset of the range in the input.
+    uint64_t source; // Offset of the range in the reference if copied.
+    uint64_t length;
+    bool copy;       // True if the range is copied from the reference.
+} DeltaRange;
+
+typedef struct {
+    uint8_t *data;       // Mapped input.
+    uint64_t size;       // Bytes of input.
+    uint8_t *ref;        // Mapped reference.
+    uint64_t ref_size;   // Bytes of reference.
+    DeltaRange *ranges;  // Ranges of the input in order.
+    uint64_t nranges;
+    uint64_t capacity;   // Ranges allocated.
+    uint64_t copied;     // Bytes copied from the reference.
+} DeltaPlan;
+
+DeltaPlan *delta_scan(int infile, int reffile, uint64_t hist[static ALPHABET]);
+
+void delta_encode(DeltaPlan *p, int outfile, Code table[static ALPHABET]);
+
+void delta_delete(DeltaPlan **p);
+
+bool delta_check(int infile, int reffile);
+
+bool delta_decode(int infile, int outfile, int reffile, Node *root,
+                  uint64_t nsymbols);
@@ -1,21 +1,40 @@
+#include "analyze.h"
+#include "bitpack.h"
+#include "cache.h"
+#include "client.h"
 #include "code.h"
+#include "context.h"
+#include "dedup.h"
+#include "delta.h"
 #include "defines.h"
+#include "entropy.h"
+#include "frame.h"
+#include "hash.h"
 #include "header.h"
+#include "hist.h"
 #include "huffman.h"
 #include "io.h"
+#include "member.h"
 #include "node.h"
+#include "parallel.h"
+#include "perf.h"
+#include "pipeline.h"
 #include "pq.h"
+#include "rle.h"
+#include "spool.h"
 #include "stack.h"
+#include "wide.h"
 #include <ctype.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#define OPTIONS "hi:o:v"
+#define OPTIONS "hi:o:vpzlwxfRns:cb:dt:auk:D:e:T:r:"
 
 struct Stack {
   uint32_t top;
@@ -29,29 +48,183 @@ struct PriorityQueue {
   Node **items;
 };
 
+/* Prints the help message to stderr. */
+static void usage(char *name) {
+  fprintf(stderr, "SYNOPSIS\n");
+  fprintf(stderr, "  A Huffman encoder.\n");
+  fprintf(stderr,
+          "  Compresses a file using the Huffman coding algorithm.\n\n");
+  fprintf(stderr, "USAGE\n");
+  fprintf(stderr, "  %s [-hvpzlwxfRncdau] [-s MiB] [-b KiB]\n", name);
+  fprintf(stderr, "         [-t threads] [-k dir] [-D socket] [-e backend]\n");
+  fprintf(stderr, "         [-T head] [-r reference] [-i infile] "
+                  "[-o outfile]\n\n");
+  fprintf(stderr, "OPTIONS\n");
+  fprintf(stderr, "  -h             Program usage and help.\n");
+  fprintf(stderr, "  -v             Print compression statistics.\n");
+  fprintf(stderr, "  -p             Overlap I/O and coding on threads.\n");
+  fprintf(stderr, "  -z             Zero-copy output to pipes.\n");
+  fprintf(stderr, "  -l             Run-length code repeated bytes.\n");
+  fprintf(stderr, "  -w             Code 16-bit symbols.\n");
+  fprintf(stderr, "  -x             Code bytes by the byte before them.\n");
+  fprintf(stderr, "  -f             Stream records in flushed frames.\n");
+  fprintf(stderr, "  -R             Frame segments that rsync can match.\n");
+  fprintf(stderr, "  -n             Only report how well blocks compress.\n");
+  fprintf(stderr, "  -c             Print performance counters per phase.\n");
+  fprintf(stderr, "  -s MiB         Stdin kept in memory before spilling.\n");
+  fprintf(stderr, "  -b KiB         Size of the I/O buffers.\n");
+  fprintf(stderr, "  -d             Read the input file with direct I/O.\n");
+  fprintf(stderr, "  -t threads     Code chunks of input on threads.\n");
+  fprintf(stderr, "  -a             Append to outfile as a new member.\n");
+  fprintf(stderr, "  -u             Copy repeated blocks instead of coding.\n");
+  fprintf(stderr, "  -k dir         Reuse the output of unchanged inputs.\n");
+  fprintf(stderr, "  -D socket      Have the daemon at socket compress.\n");
+  fprintf(stderr, "  -e backend     Entropy coder: huffman, tans or auto.\n");
+  fprintf(stderr, "  -T head        Code a shard with the table of head.\n");
+  fprintf(stderr, "  -r reference   Copy the ranges found in reference.\n");
+  fprintf(stderr, "  -i infile      Input file to compress.\n");
+  fprintf(stderr, "  -o outfile     Output of compressed data.\n");
+}
+
+/* If stats are enabled, prints out compression statistics to standard
+   error (stderr). */
+static void print_statistics(bool print_stats, uint64_t infile_size) {
+  if (print_stats == true) {
+    fprintf(stderr, "Uncompressed file size: %lu bytes\n", infile_size);
+    fprintf(stderr, "Compressed file size: %lu bytes\n", bytes_written);
+
+    long double space_saving =
+        100 * (1 - ((long double)bytes_written / (long double)infile_size));
+    fprintf(stderr, "Space saving: %.2Lf%%", space_saving);
+    fprintf(stderr, "\n");
+  }
+}
+
+/* Encodes infile to outfile as a framed stream.  Framed streams are coded
+   as the input arrives, so there's no histogram pass and no temporary
+   copy of stdin, and the file size is left unknown in the header.  An
+   rsyncable stream codes content-defined segments instead of records. */
+static void encode_framed(int input, int output, bool rsyncable) {
+  struct stat SMeta;
+  fstat(input, &SMeta);
+
+  Header header = {.magic = MAGIC_FRAMED,
+                   .permissions = S_ISREG(SMeta.st_mode) ? SMeta.st_mode
+                                                         : 0600,
+                   .tree_size = 0,
+                   .file_size = 0};
+  bytes_written += write_bytes(output, (uint8_t *)&header, sizeof(header));
+  if (rsyncable == true) {
+    frame_encode_rsyncable(input, output);
+  } else {
+    frame_encode(input, output);
+  }
+}
+
+/* Codes the input file as a shard with the tree of the archive head
+   written by merge, into data frames that can follow the head or the
+   shards before it.  Returns the exit status. */
+static int encode_shard(char *head_file, char *input_file, char *output_file,
+                        bool print_stats) {
+  int head = open(head_file, O_RDONLY);
+  Header header = {.magic = 0};
+  Node *tree = NULL;
+  if (head >= 0 &&
+      read_bytes(head, (uint8_t *)&header, sizeof(header)) ==
+          sizeof(header) &&
+      header.magic == MAGIC_FRAMED) {
+    tree = frame_read_table(head);
+  }
+  if (head >= 0) {
+    close(head);
+  }
+  if (tree == NULL) {
+    fprintf(stderr, "Invalid archive head %s\n", head_file);
+    return 1;
+  }
+
+  int input = 0;
+  if (input_file != NULL) {
+    input = open(input_file, O_RDONLY);
+    io_advise(input, false);
+  }
+  int output = 1;
+  if (output_file != NULL) {
+    output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+  }
+
+  bytes_read = 0;
+  perf_begin("coding");
+  bool valid = frame_encode_shard(input, output, tree);
+  perf_end(bytes_read);
+  print_statistics(print_stats, bytes_read);
+  perf_report();
+  close(input);
+  close(output);
+  delete_tree(&tree);
+  if (valid == false) {
+    fprintf(stderr, "The shard has bytes that the head has no codes for\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* Hands input and output to the daemon listening at path, which
+   compresses input to output.  Returns the exit status. */
+static int encode_remote(const char *path, int input, int output,
+                         bool print_stats) {
+  int sock = huffd_connect(path);
+  if (sock < 0) {
+    fprintf(stderr, "Unable to reach the daemon at %s\n", path);
+    return 1;
+  }
+
+  HuffdRequest req = {.op = HUFFD_ENCODE, .flags = 0};
+  HuffdReply reply = {.status = HUFFD_EIO};
+  huffd_call(sock, &req, input, output, &reply);
+  close(sock);
+  if (reply.status != HUFFD_OK) {
+    fprintf(stderr, "%s\n", huffd_error(reply.status));
+    return 1;
+  }
+
+  bytes_written = reply.bytes_out;
+  print_statistics(print_stats, reply.bytes_in);
+  return 0;
+}
+
 int main(int argc, char **argv) {
 
   int opt = 0;
   bool input_file_exists = false;
   bool output_file_exists = false;
   bool print_stats = false;
+  bool pipelined = false;
+  bool zero_copy = false;
+  bool run_length = false;
+  bool wide = false;
+  bool context = false;
+  bool framed = false;
+  bool rsyncable = false;
+  bool analysis = false;
+  uint64_t spool_limit = (uint64_t)SPOOL_LIMIT << 20;
+  uint64_t block_size = IO_BLOCK;
+  bool direct = false;
+  uint32_t threads = 1;
+  bool append = false;
+  bool dedup = false;
+  char *cache_dir = NULL;
+  char *daemon_socket = NULL;
+  char *backend = NULL;
+  char *shard_head = NULL;
+  char *reference_file = NULL;
   char *input_file = NULL;
   char *output_file = NULL;
 
   while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
     switch (opt) {
     case 'h': /* Help Message */
-      fprintf(stderr, "SYNOPSIS\n");
-      fprintf(stderr, "  A Huffman encoder.\n");
-      fprintf(stderr,
-              "  Compresses a file using the Huffman coding algorithm.\n\n");
-      fprintf(stderr, "USAGE\n");
-      fprintf(stderr, "  %s [-h] [-i infile] [-o outfile]\n\n", argv[0]);
-      fprintf(stderr, "OPTIONS\n");
-      fprintf(stderr, "  -h             Program usage and help.\n");
-      fprintf(stderr, "  -v             Print compression statistics.\n");
-      fprintf(stderr, "  -i infile      Input file to compress.\n");
-      fprintf(stderr, "  -o outfile     Output of compressed data.\n");
+      usage(argv[0]);
       return 0;
     case 'i': /* Input File */
       if (access(optarg, F_OK) != 0) {
@@ -68,142 +241,621 @@ int main(int argc, char **argv) {
     case 'v': /* Enabling Stats */
       print_stats = true;
       break;
+    case 'p': /* Enabling the threaded pipeline */
+      pipelined = true;
+      break;
+    case 'z': /* Enabling zero-copy output to pipes */
+      zero_copy = true;
+      break;
+    case 'l': /* Enabling the run-length stage */
+      run_length = true;
+      break;
+    case 'w': /* Enabling 16-bit symbols */
+      wide = true;
+      break;
+    case 'x': /* Enabling order-1 contexts */
+      context = true;
+      break;
+    case 'f': /* Enabling framed streaming */
+      framed = true;
+      break;
+    case 'R': /* Enabling rsyncable framed segments */
+      framed = true;
+      rsyncable = true;
+      break;
+    case 'n': /* Enabling the analysis report */
+      analysis = true;
+      break;
+    case 'c': /* Enabling performance counters */
+      perf_enable();
+      break;
+    case 'b': /* Setting the I/O buffer size */
+      block_size = strtoull(optarg, NULL, 10) << 10;
+      break;
+    case 'd': /* Enabling direct I/O on the input file */
+      direct = true;
+      break;
+    case 't': /* Setting the amount of coding threads */
+      threads = strtoul(optarg, NULL, 10);
+      break;
+    case 'a': /* Appending a member to the output file */
+      append = true;
+      break;
+    case 'u': /* Enabling deduplication of repeated blocks */
+      dedup = true;
+      break;
+    case 'k': /* Setting the directory of the output cache */
+      cache_dir = optarg;
+      break;
+    case 'D': /* Handing the files to a daemon */
+      daemon_socket = optarg;
+      break;
+    case 'e': /* Choosing the entropy backends */
+      backend = optarg;
+      break;
+    case 'T': /* Coding a shard with a merged table */
+      shard_head = optarg;
+      break;
+    case 'r': /* Coding against a reference file */
+      if (access(optarg, F_OK) != 0) {
+        fprintf(stderr, "Reference file doesn't exist\n");
+        return 1;
+      }
+      reference_file = optarg;
+      break;
+    case 's': /* Setting the in-memory spool limit */
+      spool_limit = strtoull(optarg, NULL, 10) << 20;
+      break;
     default: /* Bad Option */
-      fprintf(stderr, "SYNOPSIS\n");
-      fprintf(stderr, "  A Huffman encoder.\n");
-      fprintf(stderr,
-              "  Compresses a file using the Huffman coding algorithm.\n\n");
-      fprintf(stderr, "USAGE\n");
-      fprintf(stderr, "  %s [-h] [-i infile] [-o outfile]\n\n", argv[0]);
-      fprintf(stderr, "OPTIONS\n");
-      fprintf(stderr, "  -h             Program usage and help.\n");
-      fprintf(stderr, "  -v             Print compression statistics.\n");
-      fprintf(stderr, "  -i infile      Input file to compress.\n");
-      fprintf(stderr, "  -o outfile     Output of compressed data.\n");
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (io_set_block(block_size) == false) {
+    fprintf(stderr, "Invalid I/O buffer size\n");
+    return 1;
+  }
+
+  /* An analysis only runs the histogram pass and reports the sizes the
+     default mode would write, so no other mode applies to it. */
+  if (analysis == true) {
+    int input = 0;
+    if (input_file_exists == true) {
+      input = open(input_file, O_RDONLY);
+      io_advise(input, direct);
+    }
+    int output = 1;
+    if (output_file_exists == true) {
+      output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    }
+    uint64_t analyzed = analyze(input, output);
+    if (print_stats == true) {
+      fprintf(stderr, "Bytes analyzed: %" PRIu64 "\n", analyzed);
+    }
+    perf_report();
+    close(input);
+    close(output);
+    return 0;
+  }
+
+  if (run_length == true && wide == true) {
+    fprintf(stderr, "The -l and -w options can't be combined\n");
+    return 1;
+  }
+
+  if (context == true && (run_length == true || wide == true ||
+                          framed == true || append == true || dedup == true ||
+                          backend != NULL || shard_head != NULL)) {
+    fprintf(stderr, "The -x option can't be combined with -l, -w, -f, -R, -a, "
+                    "-u, -e or -T\n");
+    return 1;
+  }
+
+  if (reference_file != NULL &&
+      (run_length == true || wide == true || context == true ||
+       framed == true || append == true || dedup == true || backend != NULL ||
+       shard_head != NULL || cache_dir != NULL || daemon_socket != NULL)) {
+    fprintf(stderr, "The -r option can't be combined with -l, -w, -x, -f, "
+                    "-R, -a, -u, -e, -T, -k or -D\n");
+    return 1;
+  }
+
+  /* With a daemon, only the files are opened here and the daemon
+     compresses them in the format of the default mode. */
+  if (daemon_socket != NULL) {
+    int input = 0;
+    if (input_file_exists == true) {
+      input = open(input_file, O_RDONLY);
+    }
+    int output = 1;
+    if (output_file_exists == true) {
+      struct stat SMeta;
+      fstat(input, &SMeta);
+      output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+      fchmod(output, S_ISREG(SMeta.st_mode) ? SMeta.st_mode : 0600);
+    }
+    int status = encode_remote(daemon_socket, input, output, print_stats);
+    close(input);
+    close(output);
+    return status;
+  }
+
+  if (append == true &&
+      (output_file_exists == false || run_length == true || wide == true ||
+       framed == true)) {
+    fprintf(stderr, "The -a option needs -o and can't be combined with -l, "
+                    "-w or -f\n");
+    return 1;
+  }
+
+  if (dedup == true && (run_length == true || wide == true ||
+                        framed == true || append == true)) {
+    fprintf(stderr, "The -u option can't be combined with -l, -w, -f or -a\n");
+    return 1;
+  }
+
+  if (backend != NULL && entropy_valid(backend) == false) {
+    fprintf(stderr, "Unknown entropy backend %s\n", backend);
+    return 1;
+  }
+
+  if (backend != NULL && (run_length == true || wide == true ||
+                          framed == true || append == true || dedup == true)) {
+    fprintf(stderr, "The -e option can't be combined with -l, -w, -f, -a or "
+                    "-u\n");
+    return 1;
+  }
+
+  if (cache_dir != NULL && (framed == true || append == true)) {
+    fprintf(stderr, "The -k option can't be combined with -f or -a\n");
+    return 1;
+  }
+
+  if (shard_head != NULL) {
+    if (run_length == true || wide == true || framed == true ||
+        append == true || dedup == true || backend != NULL ||
+        cache_dir != NULL) {
+      fprintf(stderr, "The -T option can't be combined with -l, -w, -f, -R, "
+                      "-a, -u, -e or -k\n");
       return 1;
     }
+    return encode_shard(shard_head, input_file, output_file, print_stats);
   }
 
-  /* Setting the input file descriptor with the input file or a temp file
-     in cases where the message read was from stdin (standard output). */
+  if (framed == true) {
+    if (run_length == true || wide == true) {
+      fprintf(stderr, "The -f option can't be combined with -l or -w\n");
+      return 1;
+    }
+
+    int input = 0;
+    if (input_file_exists == true) {
+      input = open(input_file, O_RDONLY);
+    }
+    int output = 1;
+    if (output_file_exists == true) {
+      output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    }
+
+    perf_begin("framing");
+    encode_framed(input, output, rsyncable);
+    perf_end(bytes_read);
+    print_statistics(print_stats, bytes_read);
+    perf_report();
+    close(input);
+    close(output);
+    return 0;
+  }
+
+  /* Setting the input file descriptor with the input file or a spool in
+     cases where the message read was from stdin (standard input).  The
+     spool is kept in memory and only spills to $TMPDIR once it grows past
+     the spool limit. */
   int input;
+  Spool spool = {.fd = -1};
   if (input_file_exists == true) {
     input = open(input_file, O_RDWR | O_CREAT, 0777);
+    if (io_advise(input, direct) == false) {
+      fprintf(stderr, "Direct I/O unavailable, using the page cache\n");
+      direct = false;
+    }
+  } else if (spool_open(&spool, spool_limit) == true) {
+    input = spool.fd;
   } else {
-    input = open("message_from_stdin.txt", O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    fprintf(stderr, "Unable to spool standard input\n");
+    return 1;
   }
 
-  /* Initializes the histogram, table, and header. */
+  /* Initializes the histograms, table, and header. */
   uint64_t histogram[ALPHABET] = {0};
-  Code *table = (Code *)calloc(ALPHABET, sizeof(Code));
+  uint64_t tokens[RLE_ALPHABET] = {0};
+  uint64_t *pairs = NULL;
+  if (wide == true) {
+    pairs = (uint64_t *)calloc(WIDE_ALPHABET, sizeof(uint64_t));
+  }
+  uint64_t *contexts = NULL;
+  if (context == true) {
+    contexts = (uint64_t *)calloc(CONTEXTS, sizeof(uint64_t));
+  }
+  Code *table = (Code *)calloc(RLE_ALPHABET, sizeof(Code));
   Header header = {
       .magic = 0, .permissions = 0, .tree_size = 0, .file_size = 0};
+  RunCoder runs;
+  rle_init(&runs, tokens, NULL, -1);
 
   /* Count the frequencies of characters from the input file or stdin
-     and put the frequencies in the histogram. */
-  uint8_t character[1];
-  if (input_file_exists == true) {
-    while (read_bytes(input, character, 1) > 0) {
-      histogram[(uint8_t)character[0]] += 1;
+     a block at a time and put the frequencies in the histogram.  With
+     run-length coding the run tokens are counted as well, and with 16-bit
+     symbols the byte pairs are counted instead.  Blocks hold an even
+     amount of bytes, so pairs never straddle two blocks.  With contexts,
+     every byte is also counted under the byte before it.  With a cache,
+     the input is hashed on the way. */
+  perf_begin("histogram");
+  HashState content;
+  hash_init(&content, 0);
+  uint8_t *block = io_alloc(io_block);
+  int nbytes = 0;
+  int source = input_file_exists == true ? input : 0;
+  uint8_t last = 0;
+  uint64_t counted = 0;
+  while ((nbytes = read_bytes(source, block, io_block)) > 0) {
+    counted += nbytes;
+    if (wide == true) {
+      hist_count_wide(pairs, block, nbytes);
+      last = block[nbytes - 1];
+    } else {
+      hist_count(histogram, block, nbytes);
     }
-  } else {
-    while (read_bytes(0, character, 1) > 0) {
-      histogram[(uint8_t)character[0]] += 1;
-      write_bytes(input, character, 1);
+    if (run_length == true) {
+      rle_feed(&runs, block, nbytes);
+    }
+    if (context == true) {
+      context_count(contexts, &last, block, nbytes);
+    }
+    if (cache_dir != NULL) {
+      hash_update(&content, block, nbytes);
     }
+    if (input_file_exists == false &&
+        spool_write(&spool, block, nbytes) == false) {
+      spool_close(&spool);
+      return 1;
+    }
+  }
+  rle_finish(&runs);
+  perf_end(counted);
+
+  /* Gets relevant stats from the input file descriptor.  Spooled stdin
+     gets the permissions of a private regular file. */
+  if (input_file_exists == false) {
+    input = spool_rewind(&spool);
+  }
+  struct stat SMeta;
+  fstat(input, &SMeta);
+  mode_t sMode = SMeta.st_mode;
+  off_t infile_size = SMeta.st_size;
+  if (input_file_exists == false) {
+    sMode = S_IFREG | 0600;
+  }
+
+  /* Opens the output, which an appended member does further down. */
+  int output = 1;
+  if (append == false && output_file_exists == true) {
+    output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    fchmod(output, sMode);
   }
 
-  if (histogram[0] == 0) {
-    histogram[0] = 1;
+  /* With a cache, an input that was compressed in the same mode before is
+     copied from its entry instead of being coded again.  Otherwise it is
+     coded into a new entry, which is copied to the output at the end. */
+  Cache cache = {.dir = cache_dir, .fd = -1, .outfile = output};
+  if (cache_dir != NULL) {
+    uint64_t digest[2];
+    hash_final(&content, digest);
+    char mode = run_length == true ? 'l' : wide == true ? 'w' : 'h';
+    if (dedup == true) {
+      mode = 'u';
+    } else if (context == true) {
+      mode = 'x';
+    } else if (backend != NULL) {
+      mode = toupper(backend[0]);
+    }
+    cache_name(&cache, digest, infile_size, mode);
+
+    if (cache_fetch(&cache, output, sMode) == true) {
+      print_statistics(print_stats, infile_size);
+      perf_report();
+      if (input_file_exists == true) {
+        close(input);
+      } else {
+        spool_close(&spool);
+      }
+      close(output);
+      free(block);
+      free(table);
+      free(pairs);
+      free(contexts);
+      return 0;
+    }
+    output = cache_begin(&cache, output);
   }
 
-  if (histogram[1] == 0) {
-    histogram[1] = 1;
+  /* Deduplication maps the input and cuts it into blocks, and the tree
+     is built from the bytes of the blocks that didn't occur before. */
+  DedupPlan *plan = NULL;
+  if (dedup == true) {
+    perf_begin("dedup");
+    plan = dedup_scan(input, histogram);
+    if (plan == NULL) {
+      fprintf(stderr, "Unable to map the input\n");
+      return 1;
+    }
+    perf_end(infile_size);
   }
 
-  /* Counts the amount of unique symbols present in the histogram */
-  for (uint64_t i = 0; i < 256; i++) {
-    if (histogram[i] != 0) {
-      header.tree_size++;
+  /* A delta maps the input and the reference and finds the ranges they
+     have in common, and the tree is built from the bytes between them. */
+  DeltaPlan *delta = NULL;
+  if (reference_file != NULL) {
+    perf_begin("delta");
+    int reference = open(reference_file, O_RDONLY);
+    delta = reference >= 0 ? delta_scan(input, reference, histogram) : NULL;
+    if (reference >= 0) {
+      close(reference);
+    }
+    if (delta == NULL) {
+      fprintf(stderr, "Unable to map the input or the reference\n");
+      return 1;
     }
+    perf_end(infile_size);
   }
 
-  /* Builds the Huffman Tree*/
-  Node *tree = build_tree(histogram);
+  /* Keeps the counts from before phantom symbols are added, which an
+     appended member prices the tree of the previous member with. */
+  uint64_t counts[ALPHABET];
+  memcpy(counts, histogram, sizeof(counts));
 
-  /* Builds the Code Table */
-  build_codes(tree, table);
+  /* Inputs of at most two different symbols take fast paths that don't
+     build a tree.  A run-length coded input of one repeated byte needs no
+     codes at all, and otherwise the two symbols get 1-bit codes which are
+     packed 8 symbols at a time. */
+  perf_begin("tree");
+  uint32_t symbols = hist_symbols(histogram);
+  bool fill = run_length == true && symbols <= 1;
+  bool two = run_length == false && wide == false && backend == NULL &&
+             context == false && symbols <= 2;
+  uint8_t one = 0;
+  Node *tree = NULL;
+  WideTable *pair_table = NULL;
+  EntropyCoder *coder = NULL;
+  ContextModel *model = NULL;
 
-  /* Gets relevant stats from the input file descriptor */
-  struct stat SMeta;
-  fstat(input, &SMeta);
-  mode_t sMode = SMeta.st_mode;
-  off_t infile_size = SMeta.st_size;
+  if (wide == true) {
+    /* Builds the canonical codes of the byte pairs.  A trailing odd byte
+       is kept in the table instead of being coded. */
+    pair_table = wide_create(pairs);
+    pair_table->tail = last;
+  } else if (fill == true) {
+    header.tree_size = 0;
+  } else if (run_length == true) {
+    /* Builds the Huffman Tree and Code Table of the run-length tokens. */
+    for (uint32_t i = 0; i < RLE_ALPHABET; i++) {
+      if (tokens[i] != 0) {
+        header.tree_size++;
+      }
+    }
+    tree = build_tree_n(tokens, RLE_ALPHABET);
+    build_codes(tree, table);
+    header.tree_size = (4 * header.tree_size) - 1;
+  } else if (context == true) {
+    /* Clusters the previous bytes and builds the tree of every group. */
+    model = context_create(contexts);
+  } else if (backend != NULL) {
+    /* Builds the tables of the chosen backends, which are dumped by the
+       coder after the header. */
+    coder = entropy_create(backend, histogram);
+  } else {
+    /* Builds the Huffman Tree and Code Table.  With at most two symbols
+       the tree is a root over two leaves, and the right one is coded as
+       a set bit in the bitmap. */
+    tree = build_byte_tree(histogram, &header.tree_size);
+    build_codes(tree, table);
+    one = tree->right->symbol;
+  }
 
   /* Sets the header's attributes */
-  header.magic = MAGIC;
+  header.magic = run_length == true ? MAGIC_RLE : MAGIC;
+  if (wide == true) {
+    header.magic = MAGIC_WIDE;
+  }
+  if (append == true) {
+    header.magic = MAGIC_MEMBER;
+  }
+  if (dedup == true) {
+    header.magic = MAGIC_DEDUP;
+  }
+  if (delta != NULL) {
+    header.magic = MAGIC_DELTA;
+  }
+  if (coder != NULL) {
+    header.magic = MAGIC_ENTROPY;
+  }
+  if (model != NULL) {
+    header.magic = MAGIC_CONTEXT;
+  }
   header.permissions = sMode;
-  header.tree_size = (3 * header.tree_size) - 1;
   header.file_size = infile_size;
 
   /* Writes the header and dumps tree to the output file or stdout
-     (standard output). */
-  int output = 0;
-  if (output_file_exists == true) {
-    output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
-    fchmod(output, sMode);
-    bytes_written += write_bytes(output, (uint8_t *)&header, sizeof(header));
-    dump_tree(output, tree);
+     (standard output).  A run-length coded file of one repeated byte
+     stores that byte instead of a tree, and 16-bit symbols store their
+     code lengths instead. */
+  uint64_t member_start = 0;
+  uint64_t tree_start = 0;
+  if (append == true) {
+    /* An appended member reuses the tree of the member before it if that
+       codes the input in fewer bits than a new tree and its dump. */
+    output = open(output_file, O_CREAT | O_RDWR, 0600);
+    Node *prev = NULL;
+    if (member_open(output, &prev, &tree_start) == false) {
+      fprintf(stderr, "Can only append to files written without -l, -w "
+                      "and -f\n");
+      return 1;
+    }
+    member_start = lseek(output, 0, SEEK_END);
+    if (member_start == 0) {
+      fchmod(output, sMode);
+    }
+
+    if (prev != NULL) {
+      Code *reused = (Code *)calloc(RLE_ALPHABET, sizeof(Code));
+      build_codes(prev, reused);
+      uint64_t new_bits =
+          member_bits(table, counts) + (8 * (uint64_t)header.tree_size);
+      if (member_bits(reused, counts) <= new_bits) {
+        free(table);
+        table = reused;
+        header.tree_size = 0;
+        two = false;
+      } else {
+        free(reused);
+      }
+      delete_tree(&prev);
+    }
+    if (header.tree_size > 0) {
+      tree_start = member_start;
+    }
+  }
+  bytes_written += write_bytes(output, (uint8_t *)&header, sizeof(header));
+  if (append == true && header.tree_size == 0) {
+    /* Coded with the tree of the previous member. */
+  } else if (fill == true) {
+    uint8_t symbol[1] = {0};
+    while (symbols == 1 && histogram[symbol[0]] == 0) {
+      symbol[0]++;
+    }
+    bytes_written += write_bytes(output, symbol, 1);
+  } else if (wide == true) {
+    wide_dump(output, pair_table);
+  } else if (run_length == true) {
+    dump_tree_wide(output, tree);
+  } else if (model != NULL) {
+    context_dump(output, model);
+  } else if (coder != NULL) {
+    entropy_dump(coder, output);
   } else {
-    bytes_written += write_bytes(1, (uint8_t *)&header, sizeof(header));
-    dump_tree(1, tree);
+    dump_tree(output, tree);
   }
 
+  perf_end(counted);
+
   /* Resets the input file descriptor so that the message from the input
-     file or stdin can be read again. */
-  close(input);
+     file or the spooled stdin can be read again. */
   if (input_file_exists == true) {
+    close(input);
     input = open(input_file, O_RDWR | O_CREAT, 0777);
+    io_advise(input, direct);
   } else {
-    input = open("message_from_stdin.txt", O_RDWR | O_CREAT, 0777);
+    input = spool_rewind(&spool);
+  }
+
+  /* Zero-copy output only applies to the single threaded coding pass. */
+  if (zero_copy == true && pipelined == false) {
+    enable_zero_copy(output);
   }
 
   /* Write the corresponding code for each symbol in stdin or the input
-     file to stdout or the output file. Also flushes any remaining
-     buffered codes with flush_codes(). */
-  if (output_file_exists == true) {
-    while (read_bytes(input, character, 1) > 0) {
-      write_code(output, &table[character[0]]);
+     file to stdout or the output file a block at a time with the packing
+     kernels. Also flushes any remaining buffered codes with flush_codes().
+     With more than one thread, chunks of input are coded in parallel at
+     bit offsets known from their code lengths, and in pipelined mode the
+     reading, coding and writing are done by separate threads instead.
+     Run-length coding, 16-bit symbols, contexts, deduplication, deltas
+     and entropy backends are always single threaded.  An appended member
+     ends with the trailer that locates it, and a new cache entry is copied
+     to the output. */
+  perf_begin("coding");
+  if (fill == true) {
+    /* Nothing but the header and the repeated byte. */
+  } else if (wide == true) {
+    while ((nbytes = read_bytes(input, block, io_block)) > 0) {
+      wide_encode(output, pair_table, block, nbytes);
+    }
+    flush_codes(output);
+  } else if (run_length == true) {
+    rle_init(&runs, NULL, table, output);
+    while ((nbytes = read_bytes(input, block, io_block)) > 0) {
+      rle_feed(&runs, block, nbytes);
     }
+    rle_finish(&runs);
     flush_codes(output);
+  } else if (dedup == true) {
+    dedup_encode(plan, output, table);
+  } else if (delta != NULL) {
+    delta_encode(delta, output, table);
+  } else if (model != NULL) {
+    last = 0;
+    while ((nbytes = read_bytes(input, block, io_block)) > 0) {
+      context_encode(output, model, &last, block, nbytes);
+    }
+    flush_codes(output);
+  } else if (coder != NULL) {
+    entropy_encode(coder, input, output);
+  } else if (threads > 1 &&
+             parallel_encode(input, output, table, threads) == true) {
+    /* Coded by the threads. */
+  } else if (pipelined == true) {
+    pipeline_encode(input, output, table);
   } else {
-    while (read_bytes(input, character, 1) > 0) {
-      write_code(1, &table[character[0]]);
+    PackTable pack;
+    pack_create(&pack, table);
+
+    while ((nbytes = read_bytes(input, block, io_block)) > 0) {
+      if (two == true) {
+        write_bitmap(output, one, block, nbytes);
+      } else {
+        write_codes(output, &pack, block, nbytes);
+      }
     }
-    flush_codes(1);
+    flush_codes(output);
   }
-
-  /* If stats are enabled, prints out compression statistics to standard
-     error (stderr). */
-  if (print_stats == true) {
-    fprintf(stderr, "Uncompressed file size: %lu bytes\n", infile_size);
-    fprintf(stderr, "Compressed file size: %lu bytes\n", bytes_written);
-
-    long double space_saving =
-        100 * (1 - ((long double)bytes_written / (long double)infile_size));
-    fprintf(stderr, "Space saving: %.2Lf%%", space_saving);
-    fprintf(stderr, "\n");
+  if (append == true) {
+    member_close(output, member_start, tree_start);
   }
+  output = cache_commit(&cache);
+  perf_end(infile_size);
 
-  /* Removes the temporary file from the directory if it was ever used. */
-  if (input_file_exists == false) {
-    remove("message_from_stdin.txt");
+  print_statistics(print_stats, infile_size);
+  if (print_stats == true && plan != NULL) {
+    fprintf(stderr, "Duplicate bytes: %" PRIu64 "\n", plan->duplicates);
   }
+  if (print_stats == true && delta != NULL) {
+    fprintf(stderr, "Reference bytes: %" PRIu64 "\n", delta->copied);
+  }
+  if (print_stats == true && coder != NULL) {
+    entropy_report(coder);
+  }
+  perf_report();
 
-  close(input);
+  /* Closing the spool releases its memory or temporary file. */
+  if (input_file_exists == true) {
+    close(input);
+  } else {
+    spool_close(&spool);
+  }
   close(output);
-  delete_tree(&tree);
+  if (tree != NULL) {
+    delete_tree(&tree);
+  }
+  free(block);
   free(table);
+  free(pairs);
+  free(contexts);
+  wide_delete(&pair_table);
+  dedup_delete(&plan);
+  delta_delete(&delta);
+  entropy_delete(&coder);
+  context_delete(&model);
 
   return 0;
 }
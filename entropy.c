@@ -0,0 +1,326 @@
+#include "entropy.h"
+#include "bitpack.h"
+#include "code.h"
+#include "hist.h"
+#include "huffman.h"
+#include "io.h"
+#include "tans.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A file coded with entropy backends is a header, the tables of the
+   backends its blocks use, and records of ENTROPY_BLOCK symbols each.  A
+   record starts with the selector of the backend that coded it, its
+   symbol count and its length in bits as 4 bytes each, followed by the
+   bits padded to a byte boundary.  All tables are built from the
+   histogram of the whole input, and every block picks the backend that
+   codes it in the fewest bits. */
+
+/* The Huffman backend, which is the tree and the packing kernels that
+   the other modes code with. */
+typedef struct {
+  Node *tree;             /* Tree of the codes. */
+  Code codes[ALPHABET];   /* Code of every symbol. */
+  PackTable pack;         /* Packing kernel table of the codes. */
+  UnpackTable *unpack;    /* Decoding kernel table of the tree. */
+  uint8_t length[ALPHABET]; /* Code length of every symbol. */
+} HuffmanTable;
+
+/* Fills the lookup tables of a table whose tree is set. */
+static HuffmanTable *huffman_tables(HuffmanTable *h) {
+  memset(h->codes, 0, sizeof(h->codes));
+  build_codes(h->tree, h->codes);
+  pack_create(&h->pack, h->codes);
+  h->unpack = (UnpackTable *)malloc(sizeof(UnpackTable));
+  unpack_create(h->unpack, h->tree);
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    h->length[s] = code_size(&h->codes[s]);
+  }
+  return h;
+}
+
+/* Builds a tree from the histogram, with phantom symbols added until
+   there are two like the default mode does. */
+static void *huffman_build(uint64_t hist[static ALPHABET]) {
+  uint64_t counts[ALPHABET];
+  memcpy(counts, hist, sizeof(counts));
+  for (uint32_t s = 0; hist_symbols(counts) < 2; s++) {
+    if (counts[s] == 0) {
+      counts[s] = 1;
+    }
+  }
+
+  HuffmanTable *h = (HuffmanTable *)malloc(sizeof(HuffmanTable));
+  h->tree = build_tree(counts);
+  return huffman_tables(h);
+}
+
+/* Writes the size of the dumped tree as 2 bytes and the dump. */
+static void huffman_dump(void *table, int outfile) {
+  HuffmanTable *h = (HuffmanTable *)table;
+  uint8_t buf[2 + MAX_TREE_SIZE];
+  uint16_t size = flatten_tree(h->tree, buf + 2);
+  buf[0] = size & 0xFF;
+  buf[1] = size >> 8;
+  bytes_written += write_bytes(outfile, buf, 2 + size);
+}
+
+/* Reads a tree written by huffman_dump().  Returns NULL if it's too
+   long or malformed. */
+static void *huffman_load(int infile) {
+  uint8_t buf[MAX_TREE_SIZE];
+  int got = read_bytes(infile, buf, 2);
+  bytes_read += got;
+  uint16_t size = buf[0] | (buf[1] << 8);
+  if (got < 2 || size < 3 || size > MAX_TREE_SIZE) {
+    return NULL;
+  }
+  got = read_bytes(infile, buf, size);
+  bytes_read += got;
+  if (got < size || valid_dump(buf, size) == false) {
+    return NULL;
+  }
+
+  HuffmanTable *h = (HuffmanTable *)malloc(sizeof(HuffmanTable));
+  h->tree = rebuild_tree(size, buf);
+  return huffman_tables(h);
+}
+
+/* Returns the bits needed to code the symbols counted in hist. */
+static uint64_t huffman_cost(void *table, uint64_t hist[static ALPHABET]) {
+  HuffmanTable *h = (HuffmanTable *)table;
+  uint64_t bits = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    if (hist[s] > 0 && h->length[s] == 0) {
+      return UINT64_MAX;
+    }
+    bits += hist[s] * h->length[s];
+  }
+  return bits;
+}
+
+/* Packs the codes of the n symbols of in into out and returns the amount
+   of bits. */
+static uint64_t huffman_encode(void *table, const uint8_t *in, uint32_t n,
+                               uint8_t *out) {
+  HuffmanTable *h = (HuffmanTable *)table;
+  uint64_t bit = 0;
+  pack_codes(&h->pack, in, n, out, &bit);
+  return bit;
+}
+
+/* Decodes n symbols from the nbits bits of in into out with the table
+   kernels.  Returns false if the bits run out first. */
+static bool huffman_decode(void *table, const uint8_t *in, uint64_t nbits,
+                           uint8_t *out, uint32_t n) {
+  HuffmanTable *h = (HuffmanTable *)table;
+  uint64_t bit = 0;
+  uint32_t k = unpack_symbols(h->unpack, in, &bit, nbits, out, n);
+  k += unpack_tail(h->tree, in, &bit, nbits, out + k, n - k);
+  return k == n;
+}
+
+/* Frees a table and its tree. */
+static void huffman_destroy(void *table) {
+  HuffmanTable *h = (HuffmanTable *)table;
+  delete_tree(&h->tree);
+  free(h->unpack);
+  free(h);
+}
+
+static const Backend huffman_backend = {.name = "huffman",
+                                        .id = 'H',
+                                        .build = huffman_build,
+                                        .dump = huffman_dump,
+                                        .load = huffman_load,
+                                        .cost = huffman_cost,
+                                        .encode = huffman_encode,
+                                        .decode = huffman_decode,
+                                        .destroy = huffman_destroy};
+
+static const Backend *backends[ENTROPY_BACKENDS] = {&huffman_backend,
+                                                    &tans_backend};
+
+/* Returns the backend with the given selector, or NULL. */
+static const Backend *find_backend(uint8_t id) {
+  for (uint32_t b = 0; b < ENTROPY_BACKENDS; b++) {
+    if (backends[b]->id == id) {
+      return backends[b];
+    }
+  }
+  return NULL;
+}
+
+/* Returns true if name is a backend or auto, which picks one for every
+   block. */
+bool entropy_valid(const char *name) {
+  if (strcmp(name, "auto") == 0) {
+    return true;
+  }
+  for (uint32_t b = 0; b < ENTROPY_BACKENDS; b++) {
+    if (strcmp(name, backends[b]->name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Builds the tables of the backend called name, or of every backend for
+   auto, from the histogram of the input. */
+EntropyCoder *entropy_create(const char *name, uint64_t hist[static ALPHABET]) {
+  EntropyCoder *c = (EntropyCoder *)calloc(1, sizeof(EntropyCoder));
+  bool all = strcmp(name, "auto") == 0;
+  for (uint32_t b = 0; b < ENTROPY_BACKENDS; b++) {
+    if (all == true || strcmp(name, backends[b]->name) == 0) {
+      c->backend[c->count] = backends[b];
+      c->table[c->count] = backends[b]->build(hist);
+      c->count++;
+    }
+  }
+  return c;
+}
+
+/* Writes the amount of tables and every table after its selector. */
+void entropy_dump(EntropyCoder *c, int outfile) {
+  uint8_t count = c->count;
+  bytes_written += write_bytes(outfile, &count, 1);
+  for (uint32_t b = 0; b < c->count; b++) {
+    uint8_t id = c->backend[b]->id;
+    bytes_written += write_bytes(outfile, &id, 1);
+    c->backend[b]->dump(c->table[b], outfile);
+  }
+}
+
+/* Sets the n-byte little-endian number v at p. */
+static void put_le(uint8_t *p, uint64_t v, uint32_t n) {
+  for (uint32_t b = 0; b < n; b++) {
+    p[b] = (v >> (8 * b)) & 0xFF;
+  }
+}
+
+/* Returns the n-byte little-endian number at p. */
+static uint64_t get_le(const uint8_t *p, uint32_t n) {
+  uint64_t v = 0;
+  for (uint32_t b = 0; b < n; b++) {
+    v |= (uint64_t)p[b] << (8 * b);
+  }
+  return v;
+}
+
+/* Codes infile to outfile a block at a time.  With more than one backend,
+   each block is counted and coded by the backend whose table codes those
+   counts in the fewest bits. */
+void entropy_encode(EntropyCoder *c, int infile, int outfile) {
+  uint8_t *block = io_alloc(ENTROPY_BLOCK);
+  uint8_t *record = (uint8_t *)malloc(
+      ENTROPY_RECORD + ((uint64_t)ENTROPY_BLOCK * MAX_CODE_SIZE) + 16);
+  int nbytes = 0;
+
+  while ((nbytes = read_bytes(infile, block, ENTROPY_BLOCK)) > 0) {
+    uint32_t pick = 0;
+    if (c->count > 1) {
+      uint64_t hist[ALPHABET] = {0};
+      hist_count(hist, block, nbytes);
+      uint64_t best = UINT64_MAX;
+      for (uint32_t b = 0; b < c->count; b++) {
+        uint64_t bits = c->backend[b]->cost(c->table[b], hist);
+        if (bits < best) {
+          best = bits;
+          pick = b;
+        }
+      }
+    }
+
+    uint64_t nbits = c->backend[pick]->encode(c->table[pick], block, nbytes,
+                                              record + ENTROPY_RECORD);
+    record[0] = c->backend[pick]->id;
+    put_le(record + 1, nbytes, 4);
+    put_le(record + 5, nbits, 4);
+    bytes_written +=
+        write_bytes(outfile, record, ENTROPY_RECORD + ((nbits + 7) / 8));
+    c->blocks[pick]++;
+  }
+  free(record);
+  free(block);
+}
+
+/* Prints how many blocks each backend coded to stderr. */
+void entropy_report(EntropyCoder *c) {
+  for (uint32_t b = 0; b < c->count; b++) {
+    fprintf(stderr, "Blocks coded with %s: %lu\n", c->backend[b]->name,
+            c->blocks[b]);
+  }
+}
+
+/* Frees the tables and the coder. */
+void entropy_delete(EntropyCoder **c) {
+  if (*c == NULL) {
+    return;
+  }
+  for (uint32_t b = 0; b < (*c)->count; b++) {
+    (*c)->backend[b]->destroy((*c)->table[b]);
+  }
+  free(*c);
+  *c = NULL;
+}
+
+/* Decodes a file coded with entropy backends from infile to outfile,
+   starting with the tables after the header, until nsymbols symbols were
+   written.  Returns false if a table or record is malformed. */
+bool entropy_decode(int infile, int outfile, uint64_t nsymbols) {
+  EntropyCoder *c = (EntropyCoder *)calloc(1, sizeof(EntropyCoder));
+  uint8_t count = 0;
+  bytes_read += read_bytes(infile, &count, 1);
+  bool valid = count >= 1 && count <= ENTROPY_BACKENDS;
+
+  for (uint32_t b = 0; valid == true && b < count; b++) {
+    uint8_t id = 0;
+    bytes_read += read_bytes(infile, &id, 1);
+    c->backend[b] = find_backend(id);
+    if (c->backend[b] != NULL) {
+      c->table[b] = c->backend[b]->load(infile);
+    }
+    valid = c->backend[b] != NULL && c->table[b] != NULL;
+    c->count += valid == true ? 1 : 0;
+  }
+
+  uint64_t capacity = ((uint64_t)ENTROPY_BLOCK * MAX_CODE_SIZE) + 16;
+  uint8_t *in = (uint8_t *)malloc(capacity + UNPACK_SLACK);
+  uint8_t *out = io_alloc(ENTROPY_BLOCK);
+  uint64_t decoded = 0;
+
+  while (valid == true && decoded < nsymbols) {
+    uint8_t header[ENTROPY_RECORD];
+    int got = read_bytes(infile, header, ENTROPY_RECORD);
+    bytes_read += got;
+    uint32_t n = get_le(header + 1, 4);
+    uint64_t nbits = get_le(header + 5, 4);
+    uint32_t length = (nbits + 7) / 8;
+    if (got < ENTROPY_RECORD || n > ENTROPY_BLOCK ||
+        n > nsymbols - decoded || length > capacity) {
+      valid = false;
+      break;
+    }
+
+    got = read_bytes(infile, in, length);
+    bytes_read += got;
+    memset(in + length, 0, UNPACK_SLACK);
+    uint32_t b = 0;
+    while (b < c->count && c->backend[b]->id != header[0]) {
+      b++;
+    }
+    valid = got == (int)length && b < c->count &&
+            c->backend[b]->decode(c->table[b], in, nbits, out, n) == true;
+    if (valid == true) {
+      write_symbols(outfile, out, n);
+      decoded += n;
+    }
+  }
+  flush_codes(outfile);
+
+  free(in);
+  free(out);
+  entropy_delete(&c);
+  return valid;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ENTROPY_BLOCK    (16 * BLOCK) // Symbols coded by one backend at a time.
+#define ENTROPY_BACKENDS 2            // Amount of backends.
+#define ENTROPY_RECORD   9            // Selector, symbol count and bit count.
+
+/* A way of coding blocks of bytes with a table built from a histogram.
+   The coded bits of a block are followed by UNPACK_SLACK readable bytes
+   when they are decoded. */
+typedef struct {
+    const char *name;
+    uint8_t id; // Selector of the blocks the backend codes.
+    void *(*build)(uint64_t hist[static ALPHABET]);
+    void (*dump)(void *table, int outfile);
+    void *(*load)(int infile);
+    uint64_t (*cost)(void *table, uint64_t hist[static ALPHABET]);
+    uint64_t (*encode)(void *table, const uint8_t *in, uint32_t n,
+                       uint8_t *out);
+    bool (*decode)(void *table, const uint8_t *in, uint64_t nbits,
+                   uint8_t *out, uint32_t n);
+    void (*destroy)(void *table);
+} Backend;
+
+typedef struct {
+    const Backend *backend[ENTROPY_BACKENDS]; // Backends the blocks may use.
+    void *table[ENTROPY_BACKENDS];            // Table of each backend.
+    uint32_t count;                           // Backends in use.
+    uint64_t blocks[ENTROPY_BACKENDS];        // Blocks coded by each.
+} EntropyCoder;
+
+bool entropy_valid(const char *name);
+
+EntropyCoder *entropy_create(const char *name, uint64_t hist[static ALPHABET]);
+
+void entropy_dump(EntropyCoder *c, int outfile);
+
+void entropy_encode(EntropyCoder *c, int infile, int outfile);
+
+void entropy_report(EntropyCoder *c);
+
+void entropy_delete(EntropyCoder **c);
+
+bool entropy_decode(int infile, int outfile, uint64_t nsymbols);
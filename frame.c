@@ -0,0 +1,323 @@
+#include "frame.h"
+#include "hash.h"
+#include "hist.h"
+#include "huffman.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* A framed stream is a header followed by frames.  Every frame starts with
+   a marker and the length of the frame's payload, so the receiver knows
+   when a whole frame has arrived, and every frame ends on a byte boundary,
+   so each one can be decoded on its own as soon as it arrives.  A table
+   frame replaces the tree used by the data frames that follow it. */
+
+/* Sets the frame header at the front of frame. */
+static void put_header(uint8_t *frame, uint8_t marker, uint32_t length) {
+  frame[0] = marker;
+  for (uint32_t b = 0; b < 4; b++) {
+    frame[1 + b] = (length >> (8 * b)) & 0xFF;
+  }
+}
+
+/* Returns the bits needed to code the symbols counted in hist with codes
+   of the given lengths. */
+static uint64_t coded_bits(uint64_t hist[static ALPHABET],
+                           uint8_t length[static ALPHABET]) {
+  uint64_t bits = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    bits += hist[s] * length[s];
+  }
+  return bits;
+}
+
+/* Builds a tree from the symbols counted in the window.  Every byte gets
+   a code, since later records may hold bytes that the window doesn't. */
+static Node *window_tree(FrameCoder *f) {
+  uint64_t hist[ALPHABET];
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    hist[s] = f->window[s] + 1;
+  }
+  return build_tree(hist);
+}
+
+/* Makes tree the current tree of the coder, replacing the old one. */
+static void use_tree(FrameCoder *f, Node *tree) {
+  if (f->tree != NULL) {
+    delete_tree(&f->tree);
+  }
+  f->tree = tree;
+  f->dump_size = flatten_tree(f->tree, f->dump);
+  build_codes(f->tree, f->table);
+  pack_create(&f->pack, f->table);
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    f->length[s] = code_size(&f->table[s]);
+  }
+}
+
+/* Decides whether to replace the current tree, based on how far the
+   symbols counted in the window have drifted from it.  A new tree is only
+   worth it if coding the window with it saves more than the table frame
+   costs.  The entropy of the window bounds what a new tree could save, so
+   as long as the current tree is within a table frame of the entropy no
+   tree is built at all.  Returns true if the current tree was replaced. */
+static bool drifted(FrameCoder *f) {
+  uint64_t table_bits = 8 * (FRAME_HEADER + MAX_TREE_SIZE);
+  uint64_t current = coded_bits(f->window, f->length);
+  if (current <= hist_entropy(f->window) + table_bits) {
+    return false;
+  }
+
+  Node *tree = window_tree(f);
+  Code table[ALPHABET];
+  uint8_t length[ALPHABET];
+  build_codes(tree, table);
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    length[s] = code_size(&table[s]);
+  }
+
+  if (coded_bits(f->window, length) + table_bits >= current) {
+    delete_tree(&tree);
+    return false;
+  }
+  use_tree(f, tree);
+  return true;
+}
+
+/* Counts the n bytes of buf into the window and picks the tree they are
+   coded with.  The first records get a tree of their own, and later
+   records keep the current tree until the data drifted away from it.
+   Returns true if the tree changed, in which case it has to be sent in a
+   table frame before the records. */
+bool frame_pick_tree(FrameCoder *f, const uint8_t *buf, uint32_t n) {
+  hist_count(f->window, buf, n);
+  if (f->tree == NULL) {
+    use_tree(f, window_tree(f));
+    return true;
+  }
+  return drifted(f);
+}
+
+/* Puts a table frame of the current tree into frame, which has room for
+   FRAME_HEADER + MAX_TREE_SIZE bytes, and starts a new window.  Returns
+   the length of the frame. */
+uint32_t frame_put_table(FrameCoder *f, uint8_t *frame) {
+  put_header(frame, FRAME_TABLE, f->dump_size);
+  memcpy(frame + FRAME_HEADER, f->dump, f->dump_size);
+  memset(f->window, 0, sizeof(f->window));
+  return FRAME_HEADER + f->dump_size;
+}
+
+/* Codes the n bytes of buf into a data frame in frame, which has room for
+   FRAME_HEADER + 4 bytes and the codes plus 16 bytes.  The payload is the
+   symbol count as 4 bytes followed by the codes, padded to a byte
+   boundary.  Returns the length of the frame. */
+uint32_t frame_put_data(FrameCoder *f, const uint8_t *buf, uint32_t n,
+                        uint8_t *frame) {
+  uint64_t bit = 0;
+  for (uint32_t b = 0; b < 4; b++) {
+    frame[FRAME_HEADER + b] = (n >> (8 * b)) & 0xFF;
+  }
+  pack_codes(&f->pack, buf, n, frame + FRAME_HEADER + 4, &bit);
+
+  uint32_t length = 4 + ((bit + 7) / 8);
+  put_header(frame, FRAME_DATA, length);
+  return FRAME_HEADER + length;
+}
+
+/* Sends the current tree in a table frame and starts a new window. */
+static void send_table(FrameCoder *f) {
+  uint8_t frame[FRAME_HEADER + MAX_TREE_SIZE];
+  uint32_t length = frame_put_table(f, frame);
+  bytes_written += write_bytes(f->outfile, frame, length);
+}
+
+/* Codes the n bytes of buf and sends them in a data frame.  The frame
+   goes out with one write, so it reaches a socket or pipe in one piece. */
+static void send_data(FrameCoder *f, const uint8_t *buf, uint32_t n) {
+  uint64_t capacity = ((uint64_t)n * f->pack.max_len / 8) + 16;
+  uint8_t *frame = (uint8_t *)malloc(FRAME_HEADER + 4 + capacity);
+  uint32_t length = frame_put_data(f, buf, n, frame);
+  bytes_written += write_bytes(f->outfile, frame, length);
+  free(frame);
+}
+
+/* Returns the length of the complete records at the front of the pending
+   input, which is everything up to the last newline.  A record that fills
+   the whole buffer or that ends the input is complete as well. */
+static uint32_t complete_records(FrameCoder *f, bool eof) {
+  if (eof == true || f->have == BLOCK) {
+    return f->have;
+  }
+  for (uint32_t i = f->have; i > 0; i--) {
+    if (f->pending[i - 1] == '\n') {
+      return i;
+    }
+  }
+  return 0;
+}
+
+/* Encodes infile to outfile as a framed stream.  Input is coded as soon as
+   it arrives instead of after a histogram pass, so each read that ends
+   one or more records is flushed as a data frame right away.  Data frames
+   reuse the current tree without repeating it, and a new tree is only
+   sent in a table frame when it pays for itself. */
+void frame_encode(int infile, int outfile) {
+  FrameCoder *f = (FrameCoder *)calloc(1, sizeof(FrameCoder));
+  f->outfile = outfile;
+  bool eof = false;
+
+  while (eof == false) {
+    ssize_t ret = read(infile, f->pending + f->have, BLOCK - f->have);
+    if (ret <= 0) {
+      eof = true;
+    } else {
+      f->have += ret;
+      bytes_read += ret;
+    }
+
+    uint32_t cut = complete_records(f, eof);
+    if (cut > 0) {
+      if (frame_pick_tree(f, f->pending, cut) == true) {
+        send_table(f);
+      }
+      send_data(f, f->pending, cut);
+      memmove(f->pending, f->pending + cut, f->have - cut);
+      f->have -= cut;
+    }
+  }
+
+  uint8_t end[FRAME_HEADER];
+  put_header(end, FRAME_END, 0);
+  bytes_written += write_bytes(outfile, end, FRAME_HEADER);
+
+  if (f->tree != NULL) {
+    delete_tree(&f->tree);
+  }
+  free(f);
+}
+
+/* Encodes infile to outfile as a framed stream that changes little when
+   the input does, for tools like rsync that transfer only the parts of a
+   file that changed.  The input is cut into segments at content-defined
+   boundaries like the blocks of deduplication, only smaller, so an edit
+   moves at most the boundaries next to it.  Every segment is coded with a
+   tree of its own bytes in a data frame that starts on a byte boundary,
+   so the output of the segments around an edit is the same as before.  A
+   segment whose tree is the same as the one before it doesn't repeat it. */
+void frame_encode_rsyncable(int infile, int outfile) {
+  FrameCoder *f = (FrameCoder *)calloc(1, sizeof(FrameCoder));
+  f->outfile = outfile;
+  uint8_t *buf = io_alloc(FRAME_SEGMENT_MAX);
+  uint32_t have = 0;
+  bool eof = false;
+
+  while (eof == false || have > 0) {
+    if (eof == false) {
+      int got = read_bytes(infile, buf + have, FRAME_SEGMENT_MAX - have);
+      bytes_read += got;
+      have += got;
+      eof = have < FRAME_SEGMENT_MAX;
+    }
+    if (have == 0) {
+      break;
+    }
+    uint32_t n = hash_cut(buf, have, FRAME_SEGMENT_MIN, FRAME_SEGMENT_MAX,
+                          FRAME_SEGMENT_BITS);
+
+    /* Adds phantom symbols until there are two, so the tree has leaves on
+       both sides of its root. */
+    uint64_t hist[ALPHABET] = {0};
+    hist_count(hist, buf, n);
+    for (uint32_t s = 0; hist_symbols(hist) < 2; s++) {
+      if (hist[s] == 0) {
+        hist[s] = 1;
+      }
+    }
+    Node *tree = build_tree(hist);
+    uint8_t dump[MAX_TREE_SIZE];
+    uint16_t size = flatten_tree(tree, dump);
+    if (f->tree == NULL || size != f->dump_size ||
+        memcmp(dump, f->dump, size) != 0) {
+      use_tree(f, tree);
+      send_table(f);
+    } else {
+      delete_tree(&tree);
+    }
+    send_data(f, buf, n);
+    memmove(buf, buf + n, have - n);
+    have -= n;
+  }
+
+  uint8_t end[FRAME_HEADER];
+  put_header(end, FRAME_END, 0);
+  bytes_written += write_bytes(outfile, end, FRAME_HEADER);
+
+  if (f->tree != NULL) {
+    delete_tree(&f->tree);
+  }
+  free(buf);
+  free(f);
+}
+
+/* Writes a table frame of tree to outfile, which the data frames after
+   it are decoded with. */
+void frame_write_table(int outfile, Node *tree) {
+  uint8_t frame[FRAME_HEADER + MAX_TREE_SIZE];
+  uint16_t size = flatten_tree(tree, frame + FRAME_HEADER);
+  put_header(frame, FRAME_TABLE, size);
+  bytes_written += write_bytes(outfile, frame, FRAME_HEADER + size);
+}
+
+/* Reads a table frame from infile and returns its tree, or NULL if the
+   next frame isn't a table of a valid tree. */
+Node *frame_read_table(int infile) {
+  uint8_t header[FRAME_HEADER];
+  int got = read_bytes(infile, header, FRAME_HEADER);
+  bytes_read += got;
+  uint32_t length = header[1] | header[2] << 8 | header[3] << 16 |
+                    (uint32_t)header[4] << 24;
+  if (got < FRAME_HEADER || header[0] != FRAME_TABLE || length < 3 ||
+      length > MAX_TREE_SIZE) {
+    return NULL;
+  }
+
+  uint8_t dump[MAX_TREE_SIZE];
+  got = read_bytes(infile, dump, length);
+  bytes_read += got;
+  if (got < (int)length || valid_dump(dump, length) == false) {
+    return NULL;
+  }
+  return rebuild_tree(length, dump);
+}
+
+/* Codes infile with the codes of tree into data frames of up to io_block
+   symbols, without a header or a table frame, so the output can follow a
+   table frame of the same tree or the frames of another shard coded with
+   it.  Returns false if infile has a byte without a code, in which case
+   the output ends at the frames before it. */
+bool frame_encode_shard(int infile, int outfile, Node *tree) {
+  FrameCoder *f = (FrameCoder *)calloc(1, sizeof(FrameCoder));
+  f->outfile = outfile;
+  use_tree(f, tree);
+  uint8_t *block = io_alloc(io_block);
+  bool valid = true;
+  int nbytes = 0;
+
+  while (valid == true && (nbytes = read_bytes(infile, block, io_block)) > 0) {
+    bytes_read += nbytes;
+    uint64_t hist[ALPHABET] = {0};
+    hist_count(hist, block, nbytes);
+    for (uint32_t s = 0; s < ALPHABET; s++) {
+      valid = valid == true && (hist[s] == 0 || f->length[s] > 0);
+    }
+    if (valid == true) {
+      send_data(f, block, nbytes);
+    }
+  }
+
+  free(block);
+  free(f);
+  return valid;
+}
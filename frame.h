@@ -0,0 +1,47 @@
+#pragma once
+
+#include "bitpack.h"
+#include "code.h"
+#include "defines.h"
+#include "node.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FRAME_TABLE  'T' // Frame holding a dumped tree.
+#define FRAME_DATA   'D' // Frame holding a symbol count and coded symbols.
+#define FRAME_END    'E' // Empty frame that ends the stream.
+#define FRAME_HEADER 5   // Marker byte and 4-byte little-endian length.
+
+#define FRAME_SEGMENT_MIN  (4 * 1024)  // Shortest rsyncable segment.
+#define FRAME_SEGMENT_BITS 13          // Boundary test, one in 8 KiB.
+#define FRAME_SEGMENT_MAX  (64 * 1024) // Longest rsyncable segment.
+
+typedef struct {
+    int outfile;
+    Node *tree;                  // Current tree, NULL before the first table.
+    Code table[ALPHABET];        // Codes of the current tree.
+    PackTable pack;              // Packing kernel table of the codes.
+    uint8_t length[ALPHABET];    // Code length of each symbol.
+    uint8_t dump[MAX_TREE_SIZE]; // Dump of the current tree.
+    uint16_t dump_size;
+    uint64_t window[ALPHABET];   // Symbols coded since the last table frame.
+    uint8_t pending[BLOCK];      // Input that has not been framed yet.
+    uint32_t have;               // Bytes held in pending.
+} FrameCoder;
+
+bool frame_pick_tree(FrameCoder *f, const uint8_t *buf, uint32_t n);
+
+uint32_t frame_put_table(FrameCoder *f, uint8_t *frame);
+
+uint32_t frame_put_data(FrameCoder *f, const uint8_t *buf, uint32_t n,
+                        uint8_t *frame);
+
+void frame_encode(int infile, int outfile);
+
+void frame_encode_rsyncable(int infile, int outfile);
+
+void frame_write_table(int outfile, Node *tree);
+
+Node *frame_read_table(int infile);
+
+bool frame_encode_shard(int infile, int outfile, Node *tree);
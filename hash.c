@@ -0,0 +1,168 @@
+#include "hash.h"
+#include <string.h>
+
+/* A fast non-cryptographic hash in the style of xxHash64: four lanes each
+   take an 8-byte word of every 32-byte stripe, so the multiplications of
+   the lanes overlap, and the lanes are folded together at the end.  The
+   state can be fed any amount of bytes at a time and gives the same
+   digest as hashing them all at once. */
+
+static const uint64_t P1 = 0x9E3779B185EBCA87;
+static const uint64_t P2 = 0xC2B2AE3D27D4EB4F;
+static const uint64_t P3 = 0x165667B19E3779F9;
+static const uint64_t P4 = 0x85EBCA77C2B2AE63;
+static const uint64_t P5 = 0x27D4EB2F165667C5;
+
+static inline uint64_t rotl(uint64_t x, uint32_t r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+/* Mixes the word w into the lane acc. */
+static inline uint64_t round64(uint64_t acc, uint64_t w) {
+  return rotl(acc + (w * P2), 31) * P1;
+}
+
+/* Spreads every bit of x over the whole word. */
+static uint64_t avalanche(uint64_t x) {
+  x ^= x >> 33;
+  x *= P2;
+  x ^= x >> 29;
+  x *= P3;
+  x ^= x >> 32;
+  return x;
+}
+
+/* Mixes the n full stripes at p into the lanes. */
+static void stripes(HashState *h, const uint8_t *p, uint64_t n) {
+  uint64_t l0 = h->lane[0], l1 = h->lane[1], l2 = h->lane[2],
+           l3 = h->lane[3];
+  for (uint64_t i = 0; i < n; i++, p += HASH_STRIPE) {
+    l0 = round64(l0, load64(p));
+    l1 = round64(l1, load64(p + 8));
+    l2 = round64(l2, load64(p + 16));
+    l3 = round64(l3, load64(p + 24));
+  }
+  h->lane[0] = l0;
+  h->lane[1] = l1;
+  h->lane[2] = l2;
+  h->lane[3] = l3;
+}
+
+/* Starts a hash with the given seed. */
+void hash_init(HashState *h, uint64_t seed) {
+  h->lane[0] = seed + P1 + P2;
+  h->lane[1] = seed + P2;
+  h->lane[2] = seed;
+  h->lane[3] = seed - P1;
+  h->have = 0;
+  h->length = 0;
+}
+
+/* Adds the n bytes of buf to the hash. */
+void hash_update(HashState *h, const uint8_t *buf, uint64_t n) {
+  h->length += n;
+
+  if (h->have > 0) {
+    uint32_t fill = HASH_STRIPE - h->have;
+    if (n < fill) {
+      memcpy(h->tail + h->have, buf, n);
+      h->have += n;
+      return;
+    }
+    memcpy(h->tail + h->have, buf, fill);
+    stripes(h, h->tail, 1);
+    buf += fill;
+    n -= fill;
+    h->have = 0;
+  }
+
+  stripes(h, buf, n / HASH_STRIPE);
+  h->have = n % HASH_STRIPE;
+  memcpy(h->tail, buf + n - h->have, h->have);
+}
+
+/* Ends the hash and stores its 128-bit digest.  The first word folds the
+   lanes, the length and the trailing bytes like xxHash64 does, and the
+   second word folds the lanes again in the opposite order with the first
+   word, so both depend on every byte. */
+void hash_final(HashState *h, uint64_t digest[static 2]) {
+  uint64_t *l = h->lane;
+  uint64_t acc = rotl(l[0], 1) + rotl(l[1], 7) + rotl(l[2], 12) +
+                 rotl(l[3], 18);
+  for (uint32_t i = 0; i < 4; i++) {
+    acc = ((acc ^ round64(0, l[i])) * P1) + P4;
+  }
+  acc += h->length;
+
+  uint32_t i = 0;
+  for (; i + 8 <= h->have; i += 8) {
+    acc = (rotl(acc ^ round64(0, load64(h->tail + i)), 27) * P1) + P4;
+  }
+  for (; i < h->have; i++) {
+    acc = rotl(acc ^ (h->tail[i] * P5), 11) * P1;
+  }
+  digest[0] = avalanche(acc);
+
+  uint64_t other = rotl(l[3], 1) + rotl(l[2], 7) + rotl(l[1], 12) +
+                   rotl(l[0], 18);
+  digest[1] = avalanche(other ^ (digest[0] * P3) ^ (h->length * P5));
+}
+
+/* Returns the first word of the digest of the n bytes of buf. */
+uint64_t hash_bytes(const uint8_t *buf, uint64_t n, uint64_t seed) {
+  HashState h;
+  uint64_t digest[2];
+  hash_init(&h, seed);
+  hash_update(&h, buf, n);
+  hash_final(&h, digest);
+  return digest[0];
+}
+
+/* Random words of the rolling hash, one per byte value. */
+static uint64_t gear[256];
+static bool gear_ready = false;
+
+/* Fills the gear table with the same words on every run, so the same
+   input is always cut into the same blocks. */
+static void gear_init(void) {
+  uint64_t x = 0;
+  for (uint32_t s = 0; s < 256; s++) {
+    x += 0x9E3779B97F4A7C15;
+    uint64_t z = x;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    gear[s] = z ^ (z >> 31);
+  }
+  gear_ready = true;
+}
+
+/* Returns the length of the block at the front of the n bytes at p, which
+   is between min and max bytes unless n is shorter.  The gear hash shifts
+   every byte one bit further up, so its top bits only depend on the last
+   64 bytes and a boundary is wherever the top bits of them are all zero,
+   one in 2^bits positions on average.  A block that occurs again is cut
+   the same way wherever it starts. */
+uint32_t hash_cut(const uint8_t *p, uint64_t n, uint32_t min, uint32_t max,
+                  uint32_t bits) {
+  if (n <= min) {
+    return n;
+  }
+  if (gear_ready == false) {
+    gear_init();
+  }
+  uint32_t limit = n < max ? n : max;
+  uint64_t h = 0;
+  for (uint32_t i = min > 64 ? min - 64 : 0; i < limit; i++) {
+    h = (h << 1) + gear[p[i]];
+    if ((h >> (64 - bits)) == 0 && i >= min) {
+      return i + 1;
+    }
+  }
+  return limit;
+}
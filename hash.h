@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HASH_STRIPE 32 // Bytes mixed into the four lanes per round.
+
+typedef struct {
+    uint64_t lane[4];          // Accumulators of the four lanes.
+    uint8_t tail[HASH_STRIPE]; // Bytes that don't fill a stripe yet.
+    uint32_t have;             // Bytes held in tail.
+    uint64_t length;           // Bytes hashed so far.
+} HashState;
+
+void hash_init(HashState *h, uint64_t seed);
+
+void hash_update(HashState *h, const uint8_t *buf, uint64_t n);
+
+void hash_final(HashState *h, uint64_t digest[static 2]);
+
+uint64_t hash_bytes(const uint8_t *buf, uint64_t n, uint64_t seed);
+
+uint32_t hash_cut(const uint8_t *p, uint64_t n, uint32_t min, uint32_t max,
+                  uint32_t bits);
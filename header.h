@@ -8,3 +8,10 @@ typedef struct {
     uint16_t tree_size;
     uint64_t file_size;
 } Header;
+
+typedef struct {
+    uint32_t magic;       // MAGIC_TRAILER.
+    uint32_t reserved;
+    uint64_t member_size; // Bytes of the member, this trailer included.
+    uint64_t tree_back;   // Bytes back to the member holding the tree.
+} Trailer;
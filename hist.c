@@ -0,0 +1,119 @@
+#include "hist.h"
+#include "io.h"
+#include <string.h>
+
+/* Adds the frequencies of the n bytes of buf to the histogram.  Bytes are
+   counted into four separate tables that are summed at the end, so runs
+   of the same byte don't stall on incrementing one counter over and over.
+   This keeps low-entropy inputs like zero-filled images as fast as any
+   other input. */
+void hist_count(uint64_t hist[static ALPHABET], const uint8_t *buf,
+                uint32_t n) {
+  uint32_t count[4][ALPHABET];
+  memset(count, 0, sizeof(count));
+
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    count[0][buf[i]]++;
+    count[1][buf[i + 1]]++;
+    count[2][buf[i + 2]]++;
+    count[3][buf[i + 3]]++;
+  }
+  for (; i < n; i++) {
+    count[0][buf[i]]++;
+  }
+
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    hist[s] += (uint64_t)count[0][s] + count[1][s] + count[2][s] + count[3][s];
+  }
+}
+
+/* Returns log2(x) in 16.16 fixed point, for x > 0. */
+uint64_t hist_log2(uint64_t x) {
+  uint32_t n = 63 - __builtin_clzll(x);
+  uint64_t m = n >= 31 ? x >> (n - 31) : x << (31 - n); /* 1.31 mantissa. */
+  uint64_t result = (uint64_t)n << 16;
+
+  for (uint32_t bit = 1u << 15; bit > 0; bit >>= 1) {
+    m = (m * m) >> 31;
+    if (m >= (UINT64_C(2) << 31)) {
+      m >>= 1;
+      result |= bit;
+    }
+  }
+  return result;
+}
+
+/* Returns the entropy of the symbols counted in hist in bits, rounded
+   down, which no code table can beat. */
+uint64_t hist_entropy(uint64_t hist[static ALPHABET]) {
+  uint64_t total = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    total += hist[s];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  uint64_t log_total = hist_log2(total);
+  uint64_t bits = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    if (hist[s] > 0) {
+      bits += (hist[s] * (log_total - hist_log2(hist[s]))) >> 16;
+    }
+  }
+  return bits;
+}
+
+/* Returns the amount of symbols that occur in the histogram. */
+uint32_t hist_symbols(uint64_t hist[static ALPHABET]) {
+  uint32_t n = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    if (hist[s] != 0) {
+      n++;
+    }
+  }
+  return n;
+}
+
+/* Writes the histogram to outfile as HIST_FILE bytes, every count as 8
+   little-endian bytes, so histograms saved on different machines can be
+   added up. */
+void hist_save(int outfile, uint64_t hist[static ALPHABET]) {
+  uint8_t buf[HIST_FILE];
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    for (uint32_t b = 0; b < 8; b++) {
+      buf[(8 * s) + b] = (hist[s] >> (8 * b)) & 0xFF;
+    }
+  }
+  bytes_written += write_bytes(outfile, buf, HIST_FILE);
+}
+
+/* Adds a histogram written by hist_save() from infile to hist.  Returns
+   false if infile isn't exactly one histogram long. */
+bool hist_load(int infile, uint64_t hist[static ALPHABET]) {
+  uint8_t buf[HIST_FILE + 1];
+  int got = read_bytes(infile, buf, sizeof(buf));
+  bytes_read += got;
+  if (got != HIST_FILE) {
+    return false;
+  }
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    uint64_t count = 0;
+    for (uint32_t b = 0; b < 8; b++) {
+      count |= (uint64_t)buf[(8 * s) + b] << (8 * b);
+    }
+    hist[s] += count;
+  }
+  return true;
+}
+
+/* Adds the frequencies of the n / 2 byte pairs of buf, read as 16-bit
+   little-endian symbols, to the histogram.  The table is too large to
+   split like hist_count() does, so pairs are counted directly. */
+void hist_count_wide(uint64_t hist[static WIDE_ALPHABET], const uint8_t *buf,
+                     uint32_t n) {
+  for (uint32_t i = 0; i + 2 <= n; i += 2) {
+    hist[buf[i] | (buf[i + 1] << 8)]++;
+  }
+}
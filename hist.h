@@ -0,0 +1,24 @@
+#pragma once
+
+#include "defines.h"
+#include "wide.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HIST_FILE (8 * ALPHABET) // Bytes of a saved histogram.
+
+void hist_count(uint64_t hist[static ALPHABET], const uint8_t *buf,
+                uint32_t n);
+
+uint32_t hist_symbols(uint64_t hist[static ALPHABET]);
+
+uint64_t hist_log2(uint64_t x);
+
+uint64_t hist_entropy(uint64_t hist[static ALPHABET]);
+
+void hist_save(int outfile, uint64_t hist[static ALPHABET]);
+
+bool hist_load(int infile, uint64_t hist[static ALPHABET]);
+
+void hist_count_wide(uint64_t hist[static WIDE_ALPHABET], const uint8_t *buf,
+                     uint32_t n);
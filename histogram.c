@@ -0,0 +1,90 @@
+#include "defines.h"
+#include "hist.h"
+#include "io.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define OPTIONS "hi:o:v"
+
+/* Prints the help message to stderr. */
+static void usage(char *name) {
+  fprintf(stderr, "SYNOPSIS\n");
+  fprintf(stderr, "  A histogram counter.\n");
+  fprintf(stderr, "  Counts the bytes of a shard of a dataset for merge.\n\n");
+  fprintf(stderr, "USAGE\n");
+  fprintf(stderr, "  %s [-hv] [-i infile] [-o outfile]\n\n", name);
+  fprintf(stderr, "OPTIONS\n");
+  fprintf(stderr, "  -h             Program usage and help.\n");
+  fprintf(stderr, "  -v             Print the bytes counted.\n");
+  fprintf(stderr, "  -i infile      Input file to count.\n");
+  fprintf(stderr, "  -o outfile     Output of the histogram.\n");
+}
+
+int main(int argc, char **argv) {
+  int opt = 0;
+  bool input_file_exists = false;
+  bool output_file_exists = false;
+  bool print_stats = false;
+  char *input_file = NULL;
+  char *output_file = NULL;
+
+  while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    switch (opt) {
+    case 'h': /* Help Message */
+      usage(argv[0]);
+      return 0;
+    case 'i': /* Input File */
+      if (access(optarg, F_OK) != 0) {
+        fprintf(stderr, "Input file doesn't exist\n");
+        return 1;
+      }
+      input_file_exists = true;
+      input_file = optarg;
+      break;
+    case 'o': /* Output FIle */
+      output_file_exists = true;
+      output_file = optarg;
+      break;
+    case 'v': /* Enabling Stats */
+      print_stats = true;
+      break;
+    default: /* Bad Option */
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  int input = 0;
+  if (input_file_exists == true) {
+    input = open(input_file, O_RDONLY);
+    io_advise(input, false);
+  }
+  int output = 1;
+  if (output_file_exists == true) {
+    output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+  }
+
+  /* Counts the input a block at a time, like the histogram pass of
+     encode, and saves the counts in a form merge can add up. */
+  uint64_t histogram[ALPHABET] = {0};
+  uint8_t *block = io_alloc(io_block);
+  uint64_t counted = 0;
+  int nbytes = 0;
+  while ((nbytes = read_bytes(input, block, io_block)) > 0) {
+    hist_count(histogram, block, nbytes);
+    counted += nbytes;
+  }
+  hist_save(output, histogram);
+
+  if (print_stats == true) {
+    fprintf(stderr, "Bytes counted: %lu\n", counted);
+    fprintf(stderr, "Distinct bytes: %u\n", hist_symbols(histogram));
+  }
+
+  free(block);
+  close(input);
+  close(output);
+  return 0;
+}
@@ -0,0 +1,370 @@
+#include "hstream.h"
+#include "bitpack.h"
+#include "defines.h"
+#include "frame.h"
+#include "header.h"
+#include "huffman.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* The incremental coder reads and writes the framed streams of encode -f,
+   but from and into buffers the caller hands over, like zlib.  Each call
+   consumes as much input and produces as much output as it can and then
+   returns, and the next call picks up at the same byte, so a stream can
+   be driven from an event loop with buffers of any size.  Nothing blocks,
+   and all buffers are allocated by the init functions; memory is only
+   allocated again when the tree changes, which happens a table frame at
+   a time rather than per call. */
+
+/* Bytes of codes a data frame can take, 32 bits per symbol.  Trees whose
+   longest code is longer get shorter data frames. */
+#define DATA_ROOM (4 * HSTREAM_BLOCK)
+
+/* Bytes of the largest run of output one call stages: a table frame and a
+   data frame. */
+#define STAGE_SIZE (2 * FRAME_HEADER + MAX_TREE_SIZE + 4 + DATA_ROOM + 16)
+
+/* Bytes of a data frame payload the decoder holds at once. */
+#define HOLD_SIZE (HSTREAM_BLOCK + MAX_TREE_SIZE)
+
+/* Parts of a framed stream the decoder can be in the middle of. */
+typedef enum { HEADER, FRAME, COUNT, TABLE, DATA, SKIP, END, BROKEN } Phase;
+
+struct HStreamState {
+  /* Encoder. */
+  FrameCoder coder;               /* Tree and window of the stream. */
+  uint8_t pending[HSTREAM_BLOCK]; /* Input that has not been coded yet. */
+  uint32_t have;                  /* Bytes held in pending. */
+  uint8_t stage[STAGE_SIZE];      /* Coded frames not handed out yet. */
+  uint32_t staged;                /* Bytes held in stage. */
+  uint32_t handed;                /* Bytes of stage handed out. */
+  bool ended;                     /* True once the end frame is staged. */
+
+  /* Decoder. */
+  Phase phase;
+  uint8_t head[sizeof(Header)];   /* Header or frame header being read. */
+  uint32_t got;                   /* Bytes of head read so far. */
+  uint32_t length;                /* Bytes of payload not held yet. */
+  uint32_t symbols;               /* Symbols of the frame not decoded yet. */
+  Node *tree;                     /* Tree of the last table frame. */
+  UnpackTable unpack;             /* Decoding kernel table of the tree. */
+  uint8_t hold[HOLD_SIZE + UNPACK_SLACK]; /* Payload being decoded. */
+  uint32_t held;                  /* Bytes held in hold. */
+  uint64_t bit;                   /* Position of the next code in hold. */
+};
+
+/* Allocates the state of a stream and clears the counters. */
+static bool create_state(HStream *s) {
+  s->state = (HStreamState *)calloc(1, sizeof(HStreamState));
+  if (s->state == NULL) {
+    return false;
+  }
+  s->total_in = 0;
+  s->total_out = 0;
+  return true;
+}
+
+/* Starts a stream to encode.  The header of the framed stream is staged
+   as the first output.  Returns false if the state can't be allocated. */
+bool hstream_encode_init(HStream *s) {
+  if (create_state(s) == false) {
+    return false;
+  }
+  Header header = {.magic = MAGIC_FRAMED,
+                   .permissions = S_IFREG | 0600,
+                   .tree_size = 0,
+                   .file_size = 0};
+  memcpy(s->state->stage, &header, sizeof(header));
+  s->state->staged = sizeof(header);
+  s->state->coder.outfile = -1;
+  return true;
+}
+
+/* Hands out as much of the staged output as fits.  Returns true once all
+   of it was handed out. */
+static bool hand_out(HStream *s) {
+  HStreamState *st = s->state;
+  uint64_t n = st->staged - st->handed;
+  if (n > s->avail_out) {
+    n = s->avail_out;
+  }
+  memcpy(s->next_out, st->stage + st->handed, n);
+  s->next_out += n;
+  s->avail_out -= n;
+  s->total_out += n;
+  st->handed += n;
+  if (st->handed < st->staged) {
+    return false;
+  }
+  st->staged = 0;
+  st->handed = 0;
+  return true;
+}
+
+/* Codes the pending input into the stage as a data frame, after a table
+   frame if the tree changed.  If the longest code is too long for all of
+   it to fit, the rest stays pending for the next frame. */
+static void stage_frame(HStreamState *st) {
+  FrameCoder *f = &st->coder;
+  if (frame_pick_tree(f, st->pending, st->have) == true) {
+    st->staged += frame_put_table(f, st->stage + st->staged);
+  }
+
+  uint32_t n = st->have;
+  if ((uint64_t)n * f->pack.max_len > 8 * (uint64_t)DATA_ROOM) {
+    n = (8 * (uint64_t)DATA_ROOM) / f->pack.max_len;
+  }
+  st->staged += frame_put_data(f, st->pending, n, st->stage + st->staged);
+  memmove(st->pending, st->pending + n, st->have - n);
+  st->have -= n;
+}
+
+/* Encodes input into output.  Input is coded a data frame at a time once
+   HSTREAM_BLOCK bytes are pending, all of it with HSTREAM_FLUSH or
+   HSTREAM_FINISH, and HSTREAM_FINISH ends the stream after the last
+   frame.  Returns HSTREAM_END once the end of the stream was handed out,
+   and HSTREAM_OK if the call ran out of input or room for output. */
+int hstream_encode(HStream *s, int flush) {
+  HStreamState *st = s->state;
+  while (hand_out(s) == true) {
+    if (st->ended == true) {
+      return HSTREAM_END;
+    }
+
+    uint64_t n = HSTREAM_BLOCK - st->have;
+    if (n > s->avail_in) {
+      n = s->avail_in;
+    }
+    memcpy(st->pending + st->have, s->next_in, n);
+    st->have += n;
+    s->next_in += n;
+    s->avail_in -= n;
+    s->total_in += n;
+
+    if (st->have == HSTREAM_BLOCK ||
+        (flush != HSTREAM_NONE && st->have > 0)) {
+      stage_frame(st);
+    } else if (flush == HSTREAM_FINISH) {
+      st->stage[0] = FRAME_END;
+      memset(st->stage + 1, 0, FRAME_HEADER - 1);
+      st->staged = FRAME_HEADER;
+      st->ended = true;
+    } else {
+      return HSTREAM_OK;
+    }
+  }
+  return HSTREAM_OK;
+}
+
+/* Starts a stream to decode, which begins with the header of a framed
+   stream.  Returns false if the state can't be allocated. */
+bool hstream_decode_init(HStream *s) {
+  if (create_state(s) == false) {
+    return false;
+  }
+  s->state->phase = HEADER;
+  return true;
+}
+
+/* Moves input into head until it holds want bytes.  Returns true once it
+   does. */
+static bool fill_head(HStream *s, uint32_t want) {
+  HStreamState *st = s->state;
+  uint64_t n = want - st->got;
+  if (n > s->avail_in) {
+    n = s->avail_in;
+  }
+  memcpy(st->head + st->got, s->next_in, n);
+  st->got += n;
+  s->next_in += n;
+  s->avail_in -= n;
+  s->total_in += n;
+  if (st->got < want) {
+    return false;
+  }
+  st->got = 0;
+  return true;
+}
+
+/* Moves as much of the rest of the payload from input into hold as
+   fits. */
+static void fill_hold(HStream *s) {
+  HStreamState *st = s->state;
+  uint64_t n = HOLD_SIZE - st->held;
+  if (n > st->length) {
+    n = st->length;
+  }
+  if (n > s->avail_in) {
+    n = s->avail_in;
+  }
+  memcpy(st->hold + st->held, s->next_in, n);
+  st->held += n;
+  st->length -= n;
+  s->next_in += n;
+  s->avail_in -= n;
+  s->total_in += n;
+}
+
+/* Returns the 4-byte little-endian number at p. */
+static uint32_t get_le32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Reads the header of the next frame and picks the phase that reads its
+   payload.  Returns false if the frame is malformed. */
+static bool start_frame(HStreamState *st) {
+  st->length = get_le32(st->head + 1);
+  st->held = 0;
+  st->bit = 0;
+  switch (st->head[0]) {
+  case FRAME_TABLE:
+    st->phase = TABLE;
+    return st->length >= 3 && st->length <= MAX_TREE_SIZE;
+  case FRAME_DATA:
+    st->phase = COUNT;
+    return st->length >= 4 && st->tree != NULL;
+  case FRAME_END:
+    st->phase = END;
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* Decodes as many symbols of the data frame in hold as are complete and
+   fit into the output, and drops the bytes of the codes decoded.  Returns
+   false if the whole payload is held but its symbols can't be decoded. */
+static bool decode_held(HStream *s) {
+  HStreamState *st = s->state;
+  uint64_t want = st->symbols < s->avail_out ? st->symbols : s->avail_out;
+  uint64_t nbits = 8 * (uint64_t)st->held;
+  uint32_t k = unpack_symbols(&st->unpack, st->hold, &st->bit, nbits,
+                              s->next_out, want);
+  k += unpack_tail(st->tree, st->hold, &st->bit, nbits, s->next_out + k,
+                   want - k);
+  s->next_out += k;
+  s->avail_out -= k;
+  s->total_out += k;
+  st->symbols -= k;
+  if (k == 0 && want > 0 && st->length == 0) {
+    return false;
+  }
+
+  uint32_t used = st->bit / 8;
+  memmove(st->hold, st->hold + used, st->held - used);
+  st->held -= used;
+  st->bit -= 8 * (uint64_t)used;
+  return true;
+}
+
+/* Decodes input into output.  Data frames are decoded as their bytes
+   arrive, without waiting for the whole frame.  HSTREAM_FINISH tells the
+   decoder that no more input follows, so a stream that ends between two
+   frames without an end frame, like an archive of shards, is complete.
+   Returns HSTREAM_END once the stream is complete and HSTREAM_EFORMAT if
+   the input isn't a framed stream or ends in the middle of a frame, after
+   which the stream can only be ended, and HSTREAM_OK if the call ran out
+   of input or room for output. */
+int hstream_decode(HStream *s, int flush) {
+  HStreamState *st = s->state;
+  bool valid = true;
+  bool progress = true;
+
+  while (valid == true && progress == true) {
+    uint64_t in = s->avail_in;
+    uint64_t out = s->avail_out;
+    Phase phase = st->phase;
+
+    switch (st->phase) {
+    case HEADER:
+      if (fill_head(s, sizeof(Header)) == true) {
+        Header header;
+        memcpy(&header, st->head, sizeof(header));
+        valid = header.magic == MAGIC_FRAMED;
+        st->phase = FRAME;
+      }
+      break;
+    case FRAME:
+      if (fill_head(s, FRAME_HEADER) == true) {
+        valid = start_frame(st);
+      }
+      break;
+    case COUNT:
+      if (fill_head(s, 4) == true) {
+        st->symbols = get_le32(st->head);
+        st->length -= 4;
+        st->phase = DATA;
+      }
+      break;
+    case TABLE:
+      fill_hold(s);
+      if (st->length == 0) {
+        valid = valid_dump(st->hold, st->held);
+        if (valid == false) {
+          break;
+        }
+        if (st->tree != NULL) {
+          delete_tree(&st->tree);
+        }
+        st->tree = rebuild_tree(st->held, st->hold);
+        unpack_create(&st->unpack, st->tree);
+        st->held = 0;
+        st->phase = FRAME;
+      }
+      break;
+    case DATA:
+      fill_hold(s);
+      valid = decode_held(s);
+      if (st->symbols == 0) {
+        st->held = 0;
+        st->bit = 0;
+        st->phase = SKIP;
+      }
+      break;
+    case SKIP:
+      /* The padding of a data frame after its last code. */
+      st->held = 0;
+      fill_hold(s);
+      st->held = 0;
+      if (st->length == 0) {
+        st->phase = FRAME;
+      }
+      break;
+    case END:
+      return HSTREAM_END;
+    case BROKEN:
+      return HSTREAM_EFORMAT;
+    }
+
+    progress = s->avail_in != in || s->avail_out != out || st->phase != phase;
+  }
+
+  if (valid == true && flush == HSTREAM_FINISH && s->avail_in == 0) {
+    if (st->phase == FRAME && st->got == 0) {
+      st->phase = END;
+      return HSTREAM_END;
+    }
+    valid = s->avail_out == 0;
+  }
+  if (valid == false) {
+    st->phase = BROKEN;
+    return HSTREAM_EFORMAT;
+  }
+  return HSTREAM_OK;
+}
+
+/* Frees the state of a stream, which can be ended at any point. */
+void hstream_end(HStream *s) {
+  if (s->state == NULL) {
+    return;
+  }
+  if (s->state->coder.tree != NULL) {
+    delete_tree(&s->state->coder.tree);
+  }
+  if (s->state->tree != NULL) {
+    delete_tree(&s->state->tree);
+  }
+  free(s->state);
+  s->state = NULL;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HSTREAM_BLOCK (16 * 1024) // Most bytes coded in one data frame.
+
+#define HSTREAM_NONE   0 // More input follows.
+#define HSTREAM_FLUSH  1 // Codes all input given so far.
+#define HSTREAM_FINISH 2 // No more input follows.
+
+#define HSTREAM_OK      0  // Progress made, or more input or room needed.
+#define HSTREAM_END     1  // Stream ended and all output handed out.
+#define HSTREAM_EFORMAT -1 // Input isn't a framed stream.
+
+typedef struct HStreamState HStreamState;
+
+typedef struct {
+    const uint8_t *next_in; // Next input byte.
+    uint64_t avail_in;      // Bytes of input at next_in.
+    uint64_t total_in;      // Bytes of input consumed so far.
+    uint8_t *next_out;      // Where the next output byte goes.
+    uint64_t avail_out;     // Room for output at next_out.
+    uint64_t total_out;     // Bytes of output produced so far.
+    HStreamState *state;    // Private state of the coder.
+} HStream;
+
+bool hstream_encode_init(HStream *s);
+
+int hstream_encode(HStream *s, int flush);
+
+bool hstream_decode_init(HStream *s);
+
+int hstream_decode(HStream *s, int flush);
+
+void hstream_end(HStream *s);
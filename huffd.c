@@ -0,0 +1,517 @@
+#define _GNU_SOURCE
+#include "bitpack.h"
+#include "client.h"
+#include "code.h"
+#include "defines.h"
+#include "header.h"
+#include "hist.h"
+#include "huffman.h"
+#include "io.h"
+#include "node.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define OPTIONS "hs:w:b:v"
+
+#define HUFFD_WORKERS 4         // Default amount of worker processes.
+#define HUFFD_MAX     64        // Most worker processes.
+#define HUFFD_CACHE   16        // Code tables cached by each worker.
+#define HUFFD_BACKLOG 128       // Connections waiting to be accepted.
+#define HUFFD_BUFFER  (1 << 20) // Initial buffer for unmappable input.
+
+/* Every worker is a process of its own, so the single threaded coders
+   and their buffers can be used as they are.  Workers are forked once at
+   startup and all wait in accept() on the listening socket; each keeps
+   its buffers and caches for as long as it lives. */
+
+/* Codes built for a histogram, reused for inputs of the same shape. */
+typedef struct {
+  uint64_t key;                /* Shape of the histogram, 0 if unused. */
+  uint64_t used;               /* Last request the entry was used by. */
+  Code codes[ALPHABET];        /* Code of each symbol. */
+  PackTable pack;              /* Packing kernel table of the codes. */
+  uint16_t tree_size;          /* Size of the dumped tree. */
+  uint8_t dump[MAX_TREE_SIZE]; /* Dumped tree written with the codes. */
+} EncodeEntry;
+
+/* A tree read from a file, reused for files with the same tree. */
+typedef struct {
+  uint64_t key;                /* Hash of the dumped tree, 0 if unused. */
+  uint64_t used;               /* Last request the entry was used by. */
+  uint16_t tree_size;          /* Size of the dumped tree. */
+  uint8_t dump[MAX_TREE_SIZE]; /* The dumped tree. */
+  Node *root;                  /* The rebuilt tree. */
+  UnpackTable table;           /* Decoding kernel table of the tree. */
+} DecodeEntry;
+
+/* State of a worker, allocated once when it starts. */
+typedef struct {
+  uint8_t *buf;                     /* Input that can't be mapped. */
+  uint64_t capacity;                /* Size of buf. */
+  uint64_t requests;                /* Requests served so far. */
+  uint64_t hits;                    /* Requests served from the caches. */
+  EncodeEntry encode[HUFFD_CACHE];
+  DecodeEntry decode[HUFFD_CACHE];
+} Worker;
+
+static volatile sig_atomic_t stopping = 0;
+static bool verbose = false;
+
+/* Prints the help message to stderr. */
+static void usage(char *name) {
+  fprintf(stderr, "SYNOPSIS\n");
+  fprintf(stderr, "  A Huffman coding daemon.\n");
+  fprintf(stderr, "  Compresses and decompresses files passed to it over a "
+                  "Unix domain socket.\n\n");
+  fprintf(stderr, "USAGE\n");
+  fprintf(stderr, "  %s [-hv] [-s socket] [-w workers] [-b KiB]\n\n", name);
+  fprintf(stderr, "OPTIONS\n");
+  fprintf(stderr, "  -h             Program usage and help.\n");
+  fprintf(stderr, "  -v             Log every request to stderr.\n");
+  fprintf(stderr, "  -s socket      Path of the socket to listen on.\n");
+  fprintf(stderr, "  -w workers     Amount of worker processes.\n");
+  fprintf(stderr, "  -b KiB         Size of the I/O buffers.\n");
+}
+
+/* Asks the main process to stop. */
+static void stop(int signal) {
+  (void)signal;
+  stopping = 1;
+}
+
+/* Makes the n bytes of infile available in memory.  Regular files and
+   memory files are mapped, so their bytes are never copied; pipes and
+   sockets are read into the worker's buffer.  Returns NULL on errors and
+   sets *mapped if the input has to be unmapped. */
+static uint8_t *load_input(Worker *w, int infile, uint64_t *n,
+                           bool *mapped) {
+  struct stat st;
+  *mapped = false;
+  if (fstat(infile, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    uint8_t *map =
+        (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, infile, 0);
+    if (map != MAP_FAILED) {
+      *n = st.st_size;
+      *mapped = true;
+      return map;
+    }
+  }
+
+  *n = 0;
+  while (true) {
+    if (*n == w->capacity) {
+      uint8_t *grown = (uint8_t *)realloc(w->buf, 2 * w->capacity);
+      if (grown == NULL) {
+        return NULL;
+      }
+      w->buf = grown;
+      w->capacity *= 2;
+    }
+    uint64_t room = w->capacity - *n;
+    int nbytes = read_bytes(infile, w->buf + *n,
+                            room < IO_BLOCK_MAX ? room : IO_BLOCK_MAX);
+    if (nbytes <= 0) {
+      break;
+    }
+    *n += nbytes;
+  }
+  return w->buf;
+}
+
+/* Returns the shape of a histogram of n bytes: which symbols occur and
+   their share of the input, rounded down to a quarter power of two.
+   Inputs of the same shape get codes of nearly the same lengths. */
+static uint64_t shape(uint64_t hist[static ALPHABET], uint64_t n) {
+  uint64_t key = UINT64_C(14695981039346656037);
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    uint8_t bucket = 0;
+    if (hist[s] > 0) {
+      uint64_t share = ((hist[s] << 20) / n) | 4;
+      uint32_t log = 63 - __builtin_clzll(share);
+      bucket = 1 + (4 * log) + ((share >> (log - 2)) & 3);
+    }
+    key = (key ^ bucket) * UINT64_C(1099511628211);
+  }
+  return key | 1;
+}
+
+/* Returns true if e has a code for every symbol counted in hist. */
+static bool covers(EncodeEntry *e, uint64_t hist[static ALPHABET]) {
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    if (hist[s] > 0 && code_size(&e->codes[s]) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Returns the cached codes for inputs with the histogram hist of n bytes,
+   building and caching them in place of the least recently used entry if
+   there are none.  Trees are built like encode builds them. */
+static EncodeEntry *encode_entry(Worker *w, uint64_t hist[static ALPHABET],
+                                 uint64_t n) {
+  uint64_t key = shape(hist, n);
+  EncodeEntry *lru = &w->encode[0];
+  for (uint32_t i = 0; i < HUFFD_CACHE; i++) {
+    EncodeEntry *e = &w->encode[i];
+    if (e->key == key && covers(e, hist) == true) {
+      e->used = w->requests;
+      w->hits++;
+      return e;
+    }
+    if (e->used < lru->used) {
+      lru = e;
+    }
+  }
+
+  uint64_t counts[ALPHABET];
+  memcpy(counts, hist, sizeof(counts));
+  Node *root = build_byte_tree(counts, &lru->tree_size);
+  memset(lru->codes, 0, sizeof(lru->codes));
+  build_codes(root, lru->codes);
+  pack_create(&lru->pack, lru->codes);
+  flatten_tree(root, lru->dump);
+  delete_tree(&root);
+
+  lru->key = key;
+  lru->used = w->requests;
+  return lru;
+}
+
+/* Returns the cached tree for the dumped tree of nbytes bytes, rebuilding
+   and caching it in place of the least recently used entry if there is
+   none.  Returns NULL if the dump isn't valid. */
+static DecodeEntry *decode_entry(Worker *w, uint8_t *tree, uint16_t nbytes) {
+  uint64_t key = UINT64_C(14695981039346656037);
+  for (uint32_t i = 0; i < nbytes; i++) {
+    key = (key ^ tree[i]) * UINT64_C(1099511628211);
+  }
+  key |= 1;
+
+  DecodeEntry *lru = &w->decode[0];
+  for (uint32_t i = 0; i < HUFFD_CACHE; i++) {
+    DecodeEntry *e = &w->decode[i];
+    if (e->key == key && e->tree_size == nbytes &&
+        memcmp(e->dump, tree, nbytes) == 0) {
+      e->used = w->requests;
+      w->hits++;
+      return e;
+    }
+    if (e->used < lru->used) {
+      lru = e;
+    }
+  }
+
+  if (valid_dump(tree, nbytes) == false) {
+    return NULL;
+  }
+  if (lru->root != NULL) {
+    delete_tree(&lru->root);
+  }
+  lru->root = rebuild_tree(nbytes, tree);
+  unpack_create(&lru->table, lru->root);
+  memcpy(lru->dump, tree, nbytes);
+  lru->tree_size = nbytes;
+  lru->key = key;
+  lru->used = w->requests;
+  return lru;
+}
+
+/* Compresses infile to outfile in the format encode writes. */
+static int32_t encode_request(Worker *w, int infile, int outfile,
+                              HuffdReply *reply) {
+  uint64_t n = 0;
+  bool mapped = false;
+  uint8_t *data = load_input(w, infile, &n, &mapped);
+  if (data == NULL) {
+    return HUFFD_EIO;
+  }
+
+  uint64_t hist[ALPHABET] = {0};
+  for (uint64_t i = 0; i < n; i += IO_BLOCK_MAX) {
+    hist_count(hist, data + i, n - i < IO_BLOCK_MAX ? n - i : IO_BLOCK_MAX);
+  }
+  EncodeEntry *e = encode_entry(w, hist, n);
+
+  struct stat st;
+  fstat(infile, &st);
+  Header header = {.magic = MAGIC,
+                   .permissions = S_ISREG(st.st_mode) ? st.st_mode : 0600,
+                   .tree_size = e->tree_size,
+                   .file_size = n};
+  uint64_t bits = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    bits += hist[s] * code_size(&e->codes[s]);
+  }
+
+  bytes_written = 0;
+  write_symbols(outfile, (uint8_t *)&header, sizeof(header));
+  write_symbols(outfile, e->dump, e->tree_size);
+  for (uint64_t i = 0; i < n; i += io_block) {
+    write_codes(outfile, &e->pack, data + i,
+                n - i < io_block ? n - i : io_block);
+  }
+  flush_codes(outfile);
+
+  if (mapped == true) {
+    munmap(data, n);
+  }
+  reply->bytes_in = n;
+  reply->bytes_out = bytes_written;
+  if (bytes_written != sizeof(header) + e->tree_size + ((bits + 7) / 8)) {
+    return HUFFD_EIO;
+  }
+  return HUFFD_OK;
+}
+
+/* Decompresses infile, a file written by encode without -l, -w, -f or
+   -a, to outfile.  Sets the permissions of outfile from the header if
+   asked to. */
+static int32_t decode_request(Worker *w, int infile, int outfile,
+                              uint32_t flags, HuffdReply *reply) {
+  uint64_t n = 0;
+  bool mapped = false;
+  uint8_t *data = load_input(w, infile, &n, &mapped);
+  if (data == NULL) {
+    return HUFFD_EIO;
+  }
+
+  int32_t status = HUFFD_EFORMAT;
+  Header header;
+  DecodeEntry *e = NULL;
+  if (n >= sizeof(header)) {
+    memcpy(&header, data, sizeof(header));
+    if (header.magic == MAGIC && header.tree_size <= MAX_TREE_SIZE &&
+        sizeof(header) + header.tree_size <= n) {
+      e = decode_entry(w, data + sizeof(header), header.tree_size);
+    }
+  }
+
+  if (e != NULL) {
+    if ((flags & HUFFD_CHMOD) != 0) {
+      fchmod(outfile, header.permissions);
+    }
+
+    const uint8_t *in = data + sizeof(header) + header.tree_size;
+    uint64_t nbits = 8 * (n - sizeof(header) - header.tree_size);
+    uint64_t bit = 0;
+    uint64_t left = header.file_size;
+    uint8_t syms[BLOCK];
+
+    bytes_written = 0;
+    while (left > 0) {
+      uint32_t want = left < BLOCK ? left : BLOCK;
+      uint32_t k = unpack_symbols(&e->table, in, &bit, nbits, syms, want);
+      k += unpack_tail(e->root, in, &bit, nbits, syms + k, want - k);
+      if (k == 0) {
+        break;
+      }
+      write_symbols(outfile, syms, k);
+      left -= k;
+    }
+    flush_codes(outfile);
+
+    reply->bytes_out = bytes_written;
+    if (left > 0) {
+      status = HUFFD_EFORMAT;
+    } else if (bytes_written != header.file_size) {
+      status = HUFFD_EIO;
+    } else {
+      status = HUFFD_OK;
+    }
+  }
+
+  if (mapped == true) {
+    munmap(data, n);
+  }
+  reply->bytes_in = n;
+  return status;
+}
+
+/* Receives a request and the descriptors attached to it from conn.  The
+   descriptors that weren't attached are set to -1.  Returns false once
+   the client is gone. */
+static bool receive(int conn, HuffdRequest *req, int fds[static 2]) {
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = req, .iov_len = sizeof(*req)};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control.buf,
+                       .msg_controllen = sizeof(control.buf)};
+
+  fds[0] = -1;
+  fds[1] = -1;
+  if (recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) != sizeof(*req)) {
+    return false;
+  }
+
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL;
+       c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+      uint32_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(c), (count < 2 ? count : 2) * sizeof(int));
+    }
+  }
+  return true;
+}
+
+/* Serves the requests of one connection until the client closes it. */
+static void serve(Worker *w, int conn) {
+  HuffdRequest req;
+  int fds[2];
+
+  while (receive(conn, &req, fds) == true) {
+    HuffdReply reply = {.status = HUFFD_EINVAL};
+    w->requests++;
+    uint64_t hits = w->hits;
+
+    if (fds[0] >= 0 && fds[1] >= 0 && req.op == HUFFD_ENCODE) {
+      reply.status = encode_request(w, fds[0], fds[1], &reply);
+    } else if (fds[0] >= 0 && fds[1] >= 0 && req.op == HUFFD_DECODE) {
+      reply.status = decode_request(w, fds[0], fds[1], req.flags, &reply);
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+      if (fds[i] >= 0) {
+        close(fds[i]);
+      }
+    }
+
+    if (verbose == true) {
+      fprintf(stderr, "huffd[%d]: %c %lu -> %lu bytes%s: %s\n", getpid(),
+              req.op, reply.bytes_in, reply.bytes_out,
+              w->hits > hits ? " (cached)" : "", huffd_error(reply.status));
+    }
+    if (send(conn, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply)) {
+      break;
+    }
+  }
+}
+
+/* Forks a worker that accepts connections on sock until it is killed.
+   Returns its process id. */
+static pid_t spawn(int sock) {
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  Worker *w = (Worker *)calloc(1, sizeof(Worker));
+  w->capacity = HUFFD_BUFFER;
+  w->buf = (uint8_t *)malloc(w->capacity);
+
+  while (true) {
+    int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0) {
+      continue;
+    }
+    serve(w, conn);
+    close(conn);
+  }
+}
+
+int main(int argc, char **argv) {
+
+  int opt = 0;
+  char *path = HUFFD_SOCKET;
+  uint32_t workers = HUFFD_WORKERS;
+  uint64_t block_size = IO_BLOCK;
+
+  while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    switch (opt) {
+    case 'h': /* Help Message */
+      usage(argv[0]);
+      return 0;
+    case 's': /* Socket Path */
+      path = optarg;
+      break;
+    case 'w': /* Setting the amount of workers */
+      workers = strtoul(optarg, NULL, 10);
+      break;
+    case 'b': /* Setting the I/O buffer size */
+      block_size = strtoull(optarg, NULL, 10) << 10;
+      break;
+    case 'v': /* Enabling the request log */
+      verbose = true;
+      break;
+    default: /* Bad Option */
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (io_set_block(block_size) == false) {
+    fprintf(stderr, "Invalid I/O buffer size\n");
+    return 1;
+  }
+  if (workers < 1 || workers > HUFFD_MAX) {
+    fprintf(stderr, "Invalid amount of workers\n");
+    return 1;
+  }
+
+  /* Listens on the socket, which only the owner may connect to since
+     connecting lets a client have files read and written. */
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long\n");
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  unlink(path);
+  mode_t mask = umask(0077);
+  if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(sock, HUFFD_BACKLOG) != 0) {
+    fprintf(stderr, "Unable to listen on %s\n", path);
+    return 1;
+  }
+  umask(mask);
+
+  signal(SIGPIPE, SIG_IGN);
+  struct sigaction sa = {.sa_handler = stop};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+
+  pid_t pids[HUFFD_MAX];
+  for (uint32_t i = 0; i < workers; i++) {
+    pids[i] = spawn(sock);
+  }
+
+  /* Replaces workers that died until asked to stop. */
+  while (stopping == 0) {
+    int status = 0;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0 || stopping != 0) {
+      continue;
+    }
+    for (uint32_t i = 0; i < workers; i++) {
+      if (pids[i] == pid) {
+        fprintf(stderr, "huffd: worker %d exited, restarting it\n", pid);
+        pids[i] = spawn(sock);
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < workers; i++) {
+    kill(pids[i], SIGTERM);
+  }
+  while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) {
+  }
+  unlink(path);
+  close(sock);
+  return 0;
+}
@@ -5,6 +5,7 @@
 #include "node.h"
 #include "pq.h"
 #include "stack.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -46,11 +47,17 @@ static Node *construct(PriorityQueue *q) {
    function construct() to create a huffman tree.  Returns the resulting
    root node from construct(). */
 Node *build_tree(uint64_t hist[static ALPHABET]) {
-  PriorityQueue *q = pq_create(ALPHABET);
+  return build_tree_n(hist, ALPHABET);
+}
+
+/* Same as build_tree() but for a histogram of nsymbols symbols, which is
+   used by the extended alphabets that code more than just bytes. */
+Node *build_tree_n(uint64_t *hist, uint32_t nsymbols) {
+  PriorityQueue *q = pq_create(nsymbols);
 
   /* Creates frequency nodes from the histogram and enqueues them
   to the priority queue. */
-  for (uint64_t i = 0; i < 256; i++) {
+  for (uint32_t i = 0; i < nsymbols; i++) {
     if (hist[i] > 0) {
 
       Node *n = node_create(i, hist[i]);
@@ -63,6 +70,49 @@ Node *build_tree(uint64_t hist[static ALPHABET]) {
   return n;
 }
 
+/* Builds the tree the default mode codes bytes with from hist and sets
+   tree_size to the bytes of its dump.  Inputs of at most two different
+   symbols get phantom symbols until there are two, which are joined into
+   a tree of 1-bit codes, and bigger ones get phantom 0 and 1 bytes, which
+   are in the tree but never coded.  The phantom symbols are added to
+   hist. */
+Node *build_byte_tree(uint64_t hist[static ALPHABET], uint16_t *tree_size) {
+  uint32_t symbols = 0;
+  for (uint32_t i = 0; i < ALPHABET; i++) {
+    if (hist[i] != 0) {
+      symbols++;
+    }
+  }
+
+  if (symbols <= 2) {
+    for (uint32_t i = 0; symbols < 2; i++) {
+      if (hist[i] == 0) {
+        hist[i] = 1;
+        symbols++;
+      }
+    }
+
+    uint32_t zero = 0;
+    while (hist[zero] == 0) {
+      zero++;
+    }
+    uint32_t one = zero + 1;
+    while (hist[one] == 0) {
+      one++;
+    }
+    *tree_size = (3 * 2) - 1;
+    return node_join(node_create(zero, hist[zero]),
+                     node_create(one, hist[one]));
+  }
+
+  symbols += hist[0] == 0 ? 1 : 0;
+  symbols += hist[1] == 0 ? 1 : 0;
+  hist[0] = hist[0] == 0 ? 1 : hist[0];
+  hist[1] = hist[1] == 0 ? 1 : hist[1];
+  *tree_size = (3 * symbols) - 1;
+  return build_tree(hist);
+}
+
 static Code c0;
 static Code *c;
 
@@ -93,27 +143,29 @@ static void build_codes2(Node *root, Code table[static ALPHABET]) {
 }
 
 /* The original function that first initailizes the static Code object
-   and uses build_codes2() to actually build the codes from table. */
+   and uses build_codes2() to actually build the codes from table.  For
+   an extended alphabet table must hold an entry for every symbol. */
 void build_codes(Node *root, Code table[static ALPHABET]) {
   set_int();
   build_codes2(root, table);
 }
 
 /* Conducts a post-order traversal of the Huffman Tree given by root and
-   writing its contents to outfile. */
-void dump_tree(int outfile, Node *root) {
+   writing its contents to outfile.  Leaf symbols are written as width
+   bytes in little-endian order. */
+static void dump(int outfile, Node *root, uint32_t width) {
   if (root != NULL) {
-    dump_tree(outfile, root->left);
-    dump_tree(outfile, root->right);
+    dump(outfile, root->left, width);
+    dump(outfile, root->right, width);
 
-    uint8_t buffer[1];
+    uint8_t buffer[3];
 
     if (root->left == NULL && root->right == NULL) {
       /* If root is a leaf node, write L and the root's symbol to outfile */
       buffer[0] = 'L';
-      bytes_written += write_bytes(outfile, buffer, 1);
-      buffer[0] = (uint8_t)root->symbol;
-      bytes_written += write_bytes(outfile, buffer, 1);
+      buffer[1] = root->symbol & 0xFF;
+      buffer[2] = root->symbol >> 8;
+      bytes_written += write_bytes(outfile, buffer, 1 + width);
     } else {
       /* If root is an interior node, write L to outfile */
       buffer[0] = 'I';
@@ -122,9 +174,38 @@ void dump_tree(int outfile, Node *root) {
   }
 }
 
+/* Dumps a tree of byte symbols, taking 3 * leaves - 1 bytes. */
+void dump_tree(int outfile, Node *root) { dump(outfile, root, 1); }
+
+/* Post-order traversal like dump() that stores the dump of a tree of
+   byte symbols in buf starting at index.  Returns the index after it. */
+static uint16_t flatten(Node *root, uint8_t *buf, uint16_t index) {
+  if (root != NULL) {
+    index = flatten(root->left, buf, index);
+    index = flatten(root->right, buf, index);
+
+    if (root->left == NULL && root->right == NULL) {
+      buf[index++] = 'L';
+      buf[index++] = root->symbol & 0xFF;
+    } else {
+      buf[index++] = 'I';
+    }
+  }
+  return index;
+}
+
+/* Stores the dump_tree() dump of a tree in buf instead of writing it.
+   Returns its size. */
+uint16_t flatten_tree(Node *root, uint8_t buf[static MAX_TREE_SIZE]) {
+  return flatten(root, buf, 0);
+}
+
+/* Dumps a tree of 16-bit symbols, taking 4 * leaves - 1 bytes. */
+void dump_tree_wide(int outfile, Node *root) { dump(outfile, root, 2); }
+
 /* Performs a post-order traversal to build a Huffman tree from the
    array tree.  Returns the root node of the tree. */
-Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]) {
+static Node *rebuild(uint16_t nbytes, uint8_t *tree, uint32_t width) {
   Node *root = NULL;
   Stack *sk = stack_create(nbytes);
   uint16_t index = 0;
@@ -134,9 +215,13 @@ Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]) {
       /* If the next character from tree is L, go to the next chracter
          after L to get the leaf's symbol and push it into the stack.*/
       index++;
-      Node *n = node_create(tree[index], 0);
+      uint16_t symbol = tree[index];
+      if (width == 2) {
+        symbol |= (uint16_t)tree[index + 1] << 8;
+      }
+      Node *n = node_create(symbol, 0);
       stack_push(sk, n);
-      index++;
+      index += width;
     } else /* If the next character is I for interior */
     {
       Node *right = NULL;
@@ -156,6 +241,52 @@ Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]) {
   return root;
 }
 
+/* Returns true if tree is a dump of a whole tree of at least two leaves,
+   whose symbols are width bytes long and less than nsymbols. */
+static bool valid(uint8_t *tree, uint16_t nbytes, uint32_t width,
+                  uint32_t nsymbols) {
+  uint32_t depth = 0;
+  for (uint32_t i = 0; i < nbytes; i++) {
+    if (tree[i] == 'L' && i + width < nbytes) {
+      uint32_t symbol = tree[i + 1];
+      if (width == 2) {
+        symbol |= (uint32_t)tree[i + 2] << 8;
+      }
+      if (symbol >= nsymbols) {
+        return false;
+      }
+      depth++;
+      i += width;
+    } else if (tree[i] == 'I' && depth >= 2) {
+      depth--;
+    } else {
+      return false;
+    }
+  }
+  return depth == 1 && nbytes > 1 + width;
+}
+
+/* Returns true if tree is a valid dump of a tree of byte symbols. */
+bool valid_dump(uint8_t *tree, uint16_t nbytes) {
+  return valid(tree, nbytes, 1, ALPHABET);
+}
+
+/* Returns true if tree is a valid dump_tree_wide() dump of a tree of
+   symbols less than nsymbols. */
+bool valid_dump_wide(uint8_t *tree, uint16_t nbytes, uint32_t nsymbols) {
+  return valid(tree, nbytes, 2, nsymbols);
+}
+
+/* Rebuilds a tree dumped with dump_tree(). */
+Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]) {
+  return rebuild(nbytes, tree, 1);
+}
+
+/* Rebuilds a tree dumped with dump_tree_wide(). */
+Node *rebuild_tree_wide(uint16_t nbytes, uint8_t tree[static nbytes]) {
+  return rebuild(nbytes, tree, 2);
+}
+
 /* Performs a post-order traversal to delete the nodes from the tree. */
 void delete_tree(Node **root) {
   if ((*root)->left == NULL && (*root)->right == NULL) {
@@ -3,14 +3,29 @@
 #include "node.h"
 #include "code.h"
 #include "defines.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 Node *build_tree(uint64_t hist[static ALPHABET]);
 
+Node *build_tree_n(uint64_t *hist, uint32_t nsymbols);
+
+Node *build_byte_tree(uint64_t hist[static ALPHABET], uint16_t *tree_size);
+
 void build_codes(Node *root, Code table[static ALPHABET]);
 
 void dump_tree(int outfile, Node *root);
 
+void dump_tree_wide(int outfile, Node *root);
+
+uint16_t flatten_tree(Node *root, uint8_t buf[static MAX_TREE_SIZE]);
+
+bool valid_dump(uint8_t *tree, uint16_t nbytes);
+
+bool valid_dump_wide(uint8_t *tree, uint16_t nbytes, uint32_t nsymbols);
+
 Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]);
 
+Node *rebuild_tree_wide(uint16_t nbytes, uint8_t tree[static nbytes]);
+
 void delete_tree(Node **root);
@@ -1,17 +1,25 @@
+#define _GNU_SOURCE
 #include "io.h"
+#include "zerocopy.h"
+#include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 uint64_t bytes_read = 0;
 uint64_t bytes_written = 0;
-static char buffer[BLOCK];
-static int index = -1;
+uint32_t io_block = IO_BLOCK;
+static _Alignas(IO_ALIGN) uint8_t in_default[IO_BLOCK];
+static _Alignas(IO_ALIGN) uint8_t out_default[IO_BLOCK];
+static uint8_t *buffer = in_default; /* Input block read_bit() reads from. */
+static int read_index = -1;
 static uint64_t max_bytes_per_read = 0;
-static int left_over_bits = 0;
 
 /* Basically reads nbytes from infile and setting the read characters into
    the buffer pointer buf.  But, there are cases where the read() function
@@ -21,7 +29,7 @@ int read_bytes(int infile, uint8_t *buf, int nbytes) {
   int total_bytes = 0;
 
   ret = read(infile, buf, nbytes); /* Attempt to read nbytes from infile */
-  while (ret != 0) {
+  while (ret > 0) {
     total_bytes += ret;
 
     /* This is for cases where less than nbytes were read. */
@@ -38,17 +46,16 @@ int read_bytes(int infile, uint8_t *buf, int nbytes) {
 /* Write nbytes characters from the buffer to outfile. */
 int write_bytes(int outfile, uint8_t *buf, int nbytes) {
   int ret = write(outfile, buf, nbytes);
-  int total_bytes = ret;
+  int total_bytes = ret > 0 ? ret : 0;
 
   /* Loop call to make sure that all nbytes were written from the
-     buffer to the outfile. */
-  while (total_bytes < nbytes) {
-    if ((nbytes - total_bytes) < nbytes) {
-      ret = write(outfile, buf + total_bytes, (nbytes - total_bytes));
-    } else {
-      ret = write(outfile, buf + total_bytes, nbytes);
+     buffer to the outfile.  Gives up once outfile takes no more, like a
+     pipe whose reader is gone, and returns how much was written. */
+  while (ret > 0 && total_bytes < nbytes) {
+    ret = write(outfile, buf + total_bytes, (nbytes - total_bytes));
+    if (ret > 0) {
+      total_bytes += ret;
     }
-    total_bytes += ret;
   }
   return total_bytes;
 }
@@ -58,78 +65,315 @@ int write_bytes(int outfile, uint8_t *buf, int nbytes) {
    integer pointer bit.  Returns false if there are no more bits to be read
    from the static buffer. */
 bool read_bit(int infile, uint8_t *bit) {
-  /* Reads BLOCK bytes from buffer at a time until buffer is all read. */
-  if (index == -1) {
-    max_bytes_per_read = read_bytes(infile, (uint8_t *)buffer, BLOCK);
+  /* Reads io_block bytes from buffer at a time until buffer is all read. */
+  if (read_index == -1) {
+    max_bytes_per_read = read_bytes(infile, buffer, io_block);
     bytes_read += max_bytes_per_read;
-    index = (8 * max_bytes_per_read) - 1;
+    read_index = (8 * max_bytes_per_read) - 1;
     max_bytes_per_read--;
   }
 
-  if (index <= -1) /* Returns false if buffer can't be read anymore. */
+  if (read_index <= -1) /* Returns false if buffer can't be read anymore. */
   {
     return false;
   } else /* Reads a bit from the static buffer */
   {
-    if ((buffer[max_bytes_per_read - (index / 8)] & (1 << (7 - (index % 8)))) >
-        0) {
+    if ((buffer[max_bytes_per_read - (read_index / 8)] &
+         (1 << (7 - (read_index % 8)))) > 0) {
       *bit = 1;
     } else {
       *bit = 0;
     }
-    index--;
+    read_index--;
+    return true;
+  }
+}
+
+/* Reads nbits bits with read_bit() into value, LSB first.  Returns false
+   if the input ran out. */
+bool read_bits(int infile, uint64_t *value, uint32_t nbits) {
+  uint8_t bit = 0;
+  *value = 0;
+  for (uint32_t i = 0; i < nbits; i++) {
+    if (read_bit(infile, &bit) == false) {
+      return false;
+    }
+    *value |= (uint64_t)bit << i;
+  }
+  return true;
+}
+
+static uint8_t *out = out_default; /* Output block being filled. */
+static uint64_t out_bits = 0;       /* Bits stored in the output block. */
+
+/* Allocates size bytes aligned for direct I/O.  Returns NULL on failure. */
+uint8_t *io_alloc(uint64_t size) {
+  void *p = NULL;
+  if (posix_memalign(&p, IO_ALIGN, size) != 0) {
+    return NULL;
+  }
+  return (uint8_t *)p;
+}
+
+/* Sets the size of the input and output blocks to size bytes, rounded up
+   to a multiple of IO_ALIGN, and allocates them in place of the default
+   IO_BLOCK byte blocks.  Must be called before any bits or symbols are
+   read or written and before enable_zero_copy().  Returns false if size is out
+   of range or the blocks can't be allocated. */
+bool io_set_block(uint64_t size) {
+  if (size == 0 || size > IO_BLOCK_MAX) {
+    return false;
+  }
+  size = (size + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+
+  uint8_t *in_block = io_alloc(size);
+  uint8_t *out_block = io_alloc(size);
+  if (in_block == NULL || out_block == NULL) {
+    free(in_block);
+    free(out_block);
+    return false;
+  }
+
+  if (buffer != in_default) {
+    free(buffer);
+    free(out);
+  }
+  buffer = in_block;
+  out = out_block;
+  io_block = size;
+  return true;
+}
+
+/* Tells the kernel that infile is going to be read once from start to
+   end, so it reads ahead aggressively and drops the pages again instead
+   of evicting other cached data, and starts reading the first blocks
+   right away.  With direct set, infile is switched to O_DIRECT so reads
+   bypass the page cache altogether; this needs every read to go to an
+   io_alloc() buffer in multiples of IO_ALIGN bytes.  Returns false if
+   O_DIRECT was asked for but isn't supported by the file system. */
+bool io_advise(int infile, bool direct) {
+  posix_fadvise(infile, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(infile, 0, 0, POSIX_FADV_NOREUSE);
+  readahead(infile, 0, 4 * (size_t)io_block);
+
+  if (direct == true) {
+    int flags = fcntl(infile, F_GETFL);
+    return flags >= 0 && fcntl(infile, F_SETFL, flags | O_DIRECT) == 0;
+  }
+  return true;
+}
+
+/* Reserves size bytes of disk space for outfile and maps them, so the
+   decoders can store symbols straight into the file instead of writing
+   them.  *map is NULL if outfile is anything but an empty regular file
+   open for reading and writing, like a pipe or stdout, which is written
+   to as usual instead.  Returns false if the file system doesn't have
+   room for size bytes. */
+bool io_map_output(int outfile, uint64_t size, uint8_t **map) {
+  *map = NULL;
+  struct stat st;
+  int flags = fcntl(outfile, F_GETFL);
+  if (size == 0 || fstat(outfile, &st) != 0 || S_ISREG(st.st_mode) == 0 ||
+      st.st_size != 0 || flags < 0 || (flags & O_ACCMODE) != O_RDWR ||
+      (flags & O_APPEND) != 0) {
+    return true;
+  }
+
+  /* On file systems without fallocate() the space is reserved by writing
+     to every block, since stores into a hole of a full disk would raise
+     SIGBUS instead of failing.  If it can't be reserved either way, the
+     output is written as usual. */
+  int error = posix_fallocate(outfile, 0, size);
+  if (error == ENOSPC || error == EDQUOT || error == EFBIG) {
+    ftruncate(outfile, 0);
+    return false;
+  }
+  if (error != 0) {
+    ftruncate(outfile, 0);
+    return true;
+  }
+
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, outfile, 0);
+  if (p == MAP_FAILED) {
+    ftruncate(outfile, 0);
+    return true;
+  }
+  madvise(p, size, MADV_SEQUENTIAL);
+  *map = (uint8_t *)p;
+  return true;
+}
+
+/* Unmaps an output mapped by io_map_output().  The decoders count the
+   symbols they store in bytes_written, and if the input ran out before
+   all size of them were decoded, the file is cut back to those. */
+void io_unmap_output(int outfile, uint8_t *map, uint64_t size) {
+  munmap(map, size);
+  if (bytes_written < size) {
+    ftruncate(outfile, bytes_written);
+  }
+  lseek(outfile, bytes_written, SEEK_SET);
+}
+
+/* Hands the first nbytes of the output block to outfile and starts a new
+   block.  With zero-copy output the block is spliced into the pipe and
+   the next block is a different buffer. */
+static void emit_block(int outfile, uint32_t nbytes) {
+  if (zc_enabled() == true) {
+    out = zc_submit(outfile, out, nbytes);
+    bytes_written += nbytes;
+  } else {
+    bytes_written += write_bytes(outfile, out, nbytes);
+  }
+  out_bits = 0;
+}
+
+/* Switches the output to zero-copy mode if outfile is a pipe.  Returns
+   true if it was switched.  Must be called before anything is buffered. */
+bool enable_zero_copy(int outfile) {
+  if (out_bits == 0 && zc_open(outfile) == true) {
+    out = zc_buffer();
     return true;
   }
+  return false;
 }
 
-static int count = 0;
-static int count1 = 0;
-static uint64_t bit2 = 0;
+/* Appends one bit to the output block.  Bits are written from LSB to MSB
+   in the block's current byte.  If the block is full, it's written to
+   outfile so that a new block can be used. */
+static inline void put_bit(int outfile, bool bit) {
+  /* This is to make sure that each byte in the output block gets
+     reset to 0 before bits are added into it. */
+  if (out_bits % 8 == 0) {
+    out[out_bits / 8] = 0;
+  }
 
-/* Writes all bits from the Code object to the buffer.  If the buffer is
-   full, the buffer's characters will be written to outfile so that the
-   buffer is usable again. */
+  if (bit == true) {
+    out[out_bits / 8] |= (uint8_t)1 << (out_bits % 8);
+  }
+  out_bits++;
+
+  if (out_bits == 8 * (uint64_t)io_block) {
+    emit_block(outfile, io_block);
+  }
+}
+
+/* Writes all bits from the Code object to the output block. */
 void write_code(int outfile, Code *c) {
   for (uint32_t bit = 0; bit < code_size(c); bit++) {
+    put_bit(outfile, code_get_bit(c, bit));
+  }
+}
+
+/* Writes the nbits low bits of value to the output block, LSB first.
+   Used for raw fields that follow a code, like run lengths, and for codes
+   that are kept as plain integers.  Fills up to a byte per iteration. */
+void write_bits(int outfile, uint64_t value, uint32_t nbits) {
+  while (nbits > 0) {
+    uint32_t used = out_bits % 8;
+    uint32_t take = 8 - used < nbits ? 8 - used : nbits;
+
+    if (used == 0) {
+      out[out_bits / 8] = 0;
+    }
+    out[out_bits / 8] |= (uint8_t)((value & ((1u << take) - 1)) << used);
+    value >>= take;
+    nbits -= take;
+    out_bits += take;
 
-    count++;
-    if (bit2 % 8 == 0) {
-      /* This is to make sure that each byte in the static buffer gets
-         reset to 0 before bits are added into it from the Code object. */
-      buffer[(bit2 / 8) % BLOCK] = 0;
+    if (out_bits == 8 * (uint64_t)io_block) {
+      emit_block(outfile, io_block);
     }
+  }
+}
 
-    if (count1 % 8 == 0) {
-      /* Keeps track of the bit position in the buffer. */
-      count1 = 0;
+/* Writes the codes of n symbols to the output block.  The packing kernels
+   code as many symbols as fit into the current block, and the symbol that
+   straddles the end of the block goes through write_code(). */
+void write_codes(int outfile, PackTable *t, uint8_t *syms, uint32_t n) {
+  uint32_t i = 0;
+  while (i < n) {
+    i += pack_symbols(t, syms + i, n - i, out, &out_bits,
+                      8 * (uint64_t)io_block);
+    if (i < n) {
+      write_code(outfile, &t->codes[syms[i]]);
+      i++;
     }
+  }
+}
+
+/* Writes the 1-bit codes of n symbols of a tree with just two leaves, one
+   being the symbol coded as 1.  Whole bytes of codes are packed 8 symbols
+   at a time and the rest go through put_bit(). */
+void write_bitmap(int outfile, uint8_t one, uint8_t *syms, uint32_t n) {
+  uint32_t i = 0;
+  while (i < n) {
+    if (out_bits % 8 == 0 && n - i >= 8) {
+      uint32_t room = io_block - (out_bits / 8);
+      uint32_t chunk = (n - i) / 8 < room ? (n - i) / 8 : room;
 
-    /* Bits from the Code object are written from LSB to MSB in the
-       buffer's current byte. */
-    if (code_get_bit(c, bit) == true) {
-      buffer[(bit2 / 8) % BLOCK] |= (uint8_t)1 << count1;
+      pack_bitmap(one, syms + i, 8 * chunk, out + (out_bits / 8));
+      out_bits += 8 * (uint64_t)chunk;
+      i += 8 * chunk;
+
+      if (out_bits == 8 * (uint64_t)io_block) {
+        emit_block(outfile, io_block);
+      }
     } else {
-      buffer[(bit2 / 8) % BLOCK] |= (uint8_t)0 << count1;
+      put_bit(outfile, syms[i] == one);
+      i++;
     }
+  }
+}
+
+/* Writes a whole byte to the output block.  Decoded symbols use this so
+   they reach outfile in full blocks instead of one write() each. */
+void write_symbol(int outfile, uint8_t symbol) {
+  out[out_bits / 8] = symbol;
+  out_bits += 8;
+
+  if (out_bits == 8 * (uint64_t)io_block) {
+    emit_block(outfile, io_block);
+  }
+}
+
+/* Writes n whole bytes to the output block.  Like write_symbol() this
+   assumes the block only holds whole bytes. */
+void write_symbols(int outfile, uint8_t *syms, uint32_t n) {
+  while (n > 0) {
+    uint32_t room = io_block - (out_bits / 8);
+    uint32_t chunk = n < room ? n : room;
+
+    memcpy(out + (out_bits / 8), syms, chunk);
+    out_bits += 8 * (uint64_t)chunk;
+    syms += chunk;
+    n -= chunk;
+
+    if (out_bits == 8 * (uint64_t)io_block) {
+      emit_block(outfile, io_block);
+    }
+  }
+}
+
+/* Writes count copies of symbol to the output block, a block at a time. */
+void write_repeat(int outfile, uint8_t symbol, uint64_t count) {
+  while (count > 0) {
+    uint32_t room = io_block - (out_bits / 8);
+    uint32_t chunk = count < room ? count : room;
 
-    count1++;
+    memset(out + (out_bits / 8), symbol, chunk);
+    out_bits += 8 * (uint64_t)chunk;
+    count -= chunk;
 
-    /* Writes the contents of the buffer to outfile if the buffer
-       is full. */
-    if ((count / 8) >= BLOCK) {
-      bytes_written += write_bytes(outfile, (uint8_t *)buffer, BLOCK);
-      count = 0;
+    if (out_bits == 8 * (uint64_t)io_block) {
+      emit_block(outfile, io_block);
     }
-    bit2++;
   }
-  left_over_bits = count;
 }
 
-/* If there are still remaining bits in the buffer, simply write them
-   to outfile. */
+/* If there are still remaining bits or symbols in the output block,
+   simply write them to outfile. */
 void flush_codes(int outfile) {
-  if (left_over_bits > 0) {
-    bytes_written +=
-        write_bytes(outfile, (uint8_t *)buffer, 1 + ((left_over_bits - 1) / 8));
+  if (out_bits > 0) {
+    emit_block(outfile, (out_bits + 7) / 8);
   }
 }
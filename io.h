@@ -1,11 +1,23 @@
 #pragma once
 
+#include "bitpack.h"
 #include "code.h"
 #include <stdbool.h>
 #include <stdint.h>
 
 extern uint64_t bytes_read;
 extern uint64_t bytes_written;
+extern uint32_t io_block;
+
+uint8_t *io_alloc(uint64_t size);
+
+bool io_set_block(uint64_t size);
+
+bool io_advise(int infile, bool direct);
+
+bool io_map_output(int outfile, uint64_t size, uint8_t **map);
+
+void io_unmap_output(int outfile, uint8_t *map, uint64_t size);
 
 int read_bytes(int infile, uint8_t *buf, int nbytes);
 
@@ -13,6 +25,22 @@ int write_bytes(int outfile, uint8_t *buf, int nbytes);
 
 bool read_bit(int infile, uint8_t *bit);
 
+bool read_bits(int infile, uint64_t *value, uint32_t nbits);
+
+bool enable_zero_copy(int outfile);
+
 void write_code(int outfile, Code *c);
 
+void write_bits(int outfile, uint64_t value, uint32_t nbits);
+
+void write_codes(int outfile, PackTable *t, uint8_t *syms, uint32_t n);
+
+void write_bitmap(int outfile, uint8_t one, uint8_t *syms, uint32_t n);
+
+void write_symbol(int outfile, uint8_t symbol);
+
+void write_symbols(int outfile, uint8_t *syms, uint32_t n);
+
+void write_repeat(int outfile, uint8_t symbol, uint64_t count);
+
 void flush_codes(int outfile);
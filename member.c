@@ -0,0 +1,89 @@
+#include "member.h"
+#include "header.h"
+#include "huffman.h"
+#include "io.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A file that can be appended to is a sequence of members, each a header
+   with the MAGIC_MEMBER magic, a tree, the codes of its symbols and a
+   trailer.  A member with a tree size of 0 has no tree of its own and is
+   coded with the tree of the member before it.  The trailer at the end of
+   the file locates the last member and the member holding its tree, so an
+   append only reads those instead of the whole file. */
+
+/* Finds the tree the next member appended to outfile would reuse, and
+   the offset of the member holding it in *tree_start.  *tree is NULL if
+   outfile is empty.  A plain file of one member is turned into a member
+   by replacing its magic.  Returns false if outfile isn't a plain or
+   appendable file. */
+bool member_open(int outfile, Node **tree, uint64_t *tree_start) {
+  *tree = NULL;
+  *tree_start = 0;
+
+  struct stat st;
+  if (fstat(outfile, &st) != 0) {
+    return false;
+  }
+  uint64_t size = st.st_size;
+  if (size == 0) {
+    return true;
+  }
+
+  Trailer trailer = {0};
+  uint64_t start = 0;
+  if (size >= sizeof(Header) + sizeof(Trailer) &&
+      pread(outfile, &trailer, sizeof(trailer), size - sizeof(trailer)) ==
+          sizeof(trailer) &&
+      trailer.magic == MAGIC_TRAILER && trailer.member_size <= size &&
+      trailer.tree_back <= size - trailer.member_size) {
+    start = size - trailer.member_size - trailer.tree_back;
+  }
+
+  Header header = {0};
+  if (pread(outfile, &header, sizeof(header), start) != sizeof(header) ||
+      (header.magic != MAGIC && header.magic != MAGIC_MEMBER) ||
+      header.tree_size == 0 || header.tree_size > MAX_TREE_SIZE) {
+    return false;
+  }
+
+  uint8_t dump[MAX_TREE_SIZE];
+  if (pread(outfile, dump, header.tree_size, start + sizeof(header)) !=
+          header.tree_size ||
+      valid_dump(dump, header.tree_size) == false) {
+    return false;
+  }
+  if (header.magic == MAGIC) {
+    header.magic = MAGIC_MEMBER;
+    pwrite(outfile, &header.magic, sizeof(header.magic), start);
+  }
+
+  *tree = rebuild_tree(header.tree_size, dump);
+  *tree_start = start;
+  return true;
+}
+
+/* Returns the amount of bits the symbols counted in hist code to with
+   the codes of table, or UINT64_MAX if one of them has no code. */
+uint64_t member_bits(Code table[static ALPHABET],
+                     uint64_t hist[static ALPHABET]) {
+  uint64_t bits = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    if (hist[s] > 0 && code_size(&table[s]) == 0) {
+      return UINT64_MAX;
+    }
+    bits += hist[s] * code_size(&table[s]);
+  }
+  return bits;
+}
+
+/* Ends the member written to outfile from offset start on with its
+   trailer.  tree_start is the offset of the member holding its tree. */
+void member_close(int outfile, uint64_t start, uint64_t tree_start) {
+  uint64_t end = lseek(outfile, 0, SEEK_END);
+  Trailer trailer = {.magic = MAGIC_TRAILER,
+                     .reserved = 0,
+                     .member_size = end - start + sizeof(Trailer),
+                     .tree_back = start - tree_start};
+  bytes_written += write_bytes(outfile, (uint8_t *)&trailer, sizeof(trailer));
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include "node.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+bool member_open(int outfile, Node **tree, uint64_t *tree_start);
+
+uint64_t member_bits(Code table[static ALPHABET],
+                     uint64_t hist[static ALPHABET]);
+
+void member_close(int outfile, uint64_t start, uint64_t tree_start);
@@ -0,0 +1,112 @@
+#include "defines.h"
+#include "frame.h"
+#include "header.h"
+#include "hist.h"
+#include "huffman.h"
+#include "io.h"
+#include "node.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OPTIONS "ho:v"
+
+/* Prints the help message to stderr. */
+static void usage(char *name) {
+  fprintf(stderr, "SYNOPSIS\n");
+  fprintf(stderr, "  A histogram merger.\n");
+  fprintf(stderr, "  Adds up the histograms of shards and writes the head of "
+                  "an archive of them.\n\n");
+  fprintf(stderr, "USAGE\n");
+  fprintf(stderr, "  %s [-hv] [-o outfile] histogram...\n\n", name);
+  fprintf(stderr, "OPTIONS\n");
+  fprintf(stderr, "  -h             Program usage and help.\n");
+  fprintf(stderr, "  -v             Print the merged counts.\n");
+  fprintf(stderr, "  -o outfile     Output of the archive head.\n");
+}
+
+int main(int argc, char **argv) {
+  int opt = 0;
+  bool output_file_exists = false;
+  bool print_stats = false;
+  char *output_file = NULL;
+
+  while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    switch (opt) {
+    case 'h': /* Help Message */
+      usage(argv[0]);
+      return 0;
+    case 'o': /* Output FIle */
+      output_file_exists = true;
+      output_file = optarg;
+      break;
+    case 'v': /* Enabling Stats */
+      print_stats = true;
+      break;
+    default: /* Bad Option */
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind == argc) {
+    fprintf(stderr, "Missing histograms\n");
+    usage(argv[0]);
+    return 1;
+  }
+
+  /* Adds up the histograms written by histogram for every shard. */
+  uint64_t histogram[ALPHABET] = {0};
+  for (int i = optind; i < argc; i++) {
+    int input = open(argv[i], O_RDONLY);
+    bool valid = input >= 0 && hist_load(input, histogram) == true;
+    if (input >= 0) {
+      close(input);
+    }
+    if (valid == false) {
+      fprintf(stderr, "Invalid histogram %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  uint64_t total = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    total += histogram[s];
+  }
+  uint32_t symbols = hist_symbols(histogram);
+
+  /* Adds phantom symbols until there are two, and builds the tree. */
+  for (uint32_t s = 0; hist_symbols(histogram) < 2; s++) {
+    if (histogram[s] == 0) {
+      histogram[s] = 1;
+    }
+  }
+  Node *tree = build_tree(histogram);
+
+  /* The head of the archive is the header of a framed stream and a table
+     frame of the merged tree.  Shards coded with encode -T and this head
+     follow it in any order, and the decoder reads the result like any
+     framed stream. */
+  int output = 1;
+  if (output_file_exists == true) {
+    output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+  }
+  Header header = {.magic = MAGIC_FRAMED,
+                   .permissions = S_IFREG | 0600,
+                   .tree_size = 0,
+                   .file_size = 0};
+  bytes_written += write_bytes(output, (uint8_t *)&header, sizeof(header));
+  frame_write_table(output, tree);
+
+  if (print_stats == true) {
+    fprintf(stderr, "Histograms merged: %d\n", argc - optind);
+    fprintf(stderr, "Bytes counted: %lu\n", total);
+    fprintf(stderr, "Distinct bytes: %u\n", symbols);
+  }
+
+  delete_tree(&tree);
+  close(output);
+  return 0;
+}
@@ -5,7 +5,7 @@
 #include <stdlib.h>
 
 /* Constructs a Node object */
-Node *node_create(uint8_t symbol, uint64_t frequency) {
+Node *node_create(uint16_t symbol, uint64_t frequency) {
   Node *n = (Node *)malloc(sizeof(Node));
   n->left = NULL;
   n->right = NULL;
@@ -46,7 +46,7 @@ void node_print(Node *n) {
     printf("Frequency: %lu || Symbol: %c\n", n->frequency, n->symbol);
   } else {
     printf("Frequency: %lu || ", n->frequency);
-    printf("Symbol: 0x%02" PRIx8 "\n", n->symbol);
+    printf("Symbol: 0x%02" PRIx16 "\n", n->symbol);
   }
 }
 
@@ -64,6 +64,6 @@ void node_print_sym(Node *n) {
   if (isprint(n->symbol) != 0 && iscntrl(n->symbol) == 0) {
     printf("Symbol: %c\n", n->symbol);
   } else {
-    printf("Symbol: 0x%02" PRIx8 "\n", n->symbol);
+    printf("Symbol: 0x%02" PRIx16 "\n", n->symbol);
   }
 }
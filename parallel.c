@@ -0,0 +1,374 @@
+#include "parallel.h"
+#include "bitpack.h"
+#include "hist.h"
+#include "io.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Since the code table is known before coding starts, the amount of bits
+   any chunk of input codes to is the sum of its symbol frequencies times
+   their code lengths.  Prefix sums of these lengths give the bit offset of
+   every chunk in the output, so chunks can be coded independently and
+   their boundary bytes ORed together, which produces exactly the output
+   of the single threaded encoder. */
+
+/* One chunk of input and the thread that codes it. */
+typedef struct Worker Worker;
+
+struct Worker {
+  const uint8_t *in;          /* Input bytes of the chunk. */
+  uint32_t n;                 /* Amount of input bytes. */
+  uint64_t bits;              /* Bits the chunk codes to. */
+  uint64_t start;             /* Bit of the first code in the first byte. */
+  uint8_t *out;               /* Coded bytes of the chunk. */
+  uint32_t index;             /* Position of the chunk in its batch. */
+  uint64_t carry;             /* Bits pending from the previous batch. */
+  uint32_t *length;           /* Code length of each symbol. */
+  PackTable *pack;            /* Packing kernel table of the codes. */
+  Worker *batch;              /* All chunks of the batch. */
+  pthread_barrier_t *counted; /* Reached once every length is known. */
+};
+
+/* Codes one chunk.  First computes the chunk's bit length from its
+   histogram, then waits for the other chunks of the batch to do the same
+   so its offset in the output is known, and packs its codes at that
+   offset. */
+static void *code_chunk(void *arg) {
+  Worker *w = (Worker *)arg;
+
+  uint64_t hist[ALPHABET] = {0};
+  hist_count(hist, w->in, w->n);
+  w->bits = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    w->bits += hist[s] * w->length[s];
+  }
+
+  pthread_barrier_wait(w->counted);
+
+  uint64_t offset = w->carry;
+  for (uint32_t i = 0; i < w->index; i++) {
+    offset += w->batch[i].bits;
+  }
+  w->start = offset % 8;
+  w->out = (uint8_t *)malloc(((w->start + w->bits) / 8) + 16);
+  w->out[0] = 0;
+
+  uint64_t bit = w->start;
+  pack_codes(w->pack, w->in, w->n, w->out, &bit);
+  return NULL;
+}
+
+/* Encodes infile to outfile with the code table, coding PARALLEL_CHUNK
+   byte chunks on up to threads threads at a time.  The output is byte
+   for byte the same as write_codes() and flush_codes() produce.  infile
+   has to be a file that can be mapped into memory; returns false without
+   writing anything if it can't. */
+bool parallel_encode(int infile, int outfile, Code table[static ALPHABET],
+                     uint32_t threads) {
+  struct stat st;
+  if (fstat(infile, &st) != 0 || st.st_size == 0) {
+    return false;
+  }
+  uint8_t *map =
+      (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, infile, 0);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  if (threads > PARALLEL_THREADS) {
+    threads = PARALLEL_THREADS;
+  }
+  PackTable pack;
+  pack_create(&pack, table);
+  uint32_t length[ALPHABET];
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    length[s] = code_size(&table[s]);
+  }
+
+  Worker batch[PARALLEL_THREADS];
+  pthread_t tid[PARALLEL_THREADS];
+  uint64_t pos = 0;
+  uint64_t carry = 0; /* Bits of the last, partial output byte. */
+  uint8_t partial = 0;
+
+  while (pos < (uint64_t)st.st_size) {
+    uint32_t nchunks = 0;
+    for (; nchunks < threads && pos < (uint64_t)st.st_size; nchunks++) {
+      uint64_t left = st.st_size - pos;
+      batch[nchunks] = (Worker){.in = map + pos,
+                                .n = left < PARALLEL_CHUNK ? left
+                                                           : PARALLEL_CHUNK,
+                                .index = nchunks,
+                                .carry = carry,
+                                .length = length,
+                                .pack = &pack,
+                                .batch = batch};
+      pos += batch[nchunks].n;
+    }
+
+    pthread_barrier_t counted;
+    pthread_barrier_init(&counted, NULL, nchunks);
+    for (uint32_t i = 0; i < nchunks; i++) {
+      batch[i].counted = &counted;
+      pthread_create(&tid[i], NULL, code_chunk, &batch[i]);
+    }
+
+    /* Joins the chunks in order, ORing the partial byte left by each
+       chunk into the first byte of the next. */
+    for (uint32_t i = 0; i < nchunks; i++) {
+      pthread_join(tid[i], NULL);
+      Worker *w = &batch[i];
+      uint64_t end = w->start + w->bits;
+
+      w->out[0] |= partial;
+      write_symbols(outfile, w->out, end / 8);
+      partial = w->out[end / 8] & ((1u << (end % 8)) - 1);
+      carry = end % 8;
+      free(w->out);
+    }
+    pthread_barrier_destroy(&counted);
+  }
+
+  if (carry > 0) {
+    write_symbol(outfile, partial);
+  }
+  flush_codes(outfile);
+  munmap(map, st.st_size);
+  return true;
+}
+
+/* Decoding has no such offsets to go by, as a file has no index of where
+   its codes start.  Huffman codes resynchronize quickly though: decoding
+   from an arbitrary bit soon lands on a code boundary of the real stream,
+   and from there on it decodes the same symbols.  So every segment of the
+   input is decoded speculatively from its first bit, recording the bits
+   its first symbols start at, and the previous segment keeps decoding a
+   little past its end recording the same.  The first boundary both share
+   is where the previous segment's output ends and this one's begins.  Two
+   decoders at the same bit decode the same symbols, so a shared boundary
+   proves the stitched output right; if there is none, decoding continues
+   on one thread from the last boundary known to be right. */
+
+/* One segment of the compressed input and the thread that decodes it. */
+typedef struct {
+  const uint8_t *in;            /* All of the compressed input. */
+  uint64_t nbits;               /* Bits of compressed input. */
+  uint64_t start;               /* First bit of the segment. */
+  uint64_t end;                 /* First bit past the segment. */
+  bool last;                    /* True if the segment ends the input. */
+  UnpackTable *table;           /* Table of the decoding kernels. */
+  Node *root;                   /* Root of the Huffman tree. */
+  uint8_t *out;                 /* Symbols decoded from start. */
+  uint32_t capacity;            /* Most symbols out holds. */
+  uint32_t k;                   /* Amount of symbols decoded. */
+  uint32_t skip;                /* Symbols before the real stream. */
+  uint32_t past;                /* Index of the first symbol past end. */
+  uint32_t nhead;               /* Amount of boundaries from start. */
+  uint32_t ntail;               /* Amount of boundaries past end. */
+  uint64_t head[PARALLEL_SYNC]; /* Bits the first symbols start at. */
+  uint64_t tail[PARALLEL_SYNC]; /* Bits the symbols past end start at. */
+} Segment;
+
+/* Decodes up to n symbols of s one at a time starting at *bit, recording
+   the bit each one starts at in marks.  Returns how many were decoded. */
+static uint32_t decode_marked(Segment *s, uint64_t *bit, uint64_t *marks,
+                              uint32_t n) {
+  uint32_t i = 0;
+  for (; i < n; i++) {
+    marks[i] = *bit;
+    if (unpack_tail(s->root, s->in, bit, s->nbits, s->out + s->k, 1) == 0) {
+      break;
+    }
+    s->k++;
+  }
+  return i;
+}
+
+/* Decodes one segment from its first bit, as if a code started there.
+   The kernels stop at the first pair of symbols past the end of the
+   segment, after which PARALLEL_SYNC more symbols are decoded to meet the
+   boundaries of the next segment. */
+static void *decode_segment(void *arg) {
+  Segment *s = (Segment *)arg;
+  uint64_t bit = s->start;
+
+  s->nhead = decode_marked(s, &bit, s->head, PARALLEL_SYNC);
+  uint64_t limit = s->last == true ? s->nbits : s->end + (8 * UNPACK_SLACK);
+  s->k += unpack_symbols(s->table, s->in, &bit, limit, s->out + s->k,
+                         s->capacity - s->k);
+  if (s->last == true) {
+    s->k += unpack_tail(s->root, s->in, &bit, s->nbits, s->out + s->k,
+                        s->capacity - s->k);
+    return NULL;
+  }
+
+  s->past = s->k;
+  s->ntail = decode_marked(s, &bit, s->tail, PARALLEL_SYNC);
+  return NULL;
+}
+
+/* Finds the first boundary that prev decoded past its end and next
+   decoded from its start, and cuts both outputs there.  Returns false if
+   they share none. */
+static bool stitch(Segment *prev, Segment *next) {
+  uint32_t i = 0;
+  uint32_t j = 0;
+
+  while (i < prev->ntail && j < next->nhead) {
+    if (prev->tail[i] < next->head[j]) {
+      i++;
+    } else if (prev->tail[i] > next->head[j]) {
+      j++;
+    } else {
+      prev->k = prev->past + i;
+      next->skip = j;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Writes the symbols of s that belong to the real stream, but no more
+   than left, or stores them at the given place of a mapped output if at
+   isn't NULL.  Returns how many were written. */
+static uint64_t emit(int outfile, uint8_t *at, Segment *s, uint64_t left) {
+  uint64_t n = s->k - s->skip;
+  if (n > left) {
+    n = left;
+  }
+  if (at != NULL) {
+    memcpy(at, s->out + s->skip, n);
+    bytes_written += n;
+  } else {
+    write_symbols(outfile, s->out + s->skip, n);
+  }
+  return n;
+}
+
+/* Decodes nsymbols symbols of s starting at bit on this thread, storing
+   them straight into a mapped output at at if it isn't NULL. */
+static void decode_rest(int outfile, uint8_t *at, Segment *s, uint64_t bit,
+                        uint64_t nsymbols) {
+  uint8_t syms[BLOCK];
+
+  while (nsymbols > 0) {
+    uint32_t want = nsymbols < BLOCK ? nsymbols : BLOCK;
+    uint8_t *dst = at != NULL ? at : syms;
+    uint32_t k = unpack_symbols(s->table, s->in, &bit, s->nbits, dst, want);
+    k += unpack_tail(s->root, s->in, &bit, s->nbits, dst + k, want - k);
+    if (k == 0) {
+      break;
+    }
+    if (at != NULL) {
+      at += k;
+      bytes_written += k;
+    } else {
+      write_symbols(outfile, syms, k);
+    }
+    nsymbols -= k;
+  }
+}
+
+/* Decodes nsymbols symbols coded with the tree root from the rest of
+   infile to outfile, decoding PARALLEL_CHUNK byte segments of it on up to
+   threads threads at a time.  If out isn't NULL, the symbols are stored
+   into that mapping of the output instead of being written to outfile.
+   infile has to be a file that can be mapped into memory and hold at
+   least two segments; returns false without reading anything if it
+   doesn't. */
+bool parallel_decode(int infile, int outfile, uint8_t *out, Node *root,
+                     uint64_t nsymbols, uint32_t threads) {
+  struct stat st;
+  off_t offset = lseek(infile, 0, SEEK_CUR);
+  if (fstat(infile, &st) != 0 || offset < 0 ||
+      st.st_size - offset < 2 * PARALLEL_CHUNK) {
+    return false;
+  }
+  uint8_t *map =
+      (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, infile, 0);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  if (threads > PARALLEL_THREADS) {
+    threads = PARALLEL_THREADS;
+  }
+  UnpackTable *t = (UnpackTable *)malloc(sizeof(UnpackTable));
+  unpack_create(t, root);
+
+  uint64_t nbytes = st.st_size - offset;
+  uint64_t nsegments = nbytes / PARALLEL_CHUNK;
+  Segment *segs = (Segment *)calloc(threads + 1, sizeof(Segment));
+  pthread_t tid[PARALLEL_THREADS];
+  uint32_t carried = 0; /* Last segment of the previous batch, if any. */
+  uint64_t next = 0;
+  uint64_t written = 0;
+  bool synced = true;
+  uint64_t resume = 0; /* Bit to continue from if a stitch fails. */
+
+  while (next < nsegments && synced == true) {
+    uint32_t n = nsegments - next < threads ? nsegments - next : threads;
+    for (uint32_t i = 0; i < n; i++) {
+      Segment *s = &segs[carried + i];
+      uint64_t index = next + i;
+      *s = (Segment){.in = map + offset,
+                     .nbits = 8 * nbytes,
+                     .start = 8 * index * PARALLEL_CHUNK,
+                     .end = 8 * (index + 1) * PARALLEL_CHUNK,
+                     .last = index + 1 == nsegments,
+                     .table = t,
+                     .root = root};
+      if (s->last == true) {
+        s->end = s->nbits;
+      }
+      s->capacity =
+          (s->end - s->start) + (8 * UNPACK_SLACK) + (2 * PARALLEL_SYNC);
+      s->out = (uint8_t *)malloc(s->capacity);
+      pthread_create(&tid[i], NULL, decode_segment, s);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      pthread_join(tid[i], NULL);
+    }
+    next += n;
+
+    /* Stitches the segments in order.  After a failed stitch, the rest
+       of the batch is only released and no more batches are started. */
+    uint32_t count = carried + n;
+    for (uint32_t i = 1; i < count; i++) {
+      Segment *prev = &segs[i - 1];
+      if (synced == true && stitch(prev, &segs[i]) == false) {
+        synced = false;
+        resume = prev->head[prev->skip];
+      }
+      if (synced == true) {
+        written += emit(outfile, out != NULL ? out + written : NULL, prev,
+                        nsymbols - written);
+      }
+      free(prev->out);
+    }
+    segs[0] = segs[count - 1];
+    carried = 1;
+  }
+
+  if (synced == true) {
+    written += emit(outfile, out != NULL ? out + written : NULL, &segs[0],
+                    nsymbols - written);
+  } else {
+    decode_rest(outfile, out != NULL ? out + written : NULL, &segs[0],
+                resume, nsymbols - written);
+  }
+  bytes_read += nbytes;
+  flush_codes(outfile);
+
+  free(segs[0].out);
+  free(segs);
+  free(t);
+  munmap(map, st.st_size);
+  return true;
+}
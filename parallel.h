@@ -0,0 +1,17 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include "node.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PARALLEL_CHUNK   (1 << 20) // Input bytes coded by one thread at a time.
+#define PARALLEL_THREADS 64        // Most threads the parallel coders use.
+#define PARALLEL_SYNC    1024      // Symbols compared to resynchronize.
+
+bool parallel_encode(int infile, int outfile, Code table[static ALPHABET],
+                     uint32_t threads);
+
+bool parallel_decode(int infile, int outfile, uint8_t *map, Node *root,
+                     uint64_t nsymbols, uint32_t threads);
@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+#include "perf.h"
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Counters are read at the start and at the end of every phase and the
+   differences are kept per phase.  When the kernel doesn't allow hardware
+   counters, only the task clock is kept, which falls back to the process
+   CPU clock if perf events aren't available at all. */
+
+static const char *event_names[PERF_EVENTS] = {
+    "cycles", "instructions", "branch-misses", "L1D-misses", "LLC-misses"};
+
+static bool enabled = false;
+static int fds[PERF_EVENTS] = {-1, -1, -1, -1, -1};
+static int clock_fd = -1;
+static uint64_t start[PERF_EVENTS];
+static uint64_t start_nanos = 0;
+static PerfPhase phases[PERF_PHASES];
+static uint32_t nphases = 0;
+
+/* Opens a counter of the calling process and the threads it creates
+   afterwards, counting user space only so it works without privileges. */
+static int open_event(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.inherit = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Reads a counter, scaled up if the kernel had to multiplex it with other
+   counters for part of the time. */
+static uint64_t read_event(int fd) {
+  uint64_t value[3] = {0, 0, 0};
+  if (fd < 0 || read(fd, value, sizeof(value)) != sizeof(value)) {
+    return 0;
+  }
+  if (value[2] > 0 && value[2] < value[1]) {
+    return (uint64_t)((long double)value[0] * value[1] / value[2]);
+  }
+  return value[0];
+}
+
+/* Returns nanoseconds of CPU time used so far. */
+static uint64_t read_clock(void) {
+  if (clock_fd >= 0) {
+    return read_event(clock_fd);
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Turns on the instrumentation and opens the counters.  Returns true if
+   hardware counters are available, false if only time is measured. */
+bool perf_enable(void) {
+  enabled = true;
+
+  uint64_t l1d = PERF_COUNT_HW_CACHE_L1D |
+                 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  fds[0] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  fds[1] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  fds[2] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+  fds[3] = open_event(PERF_TYPE_HW_CACHE, l1d);
+  fds[4] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  clock_fd = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+
+  return fds[0] >= 0;
+}
+
+/* Starts measuring the phase called name. */
+void perf_begin(const char *name) {
+  if (enabled == false || nphases == PERF_PHASES) {
+    return;
+  }
+
+  phases[nphases].name = name;
+  for (uint32_t e = 0; e < PERF_EVENTS; e++) {
+    start[e] = read_event(fds[e]);
+  }
+  start_nanos = read_clock();
+}
+
+/* Ends the phase started last, which processed the given amount of
+   bytes. */
+void perf_end(uint64_t bytes) {
+  if (enabled == false || nphases == PERF_PHASES) {
+    return;
+  }
+
+  PerfPhase *p = &phases[nphases++];
+  p->nanos = read_clock() - start_nanos;
+  for (uint32_t e = 0; e < PERF_EVENTS; e++) {
+    p->count[e] = read_event(fds[e]) - start[e];
+  }
+  p->bytes = bytes;
+}
+
+/* Prints the counters of every phase to stderr, with nanoseconds and
+   cycles per byte and instructions per cycle, and closes the counters.
+   Counters that couldn't be opened are printed as -. */
+void perf_report(void) {
+  if (enabled == false) {
+    return;
+  }
+
+  fprintf(stderr, "%-10s %10s %8s %8s %6s", "phase", "time ms", "ns/B",
+          "cyc/B", "IPC");
+  for (uint32_t e = 2; e < PERF_EVENTS; e++) {
+    fprintf(stderr, " %14s", event_names[e]);
+  }
+  fprintf(stderr, "\n");
+
+  for (uint32_t i = 0; i < nphases; i++) {
+    PerfPhase *p = &phases[i];
+    fprintf(stderr, "%-10s %10.3f", p->name, p->nanos / 1e6);
+    if (p->bytes > 0) {
+      fprintf(stderr, " %8.3f", (double)p->nanos / p->bytes);
+    } else {
+      fprintf(stderr, " %8s", "-");
+    }
+
+    if (fds[0] >= 0 && p->bytes > 0) {
+      fprintf(stderr, " %8.2f", (double)p->count[0] / p->bytes);
+    } else {
+      fprintf(stderr, " %8s", "-");
+    }
+    if (fds[0] >= 0 && fds[1] >= 0 && p->count[0] > 0) {
+      fprintf(stderr, " %6.2f", (double)p->count[1] / p->count[0]);
+    } else {
+      fprintf(stderr, " %6s", "-");
+    }
+    for (uint32_t e = 2; e < PERF_EVENTS; e++) {
+      if (fds[e] >= 0) {
+        fprintf(stderr, " %14lu", p->count[e]);
+      } else {
+        fprintf(stderr, " %14s", "-");
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+
+  if (fds[0] < 0) {
+    fprintf(stderr, "Hardware counters unavailable, only time measured.\n");
+  }
+  for (uint32_t e = 0; e < PERF_EVENTS; e++) {
+    if (fds[e] >= 0) {
+      close(fds[e]);
+    }
+  }
+  if (clock_fd >= 0) {
+    close(clock_fd);
+  }
+  enabled = false;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PERF_EVENTS 5 // Cycles, instructions, branch, L1D and LLC misses.
+#define PERF_PHASES 8 // Most phases a run can report.
+
+typedef struct {
+    const char *name;
+    uint64_t count[PERF_EVENTS]; // Counter deltas, scaled if multiplexed.
+    uint64_t nanos;              // Task clock time spent in the phase.
+    uint64_t bytes;              // Bytes the phase is normalized to.
+} PerfPhase;
+
+bool perf_enable(void);
+
+void perf_begin(const char *name);
+
+void perf_end(uint64_t bytes);
+
+void perf_report(void);
@@ -0,0 +1,200 @@
+#include "pipeline.h"
+#include "bitpack.h"
+#include "io.h"
+#include "ring.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PIPELINE_SLOTS 8 /* Buffers in flight between two stages. */
+
+/* State shared by the reader, coder and writer stages. */
+typedef struct {
+  int infile;        /* File descriptor the reader stage reads from. */
+  int outfile;       /* File descriptor the writer stage writes to. */
+  Ring *input;       /* Blocks going from the reader to the coder. */
+  Ring *output;      /* Blocks going from the coder to the writer. */
+  uint64_t nread;    /* Bytes read by the reader stage. */
+  uint64_t nwritten; /* Bytes written by the writer stage. */
+} Pipeline;
+
+/* Reader stage.  Fills io_block byte slots from infile until end of input.
+   A short read marks the final slot of the stream. */
+static void *reader(void *arg) {
+  Pipeline *p = (Pipeline *)arg;
+  bool last = false;
+
+  while (last == false) {
+    RingSlot *s = ring_acquire(p->input);
+    s->length = read_bytes(p->infile, s->data, s->capacity);
+    s->last = last = s->length < s->capacity;
+    p->nread += s->length;
+    ring_publish(p->input);
+  }
+  return NULL;
+}
+
+/* Writer stage.  Drains the coded slots to outfile until the final slot
+   was written. */
+static void *writer(void *arg) {
+  Pipeline *p = (Pipeline *)arg;
+  bool last = false;
+
+  while (last == false) {
+    RingSlot *s = ring_peek(p->output);
+    if (s->length > 0) {
+      p->nwritten += write_bytes(p->outfile, s->data, s->length);
+    }
+    last = s->last;
+    ring_release(p->output);
+  }
+  return NULL;
+}
+
+/* Creates the rings and starts the reader and writer threads around the
+   calling thread, which acts as the coder stage. */
+static void pipeline_start(Pipeline *p, pthread_t *r, pthread_t *w) {
+  p->input = ring_create(PIPELINE_SLOTS, io_block);
+  p->output = ring_create(PIPELINE_SLOTS, io_block);
+  p->nread = 0;
+  p->nwritten = 0;
+  pthread_create(r, NULL, reader, p);
+  pthread_create(w, NULL, writer, p);
+}
+
+/* Waits for both threads to finish and adds their byte counts to the
+   statistics kept by the I/O module. */
+static void pipeline_finish(Pipeline *p, pthread_t r, pthread_t w) {
+  pthread_join(r, NULL);
+  pthread_join(w, NULL);
+  bytes_read += p->nread;
+  bytes_written += p->nwritten;
+  ring_delete(&p->input);
+  ring_delete(&p->output);
+}
+
+/* Appends the code c to the output slot a bit at a time, handing the slot
+   to the writer and continuing in a fresh one once it is full. */
+static void put_code(Pipeline *p, RingSlot **out, uint64_t *bit, Code *c) {
+  for (uint32_t b = 0; b < code_size(c); b++) {
+    if (*bit % 8 == 0) {
+      (*out)->data[*bit / 8] = 0;
+    }
+    if (code_get_bit(c, b) == true) {
+      (*out)->data[*bit / 8] |= (uint8_t)1 << (*bit % 8);
+    }
+    *bit += 1;
+
+    if (*bit == 8 * (uint64_t)(*out)->capacity) {
+      (*out)->length = (*out)->capacity;
+      ring_publish(p->output);
+      *out = ring_acquire(p->output);
+      *bit = 0;
+    }
+  }
+}
+
+/* Encodes infile to outfile with the code table using a reader, coder and
+   writer thread.  The bits are packed exactly like write_codes() and
+   flush_codes() pack them, so the output is identical to the single
+   threaded encoder. */
+void pipeline_encode(int infile, int outfile, Code table[static ALPHABET]) {
+  Pipeline p = {.infile = infile, .outfile = outfile};
+  pthread_t r, w;
+  pipeline_start(&p, &r, &w);
+
+  PackTable pack;
+  pack_create(&pack, table);
+
+  RingSlot *out = ring_acquire(p.output);
+  uint64_t bit = 0;
+  bool last = false;
+
+  while (last == false) {
+    RingSlot *in = ring_peek(p.input);
+
+    /* The kernels pack what fits into the slot and the code straddling
+       the end of the slot is appended bit by bit. */
+    uint32_t i = 0;
+    while (i < in->length) {
+      i += pack_symbols(&pack, in->data + i, in->length - i, out->data, &bit,
+                        8 * (uint64_t)out->capacity);
+      if (i < in->length) {
+        put_code(&p, &out, &bit, &table[in->data[i]]);
+        i++;
+      }
+    }
+
+    last = in->last;
+    ring_release(p.input);
+  }
+
+  /* The final block carries the left over bits. */
+  out->length = (bit + 7) / 8;
+  out->last = true;
+  ring_publish(p.output);
+
+  pipeline_finish(&p, r, w);
+}
+
+/* Decodes nsymbols symbols from infile to outfile with the table-driven
+   kernels of the Huffman tree given by root, using a reader, coder and
+   writer thread. */
+void pipeline_decode(int infile, int outfile, Node *root, uint64_t nsymbols) {
+  Pipeline p = {.infile = infile, .outfile = outfile};
+  pthread_t r, w;
+  pipeline_start(&p, &r, &w);
+
+  UnpackTable *t = (UnpackTable *)malloc(sizeof(UnpackTable));
+  unpack_create(t, root);
+  UnpackInput u;
+  unpack_input_create(&u, io_block);
+  RingSlot *out = ring_acquire(p.output);
+  uint64_t decoded = 0;
+  bool last = false;
+
+  while (last == false) {
+    /* Each block is appended to the codes of the blocks before it that
+       weren't decoded yet.  Once every symbol has been decoded the
+       remaining input is only drained so the reader thread can run to
+       completion. */
+    RingSlot *in = ring_peek(p.input);
+    if (decoded < nsymbols) {
+      unpack_shift(&u);
+      memcpy(u.in + u.have, in->data, in->length);
+      u.have += in->length;
+      memset(u.in + u.have, 0, UNPACK_SLACK);
+    }
+    last = in->last;
+    ring_release(p.input);
+
+    /* The kernels stop short of the end of the input, and the codes
+       after that are decoded by walking the tree up to the first one
+       that continues in the next block. */
+    uint32_t k = 1;
+    while (decoded < nsymbols && k > 0) {
+      uint64_t room = out->capacity - out->length;
+      uint32_t want = nsymbols - decoded < room ? nsymbols - decoded : room;
+      uint64_t nbits = 8 * (uint64_t)u.have;
+      uint8_t *dst = out->data + out->length;
+      k = unpack_symbols(t, u.in, &u.bit, nbits, dst, want);
+      k += unpack_tail(root, u.in, &u.bit, nbits, dst + k, want - k);
+      out->length += k;
+      decoded += k;
+
+      if (out->length == out->capacity) {
+        ring_publish(p.output);
+        out = ring_acquire(p.output);
+      }
+    }
+  }
+
+  out->last = true;
+  ring_publish(p.output);
+
+  pipeline_finish(&p, r, w);
+  unpack_input_delete(&u);
+  free(t);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include "node.h"
+#include <stdint.h>
+
+void pipeline_encode(int infile, int outfile, Code table[static ALPHABET]);
+
+void pipeline_decode(int infile, int outfile, Node *root, uint64_t nsymbols);
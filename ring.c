@@ -0,0 +1,83 @@
+#include "ring.h"
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+struct Ring {
+  _Alignas(64) _Atomic uint64_t head; /* Slots published by the producer. */
+  _Alignas(64) _Atomic uint64_t tail; /* Slots released by the consumer. */
+  _Alignas(64) uint32_t slots;        /* Total amount of slots. */
+  RingSlot *items;                    /* The array containing the slots. */
+  uint8_t *storage;                   /* Preallocated memory of all slots. */
+};
+
+/* Constructs a Ring object with slots preallocated buffers that are each
+   slot_size bytes long.  The ring must only ever have one producer thread
+   and one consumer thread.  The buffers are page aligned, so slots of a
+   multiple of the page size can be filled with direct I/O. */
+Ring *ring_create(uint32_t slots, uint32_t slot_size) {
+  Ring *r = (Ring *)aligned_alloc(64, sizeof(Ring));
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  r->slots = slots;
+  r->items = (RingSlot *)calloc(slots, sizeof(RingSlot));
+  r->storage = (uint8_t *)aligned_alloc(4096, (size_t)slots * slot_size);
+
+  for (uint32_t i = 0; i < slots; i++) {
+    r->items[i].data = r->storage + ((size_t)i * slot_size);
+    r->items[i].capacity = slot_size;
+    r->items[i].length = 0;
+    r->items[i].last = false;
+  }
+  return r;
+}
+
+/* Frees the slots, their buffers and the ring itself. */
+void ring_delete(Ring **r) {
+  if (*r != NULL) {
+    free((*r)->storage);
+    free((*r)->items);
+    free(*r);
+    *r = NULL;
+  }
+}
+
+/* Producer side.  Waits until a free slot is available and returns it.
+   The producer is throttled here whenever the consumer falls behind, which
+   is what applies backpressure to the pipeline. */
+RingSlot *ring_acquire(Ring *r) {
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  while (head - atomic_load_explicit(&r->tail, memory_order_acquire) >=
+         r->slots) {
+    sched_yield();
+  }
+
+  RingSlot *s = &r->items[head % r->slots];
+  s->length = 0;
+  s->last = false;
+  return s;
+}
+
+/* Producer side.  Hands the slot returned by ring_acquire() over to the
+   consumer. */
+void ring_publish(Ring *r) {
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/* Consumer side.  Waits until the producer published a slot and returns
+   it without removing it from the ring. */
+RingSlot *ring_peek(Ring *r) {
+  uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  while (atomic_load_explicit(&r->head, memory_order_acquire) == tail) {
+    sched_yield();
+  }
+  return &r->items[tail % r->slots];
+}
+
+/* Consumer side.  Gives the slot returned by ring_peek() back to the
+   producer so its buffer can be refilled. */
+void ring_release(Ring *r) {
+  uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
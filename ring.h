@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct Ring Ring;
+
+typedef struct {
+    uint8_t *data;
+    uint32_t capacity;
+    uint32_t length;
+    bool last;
+} RingSlot;
+
+Ring *ring_create(uint32_t slots, uint32_t slot_size);
+
+void ring_delete(Ring **r);
+
+RingSlot *ring_acquire(Ring *r);
+
+void ring_publish(Ring *r);
+
+RingSlot *ring_peek(Ring *r);
+
+void ring_release(Ring *r);
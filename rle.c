@@ -0,0 +1,133 @@
+#include "rle.h"
+#include "io.h"
+#include <stdbool.h>
+#include <string.h>
+
+/* A run of L >= RLE_MIN equal bytes is coded as the literal byte followed
+   by a run token for the L - 1 repeats.  Run token k stands for a repeat
+   count r with 2^k <= r < 2^(k+1), and is followed by the k low bits of r
+   written raw.  Shorter runs are coded as literals. */
+
+/* Returns how many bytes at the start of p, which holds n bytes, are equal
+   to b.  Compares 8 bytes at a time so long runs go at memchr() speed. */
+static uint32_t same_bytes(const uint8_t *p, uint32_t n, uint8_t b) {
+  uint64_t pattern = b * UINT64_C(0x0101010101010101);
+  uint32_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, sizeof(w));
+    if ((w ^ pattern) != 0) {
+      return i + (__builtin_ctzll(w ^ pattern) / 8);
+    }
+  }
+  while (i < n && p[i] == b) {
+    i++;
+  }
+  return i;
+}
+
+/* Counts or writes the token with the given symbol. */
+static void emit(RunCoder *rc, uint32_t token, uint64_t count) {
+  if (rc->hist != NULL) {
+    rc->hist[token] += count;
+  } else {
+    for (uint64_t i = 0; i < count; i++) {
+      write_code(rc->outfile, &rc->table[token]);
+    }
+  }
+}
+
+/* Emits the tokens of the current run. */
+static void flush_run(RunCoder *rc) {
+  if (rc->prev < 0) {
+    return;
+  }
+
+  if (rc->length < RLE_MIN) {
+    emit(rc, rc->prev, rc->length);
+    return;
+  }
+
+  uint64_t repeats = rc->length - 1;
+  uint32_t k = 63 - __builtin_clzll(repeats);
+  emit(rc, rc->prev, 1);
+  emit(rc, ALPHABET + k, 1);
+  if (rc->hist == NULL) {
+    write_bits(rc->outfile, repeats, k);
+  }
+}
+
+/* Initializes the run-length coder.  With a histogram the coder only counts
+   the tokens of its input, otherwise it writes their codes from table to
+   outfile. */
+void rle_init(RunCoder *rc, uint64_t *hist, Code *table, int outfile) {
+  rc->prev = -1;
+  rc->length = 0;
+  rc->hist = hist;
+  rc->table = table;
+  rc->outfile = outfile;
+}
+
+/* Feeds the next n bytes of input to the coder.  Runs may span calls. */
+void rle_feed(RunCoder *rc, const uint8_t *buf, uint32_t n) {
+  uint32_t i = 0;
+  while (i < n) {
+    if (rc->prev == buf[i]) {
+      uint32_t same = same_bytes(buf + i, n - i, buf[i]);
+      rc->length += same;
+      i += same;
+    } else {
+      flush_run(rc);
+      rc->prev = buf[i];
+      rc->length = 1;
+      i++;
+    }
+  }
+}
+
+/* Emits the final run. */
+void rle_finish(RunCoder *rc) {
+  flush_run(rc);
+  rc->prev = -1;
+  rc->length = 0;
+}
+
+/* Decodes nbytes bytes of run-length tokens coded with the tree given by
+   root from infile to outfile. */
+void rle_decode(int infile, int outfile, Node *root, uint64_t nbytes) {
+  uint64_t decoded = 0;
+  uint8_t prev = 0;
+  uint8_t bit = 0;
+
+  while (decoded < nbytes) {
+    Node *node = root;
+    while (node->left != NULL && node->right != NULL) {
+      if (read_bit(infile, &bit) == false) {
+        flush_codes(outfile);
+        return;
+      }
+      node = bit == 0 ? node->left : node->right;
+    }
+
+    if (node->symbol < ALPHABET) {
+      prev = node->symbol;
+      write_symbol(outfile, prev);
+      decoded++;
+    } else {
+      uint32_t k = node->symbol - ALPHABET;
+      uint64_t low = 0;
+      if (read_bits(infile, &low, k) == false) {
+        break;
+      }
+
+      uint64_t repeats = (UINT64_C(1) << k) | low;
+      if (repeats > nbytes - decoded) {
+        repeats = nbytes - decoded;
+      }
+      write_repeat(outfile, prev, repeats);
+      decoded += repeats;
+    }
+  }
+  flush_codes(outfile);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include "node.h"
+#include <stdint.h>
+
+#define RUN_CLASSES  64                       // Runs of up to 2^64 - 1 bytes.
+#define RLE_ALPHABET (ALPHABET + RUN_CLASSES) // Literal bytes and run tokens.
+#define RLE_MIN      4                        // Shortest run made a token.
+
+typedef struct {
+    int32_t prev;    // Byte of the current run, -1 before any input.
+    uint64_t length; // Length of the current run.
+    uint64_t *hist;  // Token histogram when counting, NULL when writing.
+    Code *table;     // Token codes when writing.
+    int outfile;
+} RunCoder;
+
+void rle_init(RunCoder *rc, uint64_t *hist, Code *table, int outfile);
+
+void rle_feed(RunCoder *rc, const uint8_t *buf, uint32_t n);
+
+void rle_finish(RunCoder *rc);
+
+void rle_decode(int infile, int outfile, Node *root, uint64_t nbytes);
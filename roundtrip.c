@@ -0,0 +1,174 @@
+#include "hstream.h"
+#include "io.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OPTIONS "hi:o:dv"
+
+/* A growing buffer the coded bytes are collected in. */
+typedef struct {
+  uint8_t *data;
+  uint64_t size;
+  uint64_t capacity;
+} Buffer;
+
+/* Prints the help message to stderr. */
+static void usage(char *name) {
+  fprintf(stderr, "SYNOPSIS\n");
+  fprintf(stderr, "  A driver of the incremental coder.\n");
+  fprintf(stderr, "  Encodes and decodes a file through hstream one byte of "
+                  "input and output\n  at a time and checks that the bytes "
+                  "come back.\n\n");
+  fprintf(stderr, "USAGE\n");
+  fprintf(stderr, "  %s [-hdv] [-i infile] [-o outfile]\n\n", name);
+  fprintf(stderr, "OPTIONS\n");
+  fprintf(stderr, "  -h             Program usage and help.\n");
+  fprintf(stderr, "  -v             Print the bytes coded.\n");
+  fprintf(stderr, "  -d             Only decode infile, a framed stream.\n");
+  fprintf(stderr, "  -i infile      Input file to code.\n");
+  fprintf(stderr, "  -o outfile     Output of the framed stream, or of the "
+                  "decoded bytes with -d.\n");
+}
+
+/* Appends byte to b, growing it if it is full. */
+static void append(Buffer *b, uint8_t byte) {
+  if (b->size == b->capacity) {
+    b->capacity = b->capacity == 0 ? io_block : 2 * b->capacity;
+    b->data = (uint8_t *)realloc(b->data, b->capacity);
+  }
+  b->data[b->size++] = byte;
+}
+
+/* Runs in through the coder of s one byte of input and output per call,
+   with HSTREAM_FINISH once all of in was handed over, and collects the
+   output in out.  Returns the last result of the coder, HSTREAM_END
+   unless the coder failed or stopped making progress. */
+static int drive(HStream *s, int (*code)(HStream *, int), Buffer *in,
+                 Buffer *out) {
+  uint64_t fed = 0;
+  int result = HSTREAM_OK;
+  while (result == HSTREAM_OK) {
+    uint8_t byte = 0;
+    s->next_in = in->data + fed;
+    uint64_t avail = fed < in->size ? 1 : 0;
+    s->avail_in = avail;
+    s->next_out = &byte;
+    s->avail_out = 1;
+    result = code(s, avail == 1 ? HSTREAM_NONE : HSTREAM_FINISH);
+    fed += avail - s->avail_in;
+    if (s->avail_out == 0) {
+      append(out, byte);
+    } else if (s->avail_in == avail && result == HSTREAM_OK) {
+      /* Neither the input nor the output byte was taken. */
+      return HSTREAM_EFORMAT;
+    }
+  }
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int opt = 0;
+  bool input_file_exists = false;
+  bool output_file_exists = false;
+  bool decode_only = false;
+  bool print_stats = false;
+  char *input_file = NULL;
+  char *output_file = NULL;
+
+  while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    switch (opt) {
+    case 'h': /* Help Message */
+      usage(argv[0]);
+      return 0;
+    case 'i': /* Input File */
+      if (access(optarg, F_OK) != 0) {
+        fprintf(stderr, "Input file doesn't exist\n");
+        return 1;
+      }
+      input_file_exists = true;
+      input_file = optarg;
+      break;
+    case 'o': /* Output FIle */
+      output_file_exists = true;
+      output_file = optarg;
+      break;
+    case 'd': /* Decoding Only */
+      decode_only = true;
+      break;
+    case 'v': /* Enabling Stats */
+      print_stats = true;
+      break;
+    default: /* Bad Option */
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  int input = 0;
+  if (input_file_exists == true) {
+    input = open(input_file, O_RDONLY);
+  }
+
+  /* Reads all of the input first, so that only the coder sees it a byte
+     at a time. */
+  Buffer original = {NULL, 0, 0};
+  uint8_t *block = io_alloc(io_block);
+  int nbytes = 0;
+  while ((nbytes = read_bytes(input, block, io_block)) > 0) {
+    for (int i = 0; i < nbytes; i++) {
+      append(&original, block[i]);
+    }
+  }
+  free(block);
+  close(input);
+
+  HStream s;
+  Buffer framed = {NULL, 0, 0};
+  Buffer decoded = {NULL, 0, 0};
+  if (decode_only == true) {
+    framed = original;
+    original.data = NULL;
+  } else {
+    hstream_encode_init(&s);
+    if (drive(&s, hstream_encode, &original, &framed) != HSTREAM_END) {
+      fprintf(stderr, "Encoding stopped making progress\n");
+      return 1;
+    }
+    hstream_end(&s);
+  }
+
+  hstream_decode_init(&s);
+  int result = drive(&s, hstream_decode, &framed, &decoded);
+  hstream_end(&s);
+  if (result != HSTREAM_END) {
+    fprintf(stderr, "Invalid framed stream\n");
+    return 1;
+  }
+  if (decode_only == false &&
+      (decoded.size != original.size ||
+       (original.size > 0 &&
+        memcmp(decoded.data, original.data, original.size) != 0))) {
+    fprintf(stderr, "Decoded bytes differ from the input\n");
+    return 1;
+  }
+
+  if (output_file_exists == true) {
+    int output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    Buffer *b = decode_only == true ? &decoded : &framed;
+    write_bytes(output, b->data, b->size);
+    close(output);
+  }
+
+  if (print_stats == true) {
+    fprintf(stderr, "Decoded bytes: %lu\n", decoded.size);
+    fprintf(stderr, "Framed bytes: %lu\n", framed.size);
+  }
+
+  free(original.data);
+  free(framed.data);
+  free(decoded.data);
+  return 0;
+}
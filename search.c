@@ -0,0 +1,275 @@
+#define _GNU_SOURCE
+#include "bitpack.h"
+#include "code.h"
+#include "defines.h"
+#include "header.h"
+#include "huffman.h"
+#include "io.h"
+#include "node.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OPTIONS "hi:o:vce:C:"
+
+#define CONTEXT_MAX BLOCK        // Most context bytes printed around a match.
+#define WINDOW      (16 * BLOCK) // Symbols decoded before each search.
+
+/* Prints the help message to stderr. */
+static void usage(char *name) {
+  fprintf(stderr, "SYNOPSIS\n");
+  fprintf(stderr, "  A Huffman searcher.\n");
+  fprintf(stderr, "  Finds a byte pattern in a file compressed by encode.\n");
+  fprintf(stderr, "  The file is decoded into a 64 KiB window at a time that "
+                  "is searched\n  and dropped, so nothing is written out but "
+                  "the matches.\n\n");
+  fprintf(stderr, "USAGE\n");
+  fprintf(stderr, "  %s [-hvc] [-C bytes] -e pattern [-i infile] [-o outfile]"
+                  "\n\n",
+          name);
+  fprintf(stderr, "OPTIONS\n");
+  fprintf(stderr, "  -h             Program usage and help.\n");
+  fprintf(stderr, "  -v             Print search statistics.\n");
+  fprintf(stderr, "  -c             Only print the amount of matches.\n");
+  fprintf(stderr, "  -C bytes       Print bytes of context around matches.\n");
+  fprintf(stderr, "  -e pattern     Literal pattern to search for.\n");
+  fprintf(stderr, "  -i infile      Compressed input file to search.\n");
+  fprintf(stderr, "  -o outfile     Output of the matches.\n");
+}
+
+/* The compressed input, which is decoded a block of symbols at a time
+   into a small window that is searched and then dropped, so nothing but
+   the matches is ever written out. */
+typedef struct {
+  int infile;
+  UnpackTable *table; /* Table of the decoding kernels. */
+  Node *root;         /* Root of the Huffman tree. */
+  UnpackInput input;  /* Compressed bytes read so far but not decoded. */
+  uint64_t left;      /* Symbols left to decode. */
+} Reader;
+
+/* Decodes up to n symbols of r into out, refilling the compressed input
+   io_block bytes at a time with unpack_refill() like decode does.
+   Returns how many symbols were decoded, which is 0 at the end of
+   input. */
+static uint32_t read_symbols(Reader *r, uint8_t *out, uint32_t n) {
+  if (r->left == 0) {
+    return 0;
+  }
+  UnpackInput *u = &r->input;
+  bytes_read += unpack_refill(u, r->infile, read_bytes);
+
+  uint32_t want = r->left < n ? r->left : n;
+  uint64_t nbits = 8 * (uint64_t)u->have;
+  uint32_t k = unpack_symbols(r->table, u->in, &u->bit, nbits, out, want);
+  k += unpack_tail(r->root, u->in, &u->bit, nbits, out + k, want - k);
+  r->left -= k;
+  return k;
+}
+
+/* Writes one match at offset in the decompressed data.  With context,
+   the match is followed by up to context bytes before and after it, with
+   bytes that aren't printable shown as dots. */
+static void print_match(int outfile, uint64_t offset, uint8_t *buf,
+                        uint32_t have, uint32_t pos, uint32_t m,
+                        uint32_t context) {
+  char line[32];
+  int n = snprintf(line, sizeof(line), "%" PRIu64, offset);
+  write_symbols(outfile, (uint8_t *)line, n);
+
+  if (context > 0) {
+    uint32_t from = pos < context ? 0 : pos - context;
+    uint32_t to = have - (pos + m) < context ? have : pos + m + context;
+    write_symbols(outfile, (uint8_t *)": ", 2);
+    for (uint32_t i = from; i < to; i++) {
+      uint8_t c = isprint(buf[i]) ? buf[i] : '.';
+      write_symbols(outfile, &c, 1);
+    }
+  }
+  write_symbols(outfile, (uint8_t *)"\n", 1);
+}
+
+int main(int argc, char **argv) {
+
+  int opt = 0;
+  bool input_file_exists = false;
+  bool output_file_exists = false;
+  bool print_stats = false;
+  bool count_only = false;
+  uint32_t context = 0;
+  char *pattern = NULL;
+  char *input_file = NULL;
+  char *output_file = NULL;
+
+  while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    switch (opt) {
+    case 'h': /* Help Message */
+      usage(argv[0]);
+      return 0;
+    case 'i': /* Input File */
+      if (access(optarg, F_OK) != 0) {
+        fprintf(stderr, "Input file doesn't exist\n");
+        return 2;
+      }
+      input_file_exists = true;
+      input_file = optarg;
+      break;
+    case 'o': /* Output FIle */
+      output_file_exists = true;
+      output_file = optarg;
+      break;
+    case 'v': /* Enabling Stats */
+      print_stats = true;
+      break;
+    case 'c': /* Only counting the matches */
+      count_only = true;
+      break;
+    case 'C': /* Setting the context around matches */
+      context = strtoul(optarg, NULL, 10);
+      break;
+    case 'e': /* Setting the pattern */
+      pattern = optarg;
+      break;
+    default: /* Bad Option */
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (pattern == NULL || pattern[0] == '\0') {
+    fprintf(stderr, "Missing pattern\n");
+    usage(argv[0]);
+    return 2;
+  }
+  if (context > CONTEXT_MAX) {
+    context = CONTEXT_MAX;
+  }
+  uint32_t m = strlen(pattern);
+
+  int input = 0;
+  if (input_file_exists == true) {
+    input = open(input_file, O_RDONLY);
+    io_advise(input, false);
+  }
+  int output = 1;
+  if (output_file_exists == true) {
+    output = open(output_file, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+  }
+
+  /* Only files of byte symbols coded with a single tree are searched;
+     the other formats code the bytes differently. */
+  Header header = {
+      .magic = 0, .permissions = 0, .tree_size = 0, .file_size = 0};
+  bytes_read = read_bytes(input, (uint8_t *)&header, sizeof(header));
+  if (header.magic == MAGIC_RLE || header.magic == MAGIC_WIDE ||
+      header.magic == MAGIC_FRAMED || header.magic == MAGIC_MEMBER ||
+      header.magic == MAGIC_DEDUP || header.magic == MAGIC_ENTROPY ||
+      header.magic == MAGIC_CONTEXT || header.magic == MAGIC_DELTA) {
+    fprintf(stderr, "Unsupported format, decode and search instead\n");
+    return 2;
+  }
+  if (header.magic != MAGIC) {
+    fprintf(stderr, "Invalid magic number\n");
+    return 2;
+  }
+
+  uint8_t tree[header.tree_size];
+  bytes_read += read_bytes(input, tree, header.tree_size);
+  if (valid_dump(tree, header.tree_size) == false) {
+    fprintf(stderr, "Invalid tree\n");
+    return 2;
+  }
+  Node *root = rebuild_tree(header.tree_size, tree);
+
+  /* Translates the pattern into the codes it is stored as.  If one of
+     its bytes has no code, it never occurs in the file and the
+     compressed data doesn't have to be read at all. */
+  Code table[ALPHABET] = {0};
+  build_codes(root, table);
+  uint64_t pattern_bits = 0;
+  bool possible = true;
+  for (uint32_t i = 0; i < m; i++) {
+    uint32_t size = code_size(&table[(uint8_t)pattern[i]]);
+    pattern_bits += size;
+    possible = possible && size > 0;
+  }
+
+  /* The window keeps context bytes before the first start position that
+     isn't searched yet, and a match and its context after it are only
+     searched for once they have been decoded completely. */
+  Reader r = {.infile = input,
+              .table = (UnpackTable *)malloc(sizeof(UnpackTable)),
+              .root = root,
+              .left = possible == true ? header.file_size : 0};
+  unpack_create(r.table, root);
+  unpack_input_create(&r.input, io_block);
+
+  uint32_t capacity = (2 * context) + m + WINDOW;
+  uint8_t *buf = (uint8_t *)malloc(capacity);
+  uint32_t have = 0;  /* Decoded bytes in the window. */
+  uint32_t scan = 0;  /* First start position not searched yet. */
+  uint64_t base = 0;  /* Offset of the window in the decompressed data. */
+  uint64_t matches = 0;
+
+  while (true) {
+    uint32_t n = read_symbols(&r, buf + have, WINDOW);
+    have += n;
+    bool done = n == 0 || r.left == 0;
+
+    uint32_t keep = done == true ? m : m + context;
+    uint32_t limit = have >= keep ? have - keep + 1 : 0;
+    while (scan < limit) {
+      uint8_t *p =
+          (uint8_t *)memmem(buf + scan, limit - scan + m - 1, pattern, m);
+      if (p == NULL) {
+        break;
+      }
+      uint32_t pos = p - buf;
+      if (count_only == false) {
+        print_match(output, base + pos, buf, have, pos, m, context);
+      }
+      matches++;
+      scan = pos + 1;
+    }
+    if (scan < limit) {
+      scan = limit;
+    }
+    if (done == true) {
+      break;
+    }
+
+    uint32_t drop = scan > context ? scan - context : 0;
+    memmove(buf, buf + drop, have - drop);
+    have -= drop;
+    scan -= drop;
+    base += drop;
+  }
+
+  if (count_only == true) {
+    char line[32];
+    int n = snprintf(line, sizeof(line), "%" PRIu64 "\n", matches);
+    write_symbols(output, (uint8_t *)line, n);
+  }
+  flush_codes(output);
+
+  if (print_stats == true) {
+    fprintf(stderr, "Pattern code: %" PRIu64 " bits", pattern_bits);
+    fprintf(stderr, possible == true ? "\n" : " (not in the tree)\n");
+    fprintf(stderr, "Compressed bytes read: %" PRIu64 "\n", bytes_read);
+    fprintf(stderr, "Symbols decoded: %" PRIu64 "\n",
+            possible == true ? header.file_size - r.left : 0);
+    fprintf(stderr, "Matches: %" PRIu64 "\n", matches);
+  }
+
+  free(buf);
+  unpack_input_delete(&r.input);
+  free(r.table);
+  delete_tree(&root);
+  close(input);
+  close(output);
+  return matches > 0 ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+#include "spool.h"
+#include "defines.h"
+#include "io.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Opens an unnamed temporary file in $TMPDIR, or /tmp if it isn't set.
+   The file is never linked into the directory where possible, and
+   unlinked right away otherwise, so concurrent encoders never share it
+   and it disappears with the last file descriptor. */
+static int open_tmpfile(void) {
+  const char *dir = getenv("TMPDIR");
+  if (dir == NULL || dir[0] == '\0') {
+    dir = "/tmp";
+  }
+
+  int fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+  if (fd >= 0) {
+    return fd;
+  }
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/encode.XXXXXX", dir);
+  fd = mkstemp(path);
+  if (fd >= 0) {
+    unlink(path);
+  }
+  return fd;
+}
+
+/* Moves the spooled bytes from memory into a temporary file.  Returns
+   false if the temporary file can't be created or written. */
+static bool spill(Spool *s) {
+  int fd = open_tmpfile();
+  if (fd < 0) {
+    return false;
+  }
+
+  uint8_t block[BLOCK];
+  int nbytes = 0;
+  bool written = true;
+  lseek(s->fd, 0, SEEK_SET);
+  while (written == true && (nbytes = read_bytes(s->fd, block, BLOCK)) > 0) {
+    written = write_bytes(fd, block, nbytes) == nbytes;
+  }
+  if (written == false) {
+    close(fd);
+    return false;
+  }
+
+  close(s->fd);
+  s->fd = fd;
+  s->spilled = true;
+  return true;
+}
+
+/* Opens a spool that keeps up to limit bytes in an anonymous memory file
+   before it spills to $TMPDIR.  Falls back to a temporary file right away
+   if memory files aren't supported.  Returns false if neither works. */
+bool spool_open(Spool *s, uint64_t limit) {
+  s->size = 0;
+  s->limit = limit;
+  s->spilled = false;
+  s->failed = false;
+  s->fd = memfd_create("encode-stdin", MFD_CLOEXEC);
+
+  if (s->fd < 0) {
+    s->fd = open_tmpfile();
+    s->spilled = true;
+  }
+  return s->fd >= 0;
+}
+
+/* Appends n bytes of buf to the spool, spilling it to $TMPDIR first if it
+   would grow beyond its limit.  Returns false if the spool couldn't be
+   spilled or written, which is reported once, and every write after that
+   fails too. */
+bool spool_write(Spool *s, uint8_t *buf, uint32_t n) {
+  if (s->failed == true) {
+    return false;
+  }
+  if (s->spilled == false && s->size + n > s->limit && spill(s) == false) {
+    fprintf(stderr, "Unable to spill the spool to a temporary file\n");
+    s->failed = true;
+    return false;
+  }
+  if (write_bytes(s->fd, buf, n) != (int)n) {
+    fprintf(stderr, "Unable to write the spool\n");
+    s->failed = true;
+    return false;
+  }
+  s->size += n;
+  return true;
+}
+
+/* Returns the file descriptor of the spool positioned at its start, so
+   the spooled input can be read again. */
+int spool_rewind(Spool *s) {
+  lseek(s->fd, 0, SEEK_SET);
+  return s->fd;
+}
+
+/* Closes the spool and releases its memory or temporary file. */
+void spool_close(Spool *s) {
+  if (s->fd >= 0) {
+    close(s->fd);
+    s->fd = -1;
+  }
+}
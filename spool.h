@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SPOOL_LIMIT 256 // Default MiB of stdin kept in memory.
+
+typedef struct {
+    int fd;         // Anonymous memory file, or a temporary file once spilled.
+    uint64_t size;  // Bytes spooled so far.
+    uint64_t limit; // Bytes kept in memory before spilling to $TMPDIR.
+    bool spilled;   // True once the spool lives in $TMPDIR.
+    bool failed;    // True once a write to the spool failed.
+} Spool;
+
+bool spool_open(Spool *s, uint64_t limit);
+
+bool spool_write(Spool *s, uint8_t *buf, uint32_t n);
+
+int spool_rewind(Spool *s);
+
+void spool_close(Spool *s);
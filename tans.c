@@ -0,0 +1,313 @@
+#include "tans.h"
+#include "bitpack.h"
+#include "hist.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* A table-based asymmetric numeral system (tANS) coder, laid out like
+   FSE.  The coder's state is a number in [TANS_SIZE, 2 * TANS_SIZE), and
+   each symbol owns as many states as its normalized count, spread over
+   the table.  Coding a symbol outputs the low bits of the state and moves
+   to one of the symbol's states, so a symbol of probability p costs
+   -log2(p) bits on average, fractions of a bit included, where a Huffman
+   code would round to whole bits.
+
+   Symbols are coded from last to first, with the bits written forwards,
+   and the decoder reads the bits backwards from the end to get the
+   symbols first to last.  Two states take turns on the symbols, so the
+   decoder's table lookups for neighbouring symbols don't wait on each
+   other. */
+
+/* Returns the position of the highest set bit of x, for x > 0. */
+static inline uint32_t highbit(uint32_t x) { return 31 - __builtin_clz(x); }
+
+/* Returns the 8 bytes at p as a little-endian number. */
+static inline uint64_t load64(const uint8_t *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+/* Scales the counts of hist to sum to TANS_SIZE, keeping every symbol
+   that occurs at a count of at least 1.  Counts are rounded down and the
+   states left over go to the symbols that lost the most by rounding.  A
+   histogram without symbols is given two so the tables are never empty. */
+static void normalize(uint64_t hist[static ALPHABET],
+                      uint16_t count[static ALPHABET]) {
+  uint64_t total = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    total += hist[s];
+  }
+  memset(count, 0, ALPHABET * sizeof(uint16_t));
+  if (total == 0) {
+    count[0] = TANS_SIZE / 2;
+    count[1] = TANS_SIZE / 2;
+    return;
+  }
+
+  uint64_t rest[ALPHABET]; /* What rounding down cut off, scaled. */
+  uint32_t sum = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    rest[s] = 0;
+    if (hist[s] > 0) {
+      uint64_t scaled = hist[s] * TANS_SIZE;
+      count[s] = scaled / total;
+      rest[s] = scaled % total;
+      if (count[s] == 0) {
+        count[s] = 1;
+        rest[s] = 0;
+      }
+      sum += count[s];
+    }
+  }
+
+  while (sum < TANS_SIZE) {
+    uint32_t best = 0;
+    for (uint32_t s = 1; s < ALPHABET; s++) {
+      if (hist[s] > 0 && (hist[best] == 0 || rest[s] > rest[best])) {
+        best = s;
+      }
+    }
+    count[best]++;
+    rest[best] = 0;
+    sum++;
+  }
+  while (sum > TANS_SIZE) {
+    uint32_t most = 0;
+    for (uint32_t s = 1; s < ALPHABET; s++) {
+      if (count[s] > count[most]) {
+        most = s;
+      }
+    }
+    count[most]--;
+    sum--;
+  }
+}
+
+/* Builds the encoder and decoder tables from the normalized counts of t.
+   The states of a symbol are spread over the table with a step that is
+   coprime to its size, so every symbol's states are interleaved with
+   the others'. */
+static void build_tables(TansTable *t) {
+  uint8_t spread[TANS_SIZE];
+  uint32_t step = (TANS_SIZE >> 1) + (TANS_SIZE >> 3) + 3;
+  uint32_t pos = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    for (uint32_t i = 0; i < t->count[s]; i++) {
+      spread[pos] = s;
+      pos = (pos + step) & (TANS_SIZE - 1);
+    }
+  }
+
+  uint32_t start[ALPHABET];
+  uint32_t total = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    start[s] = total;
+    total += t->count[s];
+  }
+  for (uint32_t u = 0; u < TANS_SIZE; u++) {
+    t->state[start[spread[u]]++] = TANS_SIZE + u;
+  }
+
+  total = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    uint32_t n = t->count[s];
+    t->cost[s] = (TANS_LOG << 16) - (n > 0 ? hist_log2(n) : 0);
+    if (n == 0) {
+      t->delta_bits[s] = 0;
+      t->delta_state[s] = 0;
+    } else if (n == 1) {
+      t->delta_bits[s] = (TANS_LOG << 16) - TANS_SIZE;
+      t->delta_state[s] = (int32_t)total - 1;
+    } else {
+      uint32_t max_bits = TANS_LOG - highbit(n - 1);
+      t->delta_bits[s] = (max_bits << 16) - (n << max_bits);
+      t->delta_state[s] = (int32_t)total - (int32_t)n;
+    }
+    total += n;
+  }
+
+  uint32_t next[ALPHABET];
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    next[s] = t->count[s];
+  }
+  for (uint32_t u = 0; u < TANS_SIZE; u++) {
+    uint8_t s = spread[u];
+    uint32_t x = next[s]++;
+    uint32_t nbits = TANS_LOG - highbit(x);
+    t->decode[u] = (TansEntry){.next = (x << nbits) - TANS_SIZE,
+                               .symbol = s,
+                               .nbits = nbits};
+  }
+}
+
+/* Builds a table from the histogram of the input. */
+static void *tans_build(uint64_t hist[static ALPHABET]) {
+  TansTable *t = (TansTable *)malloc(sizeof(TansTable));
+  normalize(hist, t->count);
+  build_tables(t);
+  return t;
+}
+
+/* Writes which symbols have a count as a 32-byte bitmap, followed by the
+   normalized counts of those symbols, 2 bytes each, which is all the
+   decoder needs to build the same tables. */
+static void tans_dump(void *table, int outfile) {
+  TansTable *t = (TansTable *)table;
+  uint8_t buf[(ALPHABET / 8) + (2 * ALPHABET)] = {0};
+  uint32_t size = ALPHABET / 8;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    if (t->count[s] > 0) {
+      buf[s / 8] |= 1 << (s % 8);
+      buf[size++] = t->count[s] & 0xFF;
+      buf[size++] = t->count[s] >> 8;
+    }
+  }
+  bytes_written += write_bytes(outfile, buf, size);
+}
+
+/* Reads the normalized counts written by tans_dump() and builds the
+   tables.  Returns NULL if they don't sum to TANS_SIZE. */
+static void *tans_load(int infile) {
+  uint8_t map[ALPHABET / 8];
+  int got = read_bytes(infile, map, sizeof(map));
+  bytes_read += got;
+  if (got < (int)sizeof(map)) {
+    return NULL;
+  }
+  uint32_t present = 0;
+  for (uint32_t b = 0; b < sizeof(map); b++) {
+    present += __builtin_popcount(map[b]);
+  }
+  uint8_t buf[2 * ALPHABET];
+  got = read_bytes(infile, buf, 2 * present);
+  bytes_read += got;
+  if (got < (int)(2 * present)) {
+    return NULL;
+  }
+
+  TansTable *t = (TansTable *)malloc(sizeof(TansTable));
+  uint32_t sum = 0;
+  uint32_t k = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    t->count[s] = 0;
+    if ((map[s / 8] >> (s % 8)) & 0x1) {
+      t->count[s] = buf[k] | (buf[k + 1] << 8);
+      k += 2;
+    }
+    sum += t->count[s];
+  }
+  if (sum != TANS_SIZE) {
+    free(t);
+    return NULL;
+  }
+  build_tables(t);
+  return t;
+}
+
+/* Returns the bits needed to code the symbols counted in hist, which is
+   exact up to how far the states are from the middle of their range. */
+static uint64_t tans_cost(void *table, uint64_t hist[static ALPHABET]) {
+  TansTable *t = (TansTable *)table;
+  uint64_t bits = 0;
+  for (uint32_t s = 0; s < ALPHABET; s++) {
+    if (hist[s] > 0 && t->count[s] == 0) {
+      return UINT64_MAX;
+    }
+    bits += hist[s] * t->cost[s];
+  }
+  return (bits >> 16) + (2 * TANS_LOG);
+}
+
+/* Codes the n symbols of in into out, which must have room for TANS_LOG
+   bits per symbol and 16 more bytes, and returns the amount of bits.
+   Every symbol must have a count. */
+static uint64_t tans_encode(void *table, const uint8_t *in, uint32_t n,
+                            uint8_t *out) {
+  TansTable *t = (TansTable *)table;
+  uint32_t x[2] = {TANS_SIZE, TANS_SIZE};
+  uint64_t acc = 0;
+  uint32_t nacc = 0;
+  uint64_t byte = 0;
+
+  for (uint32_t i = n; i-- > 0;) {
+    uint8_t s = in[i];
+    uint32_t *state = &x[i & 1];
+    uint32_t nbits = (*state + t->delta_bits[s]) >> 16;
+    acc |= (uint64_t)(*state & ((1u << nbits) - 1)) << nacc;
+    nacc += nbits;
+    *state = t->state[(*state >> nbits) + t->delta_state[s]];
+
+    if (nacc >= 32) {
+      memcpy(out + byte, &acc, 4);
+      byte += 4;
+      acc >>= 32;
+      nacc -= 32;
+    }
+  }
+
+  /* The final states go last, so the decoder reads them first. */
+  acc |= (uint64_t)(x[1] - TANS_SIZE) << nacc;
+  nacc += TANS_LOG;
+  acc |= (uint64_t)(x[0] - TANS_SIZE) << nacc;
+  nacc += TANS_LOG;
+  memcpy(out + byte, &acc, 8);
+  return (8 * byte) + nacc;
+}
+
+/* Reads the nbits bits that end at *pos, moving *pos back over them. */
+static inline uint32_t read_back(const uint8_t *in, uint64_t *pos,
+                                 uint32_t nbits) {
+  *pos -= nbits;
+  return (load64(in + (*pos / 8)) >> (*pos % 8)) & ((1u << nbits) - 1);
+}
+
+/* Decodes n symbols from the nbits bits of in into out.  Decoding must
+   end with both states back where the encoder started them, having read
+   every bit, which catches most corruption.  Returns false otherwise. */
+static bool tans_decode(void *table, const uint8_t *in, uint64_t nbits,
+                        uint8_t *out, uint32_t n) {
+  TansTable *t = (TansTable *)table;
+  uint64_t pos = nbits;
+  if (pos < 2 * TANS_LOG) {
+    return false;
+  }
+  uint32_t x0 = read_back(in, &pos, TANS_LOG);
+  uint32_t x1 = read_back(in, &pos, TANS_LOG);
+
+  uint32_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    TansEntry e0 = t->decode[x0];
+    TansEntry e1 = t->decode[x1];
+    if (e0.nbits + e1.nbits > pos) {
+      return false;
+    }
+    out[i] = e0.symbol;
+    out[i + 1] = e1.symbol;
+    x0 = e0.next + read_back(in, &pos, e0.nbits);
+    x1 = e1.next + read_back(in, &pos, e1.nbits);
+  }
+  if (i < n) {
+    TansEntry e0 = t->decode[x0];
+    if (e0.nbits > pos) {
+      return false;
+    }
+    out[i] = e0.symbol;
+    x0 = e0.next + read_back(in, &pos, e0.nbits);
+  }
+  return pos == 0 && x0 == 0 && x1 == 0;
+}
+
+/* Frees a table. */
+static void tans_destroy(void *table) { free(table); }
+
+const Backend tans_backend = {.name = "tans",
+                              .id = 'A',
+                              .build = tans_build,
+                              .dump = tans_dump,
+                              .load = tans_load,
+                              .cost = tans_cost,
+                              .encode = tans_encode,
+                              .decode = tans_decode,
+                              .destroy = tans_destroy};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "defines.h"
+#include "entropy.h"
+#include <stdint.h>
+
+#define TANS_LOG  11              // Bits of the coder's state.
+#define TANS_SIZE (1 << TANS_LOG) // Amount of states.
+
+typedef struct {
+    uint16_t next;  // State before the bits read, which are added to it.
+    uint8_t symbol; // Symbol decoded in the state.
+    uint8_t nbits;  // Bits read after decoding the symbol.
+} TansEntry;
+
+typedef struct {
+    uint16_t count[ALPHABET];       // Counts normalized to sum to TANS_SIZE.
+    uint32_t cost[ALPHABET];        // Bits per symbol in 16.16 fixed point.
+    uint16_t state[TANS_SIZE];      // Encoder states, grouped by symbol.
+    int32_t delta_state[ALPHABET];  // Offset of a symbol's group in state.
+    uint32_t delta_bits[ALPHABET];  // Bits a symbol outputs, in 16.16 form.
+    TansEntry decode[TANS_SIZE];    // Decoder entry of every state.
+} TansTable;
+
+extern const Backend tans_backend;
@@ -0,0 +1,335 @@
+#include "wide.h"
+#include "bitpack.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Codes 16-bit symbols, which are pairs of bytes in little-endian order.
+   The symbols get canonical Huffman codes, so only the code length of each
+   symbol that occurs is stored, and codes are written bit reversed so the
+   first bit of a code is the first bit in the stream like write_code(). */
+
+/* A symbol that occurs in the input together with its frequency. */
+typedef struct {
+  uint64_t frequency;
+  uint32_t symbol;
+} Leaf;
+
+/* Orders leaves by frequency and then by symbol so the code lengths don't
+   depend on the sort implementation. */
+static int leaf_cmp(const void *a, const void *b) {
+  const Leaf *x = (const Leaf *)a;
+  const Leaf *y = (const Leaf *)b;
+  if (x->frequency != y->frequency) {
+    return x->frequency < y->frequency ? -1 : 1;
+  }
+  return x->symbol < y->symbol ? -1 : x->symbol > y->symbol;
+}
+
+/* Computes the Huffman code length of the n leaves sorted by frequency.
+   Since the leaves are sorted and every joined node weighs at least as
+   much as the one joined before it, the two lightest nodes are always at
+   the front of either the leaves or the joined nodes, so the tree is
+   built in linear time without a priority queue.  Returns the longest
+   code length. */
+static uint32_t code_lengths(Leaf *leaves, uint32_t n, uint8_t *length) {
+  if (n == 1) {
+    length[leaves[0].symbol] = 1;
+    return 1;
+  }
+
+  uint64_t *weight = (uint64_t *)malloc(n * sizeof(uint64_t));
+  uint32_t *parent = (uint32_t *)malloc(n * sizeof(uint32_t));
+  uint32_t *leaf_parent = (uint32_t *)malloc(n * sizeof(uint32_t));
+  uint32_t *depth = (uint32_t *)malloc(n * sizeof(uint32_t));
+  uint32_t i = 0; /* Next leaf to join. */
+  uint32_t j = 0; /* Next joined node to join. */
+
+  for (uint32_t k = 0; k < n - 1; k++) {
+    weight[k] = 0;
+    for (uint32_t pick = 0; pick < 2; pick++) {
+      if (i < n && (j >= k || leaves[i].frequency <= weight[j])) {
+        weight[k] += leaves[i].frequency;
+        leaf_parent[i++] = k;
+      } else {
+        weight[k] += weight[j];
+        parent[j++] = k;
+      }
+    }
+  }
+
+  /* Joined node n - 2 is the root, and parents always come after their
+     children, so depths are resolved from the root downwards. */
+  uint32_t longest = 0;
+  depth[n - 2] = 0;
+  for (uint32_t k = n - 2; k-- > 0;) {
+    depth[k] = depth[parent[k]] + 1;
+  }
+  for (uint32_t l = 0; l < n; l++) {
+    length[leaves[l].symbol] = depth[leaf_parent[l]] + 1;
+    if (length[leaves[l].symbol] > longest) {
+      longest = length[leaves[l].symbol];
+    }
+  }
+
+  free(weight);
+  free(parent);
+  free(leaf_parent);
+  free(depth);
+  return longest;
+}
+
+/* Returns the low len bits of code in reverse order. */
+static uint32_t reverse(uint32_t code, uint32_t len) {
+  uint32_t r = 0;
+  for (uint32_t b = 0; b < len; b++) {
+    r = (r << 1) | ((code >> b) & 0x1);
+  }
+  return r;
+}
+
+/* Assigns canonical codes from the code lengths and fills the decode
+   table.  Codes of the same length are consecutive in symbol order. */
+static void canonical(WideTable *t) {
+  memset(t->count, 0, sizeof(t->count));
+  memset(t->lookup, 0, sizeof(t->lookup));
+  for (uint32_t s = 0; s < WIDE_ALPHABET; s++) {
+    t->count[t->length[s]]++;
+  }
+
+  uint32_t next[WIDE_MAX_LEN + 1];
+  uint32_t code = 0;
+  uint32_t index = 0;
+  t->count[0] = 0;
+  for (uint32_t len = 1; len <= WIDE_MAX_LEN; len++) {
+    code = (code + t->count[len - 1]) << 1;
+    t->first[len] = code;
+    t->offset[len] = index;
+    next[len] = code;
+    index += t->count[len];
+  }
+
+  for (uint32_t s = 0; s < WIDE_ALPHABET; s++) {
+    uint32_t len = t->length[s];
+    if (len == 0) {
+      continue;
+    }
+    t->sorted[t->offset[len] + next[len] - t->first[len]] = s;
+    t->code[s] = reverse(next[len]++, len);
+
+    /* Every index whose low len bits are the code decodes to s. */
+    if (len <= WIDE_BITS) {
+      for (uint32_t i = t->code[s]; i < (1u << WIDE_BITS); i += 1u << len) {
+        t->lookup[i] = s | (len << 16);
+      }
+    }
+  }
+}
+
+/* Constructs the code table of the 16-bit symbols counted in hist.  If a
+   code would be longer than WIDE_MAX_LEN bits, the frequencies are scaled
+   down and the lengths computed again until they fit. */
+WideTable *wide_create(uint64_t hist[static WIDE_ALPHABET]) {
+  WideTable *t = (WideTable *)calloc(1, sizeof(WideTable));
+  Leaf *leaves = (Leaf *)malloc(WIDE_ALPHABET * sizeof(Leaf));
+
+  for (uint32_t s = 0; s < WIDE_ALPHABET; s++) {
+    if (hist[s] > 0) {
+      leaves[t->nsymbols].frequency = hist[s];
+      leaves[t->nsymbols].symbol = s;
+      t->nsymbols++;
+    }
+  }
+
+  if (t->nsymbols > 0) {
+    qsort(leaves, t->nsymbols, sizeof(Leaf), leaf_cmp);
+    while (code_lengths(leaves, t->nsymbols, t->length) > WIDE_MAX_LEN) {
+      for (uint32_t l = 0; l < t->nsymbols; l++) {
+        leaves[l].frequency = (leaves[l].frequency >> 1) | 1;
+      }
+    }
+    canonical(t);
+  }
+
+  free(leaves);
+  return t;
+}
+
+/* Frees the code table. */
+void wide_delete(WideTable **t) {
+  if (*t != NULL) {
+    free(*t);
+    *t = NULL;
+  }
+}
+
+/* Writes the code table to outfile.  The table is the amount of bytes that
+   follow it as 4 bytes, the amount of symbols as 4 bytes and the tail
+   byte, followed by every symbol that has a code in increasing order as
+   the gap to the previous symbol in 7-bit groups and its code length. */
+void wide_dump(int outfile, WideTable *t) {
+  uint8_t *buf = (uint8_t *)malloc(9 + (4 * (size_t)t->nsymbols));
+  uint32_t n = 4;
+  uint32_t prev = 0;
+
+  for (uint32_t b = 0; b < 4; b++) {
+    buf[n++] = (t->nsymbols >> (8 * b)) & 0xFF;
+  }
+  buf[n++] = t->tail;
+
+  for (uint32_t s = 0; s < WIDE_ALPHABET; s++) {
+    if (t->length[s] == 0) {
+      continue;
+    }
+    uint32_t gap = s - prev;
+    while (gap >= 0x80) {
+      buf[n++] = (gap & 0x7F) | 0x80;
+      gap >>= 7;
+    }
+    buf[n++] = gap;
+    buf[n++] = t->length[s];
+    prev = s + 1;
+  }
+
+  for (uint32_t b = 0; b < 4; b++) {
+    buf[b] = ((n - 4) >> (8 * b)) & 0xFF;
+  }
+  bytes_written += write_bytes(outfile, buf, n);
+  free(buf);
+}
+
+/* Reads a code table written by wide_dump() from infile.  Returns NULL if
+   the table is truncated or its code lengths are invalid. */
+WideTable *wide_load(int infile) {
+  uint8_t size[4];
+  bytes_read += read_bytes(infile, size, 4);
+  uint32_t nbytes = size[0] | size[1] << 8 | size[2] << 16 |
+                    (uint32_t)size[3] << 24;
+  if (nbytes < 5 || nbytes > 5 + (4 * WIDE_ALPHABET)) {
+    return NULL;
+  }
+
+  uint8_t *buf = (uint8_t *)malloc(nbytes);
+  uint32_t got = read_bytes(infile, buf, nbytes);
+  bytes_read += got;
+
+  WideTable *t = (WideTable *)calloc(1, sizeof(WideTable));
+  t->nsymbols = buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24;
+  t->tail = buf[4];
+
+  uint32_t n = 5;
+  uint32_t s = 0;
+  bool valid = got == nbytes && t->nsymbols <= WIDE_ALPHABET;
+  for (uint32_t i = 0; i < t->nsymbols && valid == true; i++) {
+    uint32_t gap = 0;
+    for (uint32_t shift = 0; n < nbytes && shift < 21; shift += 7) {
+      gap |= (uint32_t)(buf[n] & 0x7F) << shift;
+      if ((buf[n++] & 0x80) == 0) {
+        break;
+      }
+    }
+    s += gap;
+    valid = n < nbytes && s < WIDE_ALPHABET && buf[n] >= 1 &&
+            buf[n] <= WIDE_MAX_LEN;
+    if (valid == true) {
+      t->length[s++] = buf[n++];
+    }
+  }
+
+  free(buf);
+  if (valid == false) {
+    wide_delete(&t);
+    return NULL;
+  }
+  canonical(t);
+  return t;
+}
+
+/* Writes the codes of the n / 2 byte pairs in buf to outfile.  A trailing
+   odd byte is not coded, it is kept in the table. */
+void wide_encode(int outfile, WideTable *t, const uint8_t *buf, uint32_t n) {
+  for (uint32_t i = 0; i + 2 <= n; i += 2) {
+    uint32_t s = buf[i] | (buf[i + 1] << 8);
+    write_bits(outfile, t->code[s], t->length[s]);
+  }
+}
+
+/* Decodes the symbol whose code starts at bit pos of in, which holds
+   nbits readable bits followed by at least 8 zero bytes.  Codes that fit
+   the lookup table take one lookup, longer codes are resolved one bit at a
+   time with the canonical code ranges.  Returns false if the input ends
+   in the middle of a code. */
+static bool decode_one(WideTable *t, const uint8_t *in, uint64_t *pos,
+                       uint64_t nbits, uint16_t *symbol) {
+  uint64_t w;
+  memcpy(&w, in + (*pos / 8), sizeof(w));
+  w >>= *pos % 8;
+
+  uint32_t e = t->lookup[w & ((1u << WIDE_BITS) - 1)];
+  uint32_t len = e >> 16;
+  if (len != 0) {
+    *symbol = e & 0xFFFF;
+  } else {
+    uint32_t code = 0;
+    for (len = 1; len <= WIDE_MAX_LEN; len++) {
+      code = (code << 1) | ((w >> (len - 1)) & 0x1);
+      if (code - t->first[len] < t->count[len]) {
+        *symbol = t->sorted[t->offset[len] + code - t->first[len]];
+        break;
+      }
+    }
+  }
+
+  if (len > WIDE_MAX_LEN || *pos + len > nbits) {
+    return false;
+  }
+  *pos += len;
+  return true;
+}
+
+/* Decodes nbytes bytes from infile to outfile, two bytes per symbol.  The
+   input is refilled a block at a time with unpack_refill() and the tail
+   byte of an odd-sized output is written last.  Returns false if the
+   input holds a bit pattern that is no code, which an incomplete
+   canonical code like that of a single symbol has. */
+bool wide_decode(int infile, int outfile, WideTable *t, uint64_t nbytes) {
+  UnpackInput u;
+  unpack_input_create(&u, BLOCK);
+  uint8_t out[BLOCK];
+  uint64_t pairs = nbytes / 2;
+  bool valid = true;
+
+  while (pairs > 0 && t->nsymbols > 0) {
+    bytes_read += unpack_refill(&u, infile, read_bytes);
+
+    /* Stops at one block of output or once the lookahead runs low. */
+    uint32_t k = 0;
+    uint16_t s = 0;
+    while (k < BLOCK && pairs > 0 &&
+           (u.eof == true || u.bit + (8 * 64) <= 8 * (uint64_t)u.have) &&
+           decode_one(t, u.in, &u.bit, 8 * (uint64_t)u.have, &s) == true) {
+      out[k++] = s & 0xFF;
+      out[k++] = s >> 8;
+      pairs--;
+    }
+
+    if (k == 0 && u.eof == true) {
+      break;
+    }
+
+    /* Nothing was decoded with a full block of lookahead, so the next
+       code is no code at all, and refilling wouldn't change that. */
+    if (k == 0 && u.have - (u.bit / 8) >= BLOCK) {
+      valid = false;
+      break;
+    }
+    write_symbols(outfile, out, k);
+  }
+  unpack_input_delete(&u);
+
+  if (valid == true && nbytes % 2 == 1) {
+    write_symbol(outfile, t->tail);
+  }
+  flush_codes(outfile);
+  return valid;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WIDE_ALPHABET 65536 // Every 16-bit symbol.
+#define WIDE_MAX_LEN  24    // Longest code, codes are rescaled to fit.
+#define WIDE_BITS     12    // Bits resolved by one decode table lookup.
+
+typedef struct {
+    uint32_t nsymbols;                 // Symbols that have a code.
+    uint8_t length[WIDE_ALPHABET];     // Code length of each symbol, or 0.
+    uint32_t code[WIDE_ALPHABET];      // Canonical codes, bit reversed.
+    uint16_t sorted[WIDE_ALPHABET];    // Symbols in canonical code order.
+    uint32_t first[WIDE_MAX_LEN + 1];  // First canonical code of a length.
+    uint32_t count[WIDE_MAX_LEN + 1];  // Codes of a length.
+    uint32_t offset[WIDE_MAX_LEN + 1]; // Index of a length's first symbol.
+    uint32_t lookup[1 << WIDE_BITS];   // Symbol and length, 0 if longer.
+    uint8_t tail;                      // Last byte of an odd-sized input.
+} WideTable;
+
+WideTable *wide_create(uint64_t hist[static WIDE_ALPHABET]);
+
+void wide_delete(WideTable **t);
+
+void wide_dump(int outfile, WideTable *t);
+
+WideTable *wide_load(int infile);
+
+void wide_encode(int outfile, WideTable *t, const uint8_t *buf, uint32_t n);
+
+bool wide_decode(int infile, int outfile, WideTable *t, uint64_t nbytes);
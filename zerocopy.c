@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include "zerocopy.h"
+#include "defines.h"
+#include "io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static bool enabled = false;
+static uint8_t **pool = NULL; /* Page-aligned io_block byte buffers. */
+static uint32_t pool_size = 0;
+static uint32_t current = 0; /* Index of the buffer being filled. */
+
+/* Frees the buffers.  This is only safe before anything was spliced, as
+   the pipe would otherwise still reference their pages.  Once in use the
+   pool lives until the process exits. */
+static void release_pool(void) {
+  for (uint32_t i = 0; i < pool_size; i++) {
+    free(pool[i]);
+  }
+  free(pool);
+  pool = NULL;
+  pool_size = 0;
+}
+
+/* Enables zero-copy output if outfile is a pipe.  Full output buffers are
+   then handed to the pipe with vmsplice() instead of being copied into it
+   with write().  The pipe keeps referencing the pages of a spliced buffer
+   until the reader consumes them, so a buffer is only refilled after a
+   whole pipe's worth of pages was spliced behind it.  Returns false if
+   outfile isn't a pipe. */
+bool zc_open(int outfile) {
+  struct stat st;
+  if (fstat(outfile, &st) != 0 || S_ISFIFO(st.st_mode) == 0) {
+    return false;
+  }
+
+  int pipe_size = fcntl(outfile, F_GETPIPE_SZ);
+  long page = sysconf(_SC_PAGESIZE);
+  if (pipe_size <= 0 || page <= 0) {
+    return false;
+  }
+
+  /* Every page of a spliced buffer takes up one slot of the pipe. */
+  uint32_t pipe_slots = pipe_size / page;
+  uint32_t buffer_slots = (io_block + page - 1) / page;
+  pool_size = (pipe_slots + buffer_slots - 1) / buffer_slots + 2;
+  pool = (uint8_t **)calloc(pool_size, sizeof(uint8_t *));
+
+  for (uint32_t i = 0; i < pool_size; i++) {
+    if (posix_memalign((void **)&pool[i], page, io_block) != 0) {
+      release_pool();
+      return false;
+    }
+  }
+
+  current = 0;
+  enabled = true;
+  return true;
+}
+
+/* Returns true if zero-copy output is in use. */
+bool zc_enabled(void) { return enabled; }
+
+/* Returns the buffer that should be filled next. */
+uint8_t *zc_buffer(void) { return pool[current]; }
+
+/* Splices nbytes from buf, which must be the buffer last returned by
+   zc_buffer() or zc_submit(), into outfile and returns the next buffer to
+   fill.  Falls back to write() for good if the kernel refuses vmsplice(). */
+uint8_t *zc_submit(int outfile, uint8_t *buf, uint32_t nbytes) {
+  struct iovec iov = {.iov_base = buf, .iov_len = nbytes};
+
+  while (enabled == true && iov.iov_len > 0) {
+    ssize_t ret = vmsplice(outfile, &iov, 1, 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      enabled = false;
+      break;
+    }
+    iov.iov_base = (uint8_t *)iov.iov_base + ret;
+    iov.iov_len -= ret;
+  }
+
+  if (iov.iov_len > 0) {
+    write_bytes(outfile, (uint8_t *)iov.iov_base, iov.iov_len);
+  }
+
+  current = (current + 1) % pool_size;
+  return pool[current];
+}
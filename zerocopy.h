@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool zc_open(int outfile);
+
+bool zc_enabled(void);
+
+uint8_t *zc_buffer(void);
+
+uint8_t *zc_submit(int outfile, uint8_t *buf, uint32_t nbytes);